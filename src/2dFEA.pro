@@ -19,7 +19,10 @@ LIBS += -Wl,-rpath,/home/pranavpr/petsc/arch-linux2-c-debug/lib -Wl,-rpath,/home
 
 unix:QMAKE_RPATHDIR += /usr/local/MATLAB/MATLAB_Production_Server/R2013a/bin/glnxa64
 
-QMAKE_CXXFLAGS += -std=c++11
+QMAKE_CXXFLAGS += -std=c++17 -O3 -march=native -fopenmp
+# per stage C++ allocation counts in the -profile report
+#DEFINES += PROFILE_ALLOCATIONS
+QMAKE_LFLAGS += -fopenmp
 QMAKE_CXX = mpicxx
 
 HEADERS += \
@@ -29,8 +32,20 @@ HEADERS += \
 		quadrature.hpp \
 		element.hpp \
 		stiffelement.hpp \
+		geometry.hpp \
+		stiffkernel.hpp \
+		elemoperator.hpp \
+		stresskernel.hpp \
+		partition.hpp \
+		ordering.hpp \
+		meshparse.hpp \
+		meshcache.hpp \
+		writer.hpp \
+		meshgen.hpp \
+		profiler.hpp \
     functions.h \
-    solver.hpp
+    solver.hpp \
+    postprocessor.hpp
 
 OTHER_FILES += \
 		lapac_example.txt
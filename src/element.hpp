@@ -5,366 +5,199 @@
 #include <iomanip>
 #include "quadrature.hpp"
 #include "mesh.hpp"
-
-// lapack routine : solves AX = B
-extern "C" {
-void dgesv_(int *n, int *nrhs,  double *a,  int  *lda,
-            int *ipivot, double *b, int *ldb, int *info);
-}
+#include "geometry.hpp"
+#include "stiffkernel.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
 
-class Element{
-  friend class EStiffness;
-protected:
-  const Quadrature *Quad;         // quadrature info
-  const Face& face;               // face associated with element
-  double *alpha,*beta;            // mapping coeff to master element
-  double **Na, *Na_data;          // shape function evaluated at quadrature points
-  double *J;                      // jacobian evaluated at quadrature points
-  double *dx_dxi, *dx_deta;       // derivative of x wrt xi and eta evaluated at quadrature points
-  double *dy_dxi, *dy_deta;       // derivative of y wrt xi and eta evaluated at quadrature points
-  double *dxi_dx, *dxi_dy;        // derivative of xi wrt x and y evaluated at quadrature points
-  double *deta_dx, *deta_dy;      // derivative of eta wrt x and y evaluated at quadrature points
-  double *dN1_dxi, *dN1_deta;
-  double *dN2_dxi, *dN2_deta;
-  double *dN3_dxi, *dN3_deta;
-  double *dN4_dxi, *dN4_deta;
-
-public:
-
-  Element(Quadrature const* quad, const Face& f);
-  virtual ~Element();
-
-  virtual void Element_setup(vector<Node> const&) = 0;
-  virtual void Compute_mapping_coeff(vector<Node> const&) = 0;
-  virtual void Compute_Shape_Function() = 0;
-  virtual void Compute_dX_dXI() = 0;
-  virtual void Compute_Jacobian() = 0;
-  virtual void Compute_dXI_dX() = 0;
-  virtual void Compute_dN_dXI() = 0;
-
-};
-
-
-
-class Quad4 : public Element{
-  friend class EStiffness;
-protected:
+/*
+ * CLASS QUAD_GEOMETRY -> quadrature point geometry of the quadrilaterals of
+ * one kind, NN nodes and NQ quadrature points known at compile time. The
+ * reference tables of the Quadrature object are copied into fixed size
+ * arrays; elements are processed W at a time (one per SIMD lane, batches of
+ * STIFF_BATCH as for the stiffness) from nodal coordinates gathered
+ * element-fastest, and the results are written into the Element_Geometry
+ * store. No virtual calls and no per element scratch.
+ *
+ * Quad4 uses the bilinear mapping x = a0 + a1*xi + a2*eta + a3*xi*eta with
+ * the coefficients from the inverse of the reference mapping; the quadratic
+ * elements are isoparametric, x = sum N_a x_a.
+ */
+template<int NN, int NQ>
+class Quad_Geometry{
+private:
+  Element_Geometry& G;
+  double dN_dxi[NN][NQ], dN_deta[NN][NQ];  // reference gradients at the quadrature points
+  double QXi[NQ], QEta[NQ];
+  double Minv[4][4];                        // Quad4: mapping coefficients from the corners
 
 public:
-  Quad4(Quadrature const*, const Face&);
-  ~Quad4();
-  virtual void Element_setup(vector<Node> const&);
-  virtual void Compute_mapping_coeff(vector<Node> const&);
-  virtual void Compute_Shape_Function();
-  virtual void Compute_dX_dXI();
-  virtual void Compute_Jacobian();
-  virtual void Compute_dXI_dX();
-  virtual void Compute_dN_dXI();
+  Quad_Geometry(const Quadrature&, Element_Geometry&);
+  template<int W> void Batch(const double*, const double*, size_t) const;
+  void Setup(const double*, const double*, Element_Block const&, const int*, long, int) const;
 };
 
 
-
-
-
-// Functions
-
-Element::Element(Quadrature const* quad, const Face& f)
-  :Quad(quad), face(f)
-{
-  alpha = NULL;
-  beta = NULL;
-  Na = NULL;
-  Na_data = NULL;
-  J = NULL;
-  dx_dxi = NULL;
-  dx_deta = NULL;
-  dy_dxi = NULL;
-  dy_deta = NULL;
-  dxi_dx = NULL;
-  dxi_dy = NULL;
-  deta_dx = NULL;
-  deta_dy = NULL;
-  dN1_dxi = NULL;
-  dN1_deta = NULL;
-  dN2_dxi = NULL;
-  dN2_deta = NULL;
-  dN3_dxi = NULL;
-  dN3_deta = NULL;
-  dN4_dxi = NULL;
-  dN4_deta = NULL;
-}
-
-
-//free memory
-Element :: ~Element(){
-  if(alpha != NULL){
-    delete [] alpha;
-  }
-  if(beta != NULL){
-    delete [] beta;
-  }
-  if(Na != NULL){
-    delete [] Na;
-  }
-  if(Na_data != NULL){
-    delete [] Na_data;
-  }
-  if(dx_dxi != NULL){
-    delete [] dx_dxi;
-  }
-  if(dx_deta != NULL){
-    delete [] dx_deta;
-  }
-  if(dy_dxi != NULL){
-    delete [] dy_dxi;
-  }
-  if(dy_deta != NULL){
-    delete [] dy_deta;
-  }
-  if(dxi_dx != NULL){
-    delete [] dxi_dx;
-  }
-  if(dxi_dy != NULL){
-    delete [] dxi_dy;
-  }
-  if(deta_dx != NULL){
-    delete [] deta_dx;
-  }
-  if(deta_dy != NULL){
-    delete [] deta_dy;
-  }
-  if(J != NULL){
-    delete [] J;
-  }
-  if(dN1_dxi != NULL){
-    delete [] dN1_dxi;
-  }
-  if(dN1_deta != NULL){
-    delete [] dN1_deta;
-  }
-  if(dN2_dxi != NULL){
-    delete [] dN2_dxi;
-  }
-  if(dN2_deta != NULL){
-    delete [] dN2_deta;
-  }
-  if(dN3_dxi != NULL){
-    delete [] dN3_dxi;
-  }
-  if(dN3_deta != NULL){
-    delete [] dN3_deta;
-  }
-  if(dN4_dxi != NULL){
-    delete [] dN4_dxi;
-  }
-  if(dN4_deta != NULL){
-    delete [] dN4_deta;
-  }
-}
-
-Quad4::Quad4(Quadrature const* quad, const Face& f)
-  :Element(quad,f)
-{
-  alpha = NULL;
-  beta = NULL;
-  Na = NULL;
-  Na_data = NULL;
-  J = NULL;
-  dx_dxi = NULL;
-  dx_deta = NULL;
-  dy_dxi = NULL;
-  dy_deta = NULL;
-  dxi_dx = NULL;
-  dxi_dy = NULL;
-  deta_dx = NULL;
-  deta_dy = NULL;
-}
-
-
-Quad4::~Quad4(){
-
-}
-
-
-
-void Quad4 :: Element_setup(vector<Node> const& node){
-  assert(Quad != NULL);
-  Compute_mapping_coeff(node);
-  Compute_Shape_Function();
-  Compute_dX_dXI();
-  Compute_Jacobian();
-  Compute_dXI_dX();
-  Compute_dN_dXI();
-}
-
-
-
-void Quad4 :: Compute_mapping_coeff(vector<Node> const& node){
-
-  int n = Quad->Qpoints(), nrhs = 2;
-  int lda = n, ldb = n;
-  int info, ipiv[n];
-  double solution[2][n];
-  double **Qmat = Quad->QMapping();
-  double *mat = NULL; //Quad->QMapping();
-  alpha = new double [n];
-  beta = new double [n];
-
-  mat = new double [n*n];
-  memcpy(&mat[0],&Qmat[0][0],n*n*sizeof(double));
-
-//  for(int i = 0; i < 4; i++){
-//    for(int j = 0; j < 4; j++){
-//      cout << setw(12) << mat[i*4+j];
-//    }
-//    cout << endl;
-//  }
-
-  // get x and y coordinates of face nodes
-  for(int i = 0; i < n; i++){
-    solution[0][i] = node[face.nodes[i]-1].x;
-    solution[1][i] = node[face.nodes[i]-1].y;
+/* runtime element kind -> compile time specialization, once for all elements */
+inline void Setup_Quad_Geometry(const Quadrature& Q, const double* x, const double* y, Element_Block const& block,
+                                const int* elem, long nelem, int nthreads, Element_Geometry& G){
+  const int nen = Q.Nodes(), nq = Q.Qpoints();
+  if(nen == 4 && nq == 1){
+    Quad_Geometry<4,1>(Q,G).Setup(x,y,block,elem,nelem,nthreads);
+  }else if(nen == 4 && nq == 4){
+    Quad_Geometry<4,4>(Q,G).Setup(x,y,block,elem,nelem,nthreads);
+  }else if(nen == 4 && nq == 9){
+    Quad_Geometry<4,9>(Q,G).Setup(x,y,block,elem,nelem,nthreads);
+  }else if(nen == 8 && nq == 9){
+    Quad_Geometry<8,9>(Q,G).Setup(x,y,block,elem,nelem,nthreads);
+  }else if(nen == 9 && nq == 9){
+    Quad_Geometry<9,9>(Q,G).Setup(x,y,block,elem,nelem,nthreads);
+  }else{
+    assert(false);
   }
-
-  /* solve AX = B using lapack solver */
-  dgesv_(&n, &nrhs, &mat[0], &lda, ipiv, &solution[0][0], &ldb, &info);
-  assert(info == 0);
-
-  //cout << "Solution: "<< info << endl;
-  //cout << setw(15) << "alpha" << setw(15) << "beta" << endl;
-  for(int i = 0; i < n; i++){
-    alpha[i] = solution[0][i];
-    beta[i] = solution[1][i];
-    //cout << setw(15) << alpha[i] << setw(15) << beta[i] << endl;
-  }
-  //cout << endl;
-
-  delete [] mat;
 }
 
 
-void Quad4 :: Compute_Shape_Function(){
 
-  const int n = Quad->Qpoints();
-  const double* QXi  = Quad->QXipoints();
-  const double* QEta = Quad->QEtapoints();
-  Na = new double* [n];
-  Na_data = new double [n*n];
-  for(int i = 0; i < n; i++){
-    Na[i] = &Na_data[i*n];
-  }
 
-  for(int i = 0; i < n; i++){
-    //compute shape functions at quadrature points
-    Na[0][i] = 0.25*(1.0-QXi[i])*(1.0-QEta[i]);
-    Na[1][i] = 0.25*(1.0+QXi[i])*(1.0-QEta[i]);
-    Na[2][i] = 0.25*(1.0+QXi[i])*(1.0+QEta[i]);
-    Na[3][i] = 0.25*(1.0-QXi[i])*(1.0+QEta[i]);
-  }
-
-
-//  cout << "Shape Functions:" << endl;
-//  for(int i = 0; i < n; i++){
-//    for(int j = 0; j < n; j++){
-//      cout << setw(12) << Na[i][j];
-//    }
-//    cout << endl;
-//  }
-//  cout << endl;
-
-}
-
-
-void Quad4 :: Compute_dX_dXI(){
-
-  assert(alpha != NULL || beta != NULL);
-  const int n = Quad->Qpoints();
-  const double* QXi = Quad->QXipoints();
-  const double* QEta = Quad->QEtapoints();
-  dx_dxi = new double [n];
-  dx_deta = new double [n];
-  dy_dxi = new double [n];
-  dy_deta = new double [n];
-
-  //cout << setw(15) << "dx_dxi" << setw(15) << "dx_deta" << setw(15) << "dy_dxi" << setw(15) << "dy_deta" << endl;
-  for(int i = 0; i < n; i++){
-    dx_dxi[i] = alpha[1] + alpha[3]*QEta[i];
-    dx_deta[i] = alpha[2] + alpha[3]*QXi[i];
-    dy_dxi[i] = beta[1] + beta[3]*QEta[i];
-    dy_deta[i] = beta[2] + beta[3]*QXi[i];
-    //cout << setw(15) << dx_dxi[i] << setw(15) << dx_deta[i]
-    //     << setw(15) << dy_dxi[i] << setw(15) << dy_deta[i] << endl;
-  }
-  //cout << endl;
-}
-
-
-void Quad4 :: Compute_Jacobian(){
-  assert(dx_dxi != NULL || dx_deta != NULL ||dy_dxi != NULL ||dy_deta != NULL);
-  const int n = Quad->Qpoints();
-  J = new double [n];
+// Functions
 
-  //cout << "Jacobian :" << endl;
-  for(int i = 0; i < n; i++){
-    J[i] = dx_dxi[i]*dy_deta[i] - dy_dxi[i]*dx_deta[i];
-    //cout << setw(15) << J[i];
+template<int NN, int NQ>
+Quad_Geometry<NN,NQ>::Quad_Geometry(const Quadrature& Q, Element_Geometry& geom)
+  : G(geom)
+{
+  assert(Q.Nodes() == NN && Q.Qpoints() == NQ);
+  assert(G.Nodes_per_element() == NN && G.Qpoints() == NQ);
+  for(int a = 0; a < NN; a++){
+    for(int q = 0; q < NQ; q++){
+      dN_dxi[a][q] = Q.QdN_dxi()[a][q];
+      dN_deta[a][q] = Q.QdN_deta()[a][q];
+    }
+  }
+  for(int q = 0; q < NQ; q++){
+    QXi[q] = Q.QXipoints()[q];
+    QEta[q] = Q.QEtapoints()[q];
+  }
+  for(int i = 0; i < 4; i++){
+    for(int j = 0; j < 4; j++){
+      Minv[i][j] = (NN == 4) ? Q.QMapping_inv()[i][j] : 0.0;
+    }
   }
-  //cout << endl << endl;
-
-  /* assert positive jacobian */
-  assert(*J > 0);
 }
 
 
-void Quad4 :: Compute_dXI_dX(){
-  assert(dx_dxi != NULL || dx_deta != NULL ||dy_dxi != NULL ||dy_deta != NULL);
-  assert(*J < 1e8);
-  const int n = 4;
-  dxi_dx = new double [n];
-  dxi_dy = new double [n];
-  deta_dx = new double [n];
-  deta_dy = new double [n];
-
-  //cout << setw(15) << "dxi_dx" << setw(15) << "dxi_dy" << setw(15) << "deta_dx" << setw(15) << "deta_dy" << endl;
-  for(int i = 0; i < n; i++){
-    dxi_dx[i]  =  dy_deta[i]/J[i];
-    dxi_dy[i]  = -dx_deta[i]/J[i];
-    deta_dx[i] = -dy_dxi[i]/J[i];
-    deta_dy[i] =  dx_dxi[i]/J[i];
-    //cout << setw(15) << dxi_dx[i] << setw(15) << dxi_dy[i]
-    //     << setw(15) << deta_dx[i] << setw(15) << deta_dy[i] << endl;
+/*
+ * Elements e0 .. e0+W-1, node a of element e0+l at x[a*W + l], y[a*W + l]:
+ * jacobian, inverse jacobian terms and shape function gradients at every
+ * quadrature point, and the hourglass vectors of the one point rule.
+ */
+template<int NN, int NQ> template<int W>
+void Quad_Geometry<NN,NQ>::Batch(const double* xe, const double* ye, size_t e0) const {
+
+  typedef typename Lanes<W>::type V;
+  V x[NN], y[NN], alpha[4], beta[4];
+  V dx_dxi[NQ], dx_deta[NQ], dy_dxi[NQ], dy_deta[NQ];
+
+  for(int a = 0; a < NN; a++){
+    x[a] = Lanes<W>::Load(&xe[a*W]);
+    y[a] = Lanes<W>::Load(&ye[a*W]);
+  }
+
+  if(NN == 4){
+    for(int i = 0; i < 4; i++){
+      alpha[i] = Minv[i][0]*x[0] + Minv[i][1]*x[1] + Minv[i][2]*x[2] + Minv[i][3]*x[3];
+      beta[i]  = Minv[i][0]*y[0] + Minv[i][1]*y[1] + Minv[i][2]*y[2] + Minv[i][3]*y[3];
+    }
+    for(int q = 0; q < NQ; q++){
+      dx_dxi[q]  = alpha[1] + alpha[3]*QEta[q];
+      dx_deta[q] = alpha[2] + alpha[3]*QXi[q];
+      dy_dxi[q]  = beta[1] + beta[3]*QEta[q];
+      dy_deta[q] = beta[2] + beta[3]*QXi[q];
+    }
+  }else{
+    for(int q = 0; q < NQ; q++){
+      dx_dxi[q] = dx_deta[q] = dy_dxi[q] = dy_deta[q] = V();
+      for(int a = 0; a < NN; a++){
+        dx_dxi[q]  += dN_dxi[a][q]*x[a];
+        dx_deta[q] += dN_deta[a][q]*x[a];
+        dy_dxi[q]  += dN_dxi[a][q]*y[a];
+        dy_deta[q] += dN_deta[a][q]*y[a];
+      }
+    }
+  }
+
+  for(int q = 0; q < NQ; q++){
+    const V J = dx_dxi[q]*dy_deta[q] - dy_dxi[q]*dx_deta[q];
+    // a folded element (or misplaced midside nodes) anywhere is an error
+    for(int l = 0; l < W; l++){
+      assert(J[l] > 0);
+    }
+    const V dxi_dx = dy_deta[q]/J, dxi_dy = -dx_deta[q]/J;
+    const V deta_dx = -dy_dxi[q]/J, deta_dy = dx_dxi[q]/J;
+    memcpy(&G.J(e0,q),&J,W*sizeof(double));
+    memcpy(&G.dxi_dx(e0,q),&dxi_dx,W*sizeof(double));
+    memcpy(&G.dxi_dy(e0,q),&dxi_dy,W*sizeof(double));
+    memcpy(&G.deta_dx(e0,q),&deta_dx,W*sizeof(double));
+    memcpy(&G.deta_dy(e0,q),&deta_dy,W*sizeof(double));
+    for(int a = 0; a < NN; a++){
+      const V bx = dN_dxi[a][q]*dxi_dx + dN_deta[a][q]*deta_dx;
+      const V by = dN_dxi[a][q]*dxi_dy + dN_deta[a][q]*deta_dy;
+      memcpy(&G.dN_dx(e0,a,q),&bx,W*sizeof(double));
+      memcpy(&G.dN_dy(e0,a,q),&by,W*sizeof(double));
+    }
+  }
+
+  /*
+   * Hourglass vector of the one point rule (Flanagan-Belytschko):
+   * gamma_a = (h_a - (h.x) dNa/dx - (h.y) dNa/dy)/4 with h = (1,-1,1,-1) and
+   * the gradients at the centre. It is orthogonal to the linear fields, so
+   * the stabilization leaves the constant strain states alone; h.x = 4 alpha3.
+   */
+  if(NN == 4 && NQ == 1 && G.Hourglass()){
+    const double h[4] = {1.0, -1.0, 1.0, -1.0};
+    for(int a = 0; a < 4; a++){
+      const V g = 0.25*h[a] - alpha[3]*Lanes<W>::Load(&G.dN_dx(e0,a,0)) - beta[3]*Lanes<W>::Load(&G.dN_dy(e0,a,0));
+      memcpy(&G.gamma(e0,a),&g,W*sizeof(double));
+    }
   }
-
 }
 
 
-
-void Quad4 :: Compute_dN_dXI(){
-  const int n = Quad->Qpoints();
-  const double* QXi = Quad->QXipoints();
-  const double* QEta = Quad->QEtapoints();
-
-  dN1_dxi = new double [n];
-  dN1_deta = new double [n];
-  dN2_dxi = new double [n];
-  dN2_deta = new double [n];
-  dN3_dxi = new double [n];
-  dN3_deta = new double [n];
-  dN4_dxi = new double [n];
-  dN4_deta = new double [n];
-
-  for(int i = 0; i < n; i++){
-    dN1_dxi[i]  = -0.25*(1-QEta[i]);
-    dN1_deta[i] = -0.25*(1-QXi[i]);
-    dN2_dxi[i]  =  0.25*(1-QEta[i]);
-    dN2_deta[i] = -0.25*(1+QXi[i]);
-    dN3_dxi[i]  =  0.25*(1+QEta[i]);
-    dN3_deta[i] =  0.25*(1+QXi[i]);
-    dN4_dxi[i]  = -0.25*(1+QEta[i]);
-    dN4_deta[i] =  0.25*(1-QXi[i]);
+/* the mesh elements elem[0 .. nelem-1] of the block, element i of the
+ * geometry store being elem[i]; full batches in parallel, then the remainder
+ * one at a time */
+template<int NN, int NQ>
+void Quad_Geometry<NN,NQ>::Setup(const double* xn, const double* yn, Element_Block const& block,
+                                 const int* elem, long nelem, int nthreads) const {
+
+  assert(G.Elements() == size_t(nelem) && block.Nodes_per_element() == NN);
+  const int32_t* conn = block.Connectivity();
+  const size_t first = block.First();
+  auto Gather = [&](long e0, int W, double* x, double* y){
+    for(int l = 0; l < W; l++){
+      const int32_t* fn = &conn[(elem[e0+l]-first)*NN];
+      for(int a = 0; a < NN; a++){
+        x[a*W + l] = xn[fn[a]-1];
+        y[a*W + l] = yn[fn[a]-1];
+      }
+    }
+  };
+
+  const long nbatch = nelem/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(nthreads,1)) schedule(static)
+  for(long b = 0; b < nbatch; b++){
+    double x[NN*STIFF_BATCH], y[NN*STIFF_BATCH];
+    Gather(b*STIFF_BATCH,STIFF_BATCH,x,y);
+    Batch<STIFF_BATCH>(x,y,b*STIFF_BATCH);
+  }
+  for(long e = nbatch*STIFF_BATCH; e < nelem; e++){
+    double x[NN], y[NN];
+    Gather(e,1,x,y);
+    Batch<1>(x,y,e);
   }
 }
 
@@ -0,0 +1,360 @@
+#ifndef ELEMOPERATOR_HPP
+#define ELEMOPERATOR_HPP
+
+#include <vector>
+#include <algorithm>
+#include "petscksp.h"
+#include "stiffkernel.hpp"
+#include "profiler.hpp"
+
+using namespace std;
+
+
+/*
+ * Matrix-free stiffness operator, K u applied element by element: the DOFs of
+ * every local element are gathered from a local copy of u (owned and ghost
+ * nodes, one VecScatter), multiplied by the element matrix and added into a
+ * local y that is scattered back with ADD_VALUES. The element matrices are
+ * either stored as their packed upper triangles in the layout of the batched
+ * kernel, or recomputed in every product from the element geometry.
+ *
+ * Fixed nodes are treated as by the symmetric assembly: their couplings are
+ * dropped and their rows are the identity. The diagonal (for PCJACOBI) is
+ * summed from the element diagonals once, when the operator is created.
+ */
+class Element_Operator{
+private:
+  const Element_Geometry* geometry;
+  const double* QW;
+  double const* const* C;
+  double thickness;
+  bool recompute;                 // no stored element matrices
+  size_t nelem, nfull;            // elements, elements in full kernel batches
+  vector<PetscInt> node;          // equation nodes touched by local elements, sorted
+  vector<int> elem_node;          // element -> 4 indices into node
+  vector<double> Ke;              // packed upper triangles, batch layout
+  vector<char> fixed;             // per entry of node
+  vector<PetscInt> fixed_owned;   // owned fixed nodes, identity rows
+  int node_lo;
+  int Num_Threads;
+  const vector<int> *color_ptr, *color_elem;
+  Vec u_loc, y_loc, diag;
+  VecScatter gather;              // global vector -> DOFs of node
+  double setup_time;
+
+  const double* Element_Matrix(size_t, double*, int&) const;
+  void Apply_Element(size_t, const double*, int, const double*, double*) const;
+  void Apply(const double*, double*) const;
+
+public:
+  Element_Operator(const Element_Geometry*, const double*, double const* const*, double, bool);
+  ~Element_Operator();
+
+  void Set_Elements(const vector<PetscInt>&, const vector<int>&);
+  void Compute_Element_Matrices(int);
+  void Create(const vector<PetscInt>&, PetscInt, int, int, int, const vector<int>*, const vector<int>*, Mat*);
+  void Assemble(Mat) const;
+  double Bytes() const;
+  double Setup_Time() const {return setup_time;}
+  bool Recompute() const {return recompute;}
+
+  static PetscErrorCode Mult(Mat, Vec, Vec);
+  static PetscErrorCode Get_Diagonal(Mat, Vec);
+};
+
+
+/******************* Functions **************************/
+
+Element_Operator :: Element_Operator(const Element_Geometry* g, const double* qw, double const* const* c,
+                                     double t, bool rc)
+  : geometry(g), QW(qw), C(c), thickness(t), recompute(rc), nelem(0), nfull(0),
+    node_lo(0), Num_Threads(0), color_ptr(NULL), color_elem(NULL),
+    u_loc(NULL), y_loc(NULL), diag(NULL), gather(NULL), setup_time(0.0)
+{}
+
+
+Element_Operator :: ~Element_Operator(){
+  VecDestroy(&u_loc);
+  VecDestroy(&y_loc);
+  VecDestroy(&diag);
+  VecScatterDestroy(&gather);
+}
+
+
+/* local elements (Quad4): touched equation nodes and 4 indices into them per element */
+void Element_Operator :: Set_Elements(const vector<PetscInt>& nodes, const vector<int>& enodes){
+  node = nodes;
+  elem_node = enodes;
+  nelem = elem_node.size()/4;
+  nfull = nelem - nelem % STIFF_BATCH;
+}
+
+
+/* packed element matrices, unless they are recomputed in every product */
+void Element_Operator :: Compute_Element_Matrices(int nthreads){
+
+  double t0, t1;
+  PetscTime(&t0);
+  if(!recompute){
+    Ke.resize(QUAD4_UPPER*nelem);
+    const long nbatch = nelem/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(nthreads,1)) schedule(static)
+    for(long b = 0; b < nbatch; b++){
+      Quad4_Stiffness_Kernel<STIFF_BATCH>(*geometry,b*STIFF_BATCH,QW,C,thickness,&Ke[QUAD4_UPPER*b*STIFF_BATCH]);
+    }
+    for(size_t e = nfull; e < nelem; e++){
+      Quad4_Stiffness_Kernel<1>(*geometry,e,QW,C,thickness,&Ke[QUAD4_UPPER*e]);
+    }
+    Profiler::Instance().Add_Flops(nelem*QUAD4_STIFFNESS_FLOPS(geometry->Qpoints()));
+  }
+  PetscTime(&t1);
+  setup_time = t1-t0;
+}
+
+
+/* packed upper triangle of element e and its stride, stored or computed into buf */
+const double* Element_Operator :: Element_Matrix(size_t e, double* buf, int& stride) const {
+  if(recompute){
+    Quad4_Stiffness_Kernel<1>(*geometry,e,QW,C,thickness,buf);
+    stride = 1;
+    return buf;
+  }
+  const size_t e0 = (e < nfull) ? e - e % STIFF_BATCH : e;
+  stride = (e < nfull) ? STIFF_BATCH : 1;
+  return &Ke[QUAD4_UPPER*e0 + (e-e0)];
+}
+
+
+/* y += Ke u on the DOFs of element e, couplings of fixed nodes dropped */
+void Element_Operator :: Apply_Element(size_t e, const double* K, int stride,
+                                       const double* u, double* y) const {
+  const int* en = &elem_node[4*e];
+  double ue[QUAD4_DOF], ye[QUAD4_DOF];
+  for(int a = 0; a < 4; a++){
+    const bool f = fixed[en[a]];
+    ue[2*a]   = f ? 0.0 : u[2*en[a]];
+    ue[2*a+1] = f ? 0.0 : u[2*en[a]+1];
+    ye[2*a] = ye[2*a+1] = 0.0;
+  }
+  int k = 0;
+  for(int i = 0; i < QUAD4_DOF; i++){
+    ye[i] += K[k*stride]*ue[i];
+    k++;
+    for(int j = i+1; j < QUAD4_DOF; j++){
+      const double v = K[k*stride];
+      ye[i] += v*ue[j];
+      ye[j] += v*ue[i];
+      k++;
+    }
+  }
+  for(int a = 0; a < 4; a++){
+    if(!fixed[en[a]]){
+      y[2*en[a]]   += ye[2*a];
+      y[2*en[a]+1] += ye[2*a+1];
+    }
+  }
+}
+
+
+/*
+ * y = K u on the local DOFs. Threaded by element color like the assembly
+ * (elements of one color share no node), serial in kernel batches otherwise.
+ */
+void Element_Operator :: Apply(const double* u, double* y) const {
+
+  if(Num_Threads > 0){
+    for(size_t c = 0; c + 1 < color_ptr->size(); c++){
+#pragma omp parallel for num_threads(Num_Threads) schedule(static)
+      for(long k = (*color_ptr)[c]; k < (*color_ptr)[c+1]; k++){
+        double buf[QUAD4_UPPER];
+        int stride;
+        const size_t e = (*color_elem)[k];
+        const double* K = Element_Matrix(e,buf,stride);
+        Apply_Element(e,K,stride,u,y);
+      }
+    }
+    return;
+  }
+
+  double buf[QUAD4_UPPER*STIFF_BATCH];
+  for(size_t e = 0; e < nfull; e += STIFF_BATCH){
+    const double* K = Ke.data() + QUAD4_UPPER*e;
+    if(recompute){
+      Quad4_Stiffness_Kernel<STIFF_BATCH>(*geometry,e,QW,C,thickness,buf);
+      K = buf;
+    }
+    for(int l = 0; l < STIFF_BATCH; l++){
+      Apply_Element(e+l,K+l,STIFF_BATCH,u,y);
+    }
+  }
+  for(size_t e = nfull; e < nelem; e++){
+    int stride;
+    const double* K = Element_Matrix(e,buf,stride);
+    Apply_Element(e,K,stride,u,y);
+  }
+}
+
+
+/*
+ * Shell matrix of GDof rows with the rows of the owned nodes [lo,hi);
+ * fixed_nodes lists the fixed nodes among the owned nodes and those of the
+ * local elements, sorted. Threads > 0 apply by the given element colors.
+ */
+void Element_Operator :: Create(const vector<PetscInt>& fixed_nodes, PetscInt GDof, int lo, int hi, int nthreads,
+                                const vector<int>* cptr, const vector<int>* celem, Mat* A){
+
+  double t0, t1;
+  PetscTime(&t0);
+  node_lo = lo;
+  Num_Threads = nthreads;
+  color_ptr = cptr;
+  color_elem = celem;
+
+  fixed.resize(node.size());
+  for(size_t i = 0; i < node.size(); i++){
+    fixed[i] = binary_search(fixed_nodes.begin(),fixed_nodes.end(),node[i]);
+  }
+  fixed_owned.clear();
+  for(size_t i = 0; i < fixed_nodes.size(); i++){
+    if(fixed_nodes[i] >= lo && fixed_nodes[i] < hi){
+      fixed_owned.push_back(fixed_nodes[i]);
+    }
+  }
+
+  MatCreateShell(PETSC_COMM_WORLD,2*(hi-lo),2*(hi-lo),GDof,GDof,this,A);
+  MatSetBlockSize(*A,2);
+  MatShellSetOperation(*A,MATOP_MULT,(void(*)(void))Mult);
+  MatShellSetOperation(*A,MATOP_GET_DIAGONAL,(void(*)(void))Get_Diagonal);
+
+  VecDestroy(&u_loc);
+  VecDestroy(&y_loc);
+  VecDestroy(&diag);
+  VecScatterDestroy(&gather);
+  VecCreateSeq(PETSC_COMM_SELF,2*node.size(),&u_loc);
+  VecDuplicate(u_loc,&y_loc);
+  MatCreateVecs(*A,&diag,NULL);
+  IS is;
+  ISCreateBlock(PETSC_COMM_SELF,2,node.size(),node.data(),PETSC_COPY_VALUES,&is);
+  VecScatterCreate(diag,is,u_loc,NULL,&gather);
+  ISDestroy(&is);
+
+  // diagonal: element diagonals of the free nodes, 1 on fixed rows
+  PetscScalar *_y, *_d;
+  VecSet(y_loc,0.0);
+  VecGetArray(y_loc,&_y);
+  for(size_t e = 0; e < nelem; e++){
+    double buf[QUAD4_UPPER];
+    int stride;
+    const double* K = Element_Matrix(e,buf,stride);
+    int k = 0;
+    for(int i = 0; i < QUAD4_DOF; i++){
+      _y[2*elem_node[4*e+i/2] + i%2] += K[k*stride];
+      k += QUAD4_DOF - i;
+    }
+  }
+  VecRestoreArray(y_loc,&_y);
+  VecSet(diag,0.0);
+  VecScatterBegin(gather,y_loc,diag,ADD_VALUES,SCATTER_REVERSE);
+  VecScatterEnd(gather,y_loc,diag,ADD_VALUES,SCATTER_REVERSE);
+  VecGetArray(diag,&_d);
+  for(size_t i = 0; i < fixed_owned.size(); i++){
+    const int n = fixed_owned[i] - node_lo;
+    _d[2*n] = _d[2*n+1] = 1.0;
+  }
+  VecRestoreArray(diag,&_d);
+
+  PetscTime(&t1);
+  setup_time += t1-t0;
+}
+
+
+PetscErrorCode Element_Operator :: Mult(Mat A, Vec x, Vec y){
+
+  Element_Operator* op;
+  MatShellGetContext(A,&op);
+
+  VecScatterBegin(op->gather,x,op->u_loc,INSERT_VALUES,SCATTER_FORWARD);
+  VecScatterEnd(op->gather,x,op->u_loc,INSERT_VALUES,SCATTER_FORWARD);
+
+  const PetscScalar* _u;
+  PetscScalar* _y;
+  VecSet(op->y_loc,0.0);
+  VecGetArrayRead(op->u_loc,&_u);
+  VecGetArray(op->y_loc,&_y);
+  op->Apply(_u,_y);
+  // symmetric product from the upper triangle: 2 per diagonal, 4 per other entry, 8 adds into y
+  Profiler::Instance().Add_Flops(op->nelem*(2*QUAD4_DOF + 4*(QUAD4_UPPER-QUAD4_DOF) + QUAD4_DOF
+                                            + (op->recompute ? QUAD4_STIFFNESS_FLOPS(op->geometry->Qpoints()) : 0.0)));
+  VecRestoreArray(op->y_loc,&_y);
+  VecRestoreArrayRead(op->u_loc,&_u);
+
+  VecSet(y,0.0);
+  VecScatterBegin(op->gather,op->y_loc,y,ADD_VALUES,SCATTER_REVERSE);
+  VecScatterEnd(op->gather,op->y_loc,y,ADD_VALUES,SCATTER_REVERSE);
+
+  // identity rows of the fixed nodes
+  const PetscScalar* _x;
+  VecGetArrayRead(x,&_x);
+  VecGetArray(y,&_y);
+  for(size_t i = 0; i < op->fixed_owned.size(); i++){
+    const int n = op->fixed_owned[i] - op->node_lo;
+    _y[2*n]   = _x[2*n];
+    _y[2*n+1] = _x[2*n+1];
+  }
+  VecRestoreArray(y,&_y);
+  VecRestoreArrayRead(x,&_x);
+  return 0;
+}
+
+
+PetscErrorCode Element_Operator :: Get_Diagonal(Mat A, Vec d){
+  Element_Operator* op;
+  MatShellGetContext(A,&op);
+  VecCopy(op->diag,d);
+  return 0;
+}
+
+
+/* element matrices and identity blocks of the owned fixed nodes into the
+ * preallocated K, same values as the symmetric assembly; no final assembly */
+void Element_Operator :: Assemble(Mat K) const {
+
+  for(size_t e = 0; e < nelem; e++){
+    double buf[QUAD4_UPPER], Kfull[QUAD4_DOF][QUAD4_DOF];
+    int stride;
+    const double* Kp = Element_Matrix(e,buf,stride);
+    int k = 0;
+    for(int i = 0; i < QUAD4_DOF; i++){
+      for(int j = i; j < QUAD4_DOF; j++){
+        Kfull[i][j] = Kfull[j][i] = Kp[k*stride];
+        k++;
+      }
+    }
+    PetscInt idx[4];
+    for(int a = 0; a < 4; a++){
+      const int n = elem_node[4*e+a];
+      idx[a] = fixed[n] ? -1 : node[n]; // negative indices are ignored
+    }
+    MatSetValuesBlocked(K,4,idx,4,idx,&Kfull[0][0],ADD_VALUES);
+  }
+
+  const double identity[4] = {1.0, 0.0, 0.0, 1.0};
+  for(size_t i = 0; i < fixed_owned.size(); i++){
+    MatSetValuesBlocked(K,1,&fixed_owned[i],1,&fixed_owned[i],identity,ADD_VALUES);
+  }
+}
+
+
+/* memory held by the operator: element matrices, connectivity, local vectors */
+double Element_Operator :: Bytes() const {
+  PetscInt nowned = 0;
+  if(diag){
+    VecGetLocalSize(diag,&nowned);
+  }
+  return double(Ke.size())*sizeof(double) + double(elem_node.size())*sizeof(int)
+       + double(node.size())*(2*sizeof(PetscInt) + sizeof(char) + 4*sizeof(PetscScalar))
+       + double(fixed_owned.size())*sizeof(PetscInt) + double(nowned)*sizeof(PetscScalar);
+}
+
+
+#endif // ELEMOPERATOR_HPP
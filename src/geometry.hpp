@@ -0,0 +1,135 @@
+#ifndef GEOMETRY_HPP
+#define GEOMETRY_HPP
+
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * CLASS ELEMENT_GEOMETRY -> quadrature point geometry of all elements in one
+ * aligned structure-of-arrays block. Each field is stored element-fastest,
+ * i.e. value(e,q) = field[q*nelem + e], so that consecutive elements are
+ * contiguous for a given quadrature point (and node, for gradients).
+ * One point Quad4 geometry also holds the hourglass vectors of the elements.
+ */
+class Element_Geometry{
+private:
+  size_t nelem;                     // number of elements
+  int nen;                          // nodes per element
+  int nqp;                          // quadrature points per element
+  size_t bytes;                     // size of the allocated block
+  double *data;                     // the single allocation
+  double *J_;                       // jacobian
+  double *dxi_dx_, *dxi_dy_;        // inverse jacobian terms
+  double *deta_dx_, *deta_dy_;
+  double *dN_dx_, *dN_dy_;          // physical shape function gradients [a][q][e]
+  double *gamma_;                   // hourglass vectors [a][e], one point rule only, else NULL
+
+  static const size_t align = 64;   // bytes, one cache line / AVX-512 register
+
+public:
+  Element_Geometry();
+  ~Element_Geometry();
+  void Allocate(size_t, int, int);
+
+  size_t Elements() const {return nelem;}
+  int Nodes_per_element() const {return nen;}
+  int Qpoints() const {return nqp;}
+  size_t Bytes() const {return bytes;}
+  double Bytes_per_element() const {return nelem ? double(bytes)/nelem : 0.0;}
+
+  double& J(size_t e, int q) const {return J_[q*nelem + e];}
+  double& dxi_dx(size_t e, int q) const {return dxi_dx_[q*nelem + e];}
+  double& dxi_dy(size_t e, int q) const {return dxi_dy_[q*nelem + e];}
+  double& deta_dx(size_t e, int q) const {return deta_dx_[q*nelem + e];}
+  double& deta_dy(size_t e, int q) const {return deta_dy_[q*nelem + e];}
+  double& dN_dx(size_t e, int a, int q) const {return dN_dx_[(a*nqp + q)*nelem + e];}
+  double& dN_dy(size_t e, int a, int q) const {return dN_dy_[(a*nqp + q)*nelem + e];}
+  double& gamma(size_t e, int a) const {return gamma_[a*nelem + e];}
+  bool Hourglass() const {return gamma_ != NULL;}
+};
+
+
+/*
+ * CLASS TRI_COORDINATES -> nodal coordinates of the constant strain
+ * triangles, element-fastest as in Element_Geometry: x(e,a) = x[a*ntri + e].
+ * The gradients of a triangle are constant and are recomputed from these in
+ * closed form by the kernels, nothing else is stored.
+ */
+class Tri_Coordinates{
+private:
+  size_t ntri;
+  vector<double> xy;                // x of nodes 0, 1, 2, then y of nodes 0, 1, 2
+
+public:
+  Tri_Coordinates() : ntri(0) {}
+  void Allocate(size_t n){ ntri = n; xy.assign(6*n,0.0); }
+
+  size_t Elements() const {return ntri;}
+  size_t Bytes() const {return xy.size()*sizeof(double);}
+
+  double& x(size_t e, int a){return xy[a*ntri + e];}
+  double& y(size_t e, int a){return xy[(3+a)*ntri + e];}
+  const double& x(size_t e, int a) const {return xy[a*ntri + e];}
+  const double& y(size_t e, int a) const {return xy[(3+a)*ntri + e];}
+};
+
+
+/******************* Functions **************************/
+
+Element_Geometry :: Element_Geometry(){
+  nelem = 0;
+  nen = 0;
+  nqp = 0;
+  bytes = 0;
+  data = NULL;
+  gamma_ = NULL;
+}
+
+
+Element_Geometry :: ~Element_Geometry(){
+  if(data != NULL){
+    free(data);
+  }
+}
+
+
+void Element_Geometry :: Allocate(size_t n_elements, int n_nodes, int n_qpoints){
+
+  if(data != NULL){
+    if(nelem == n_elements && nen == n_nodes && nqp == n_qpoints){
+      return;
+    }
+    free(data);
+  }
+  nelem = n_elements;
+  nen = n_nodes;
+  nqp = n_qpoints;
+
+  // every field starts on an aligned boundary
+  const size_t pad = align/sizeof(double);
+  const size_t field = ((nelem*nqp + pad - 1)/pad)*pad;
+  const size_t nfield = 5 + 2*nen + (nqp == 1 ? nen : 0);
+  bytes = nfield*field*sizeof(double);
+
+  void *block = NULL;
+  int err = posix_memalign(&block,align,bytes > 0 ? bytes : align);
+  assert(err == 0);
+  data = static_cast<double*>(block);
+
+  J_       = data;
+  dxi_dx_  = data + 1*field;
+  dxi_dy_  = data + 2*field;
+  deta_dx_ = data + 3*field;
+  deta_dy_ = data + 4*field;
+  dN_dx_   = data + 5*field;
+  dN_dy_   = data + (5+nen)*field;
+  gamma_   = (nqp == 1) ? data + (5+2*nen)*field : NULL;
+}
+
+
+#endif // GEOMETRY_HPP
@@ -3,42 +3,591 @@
 #include "material.hpp"
 #include "preprocessor.hpp"
 #include "solver.hpp"
+#include "postprocessor.hpp"
+#include "meshgen.hpp"
 
 using namespace std;
 
-int main(int argc, char* argv[]){
 
-  PetscInitialize(&argc,&argv,(char*)0,NULL);
+/*
+ * Solver scaling: the mesh is refined uniformly levels times and the same
+ * problem solved on every level with the given constraints and preset.
+ */
+void Scaling_Study(Mesh& mesh, Material& material, int levels, Constraint_Mode cmode, Solver_Preset preset){
 
-  Mesh mesh("4x4Quad.dat");
-  mesh.ReadMeshFile();
-  mesh.Set_Thickness(0.1);
-  mesh.ValidateMesh();
-  mesh.WriteMesh(Mesh::MATLAB);
+  const int nlevel = levels+1;
+  vector<double> elems(nlevel), dofs(nlevel), setup(nlevel), solve(nlevel);
+  vector<int> its(nlevel);
 
-  Material steel(3.0E+7,0.3);
-  steel.Compute_Elastic_Stiffness();
-  steel.Print_Elastic_Stiffness();
+  for(int l = 0; l < nlevel; l++){
+    if(l > 0){
+      mesh.Refine();
+    }
+    PreProcessor pre(&mesh,&material);
+    pre.Set_constraint_mode(cmode);
+    pre.Set_quadrature_rule(Q2D_2point);
+    pre.Create_Quadrature_Objects();
+    pre.Compute_Element_properties();
+    pre.Compute_Element_stiffness();
+    pre.Assemble_Stiffness_Matrix();
+    pre.set_pointload(-1000.0);
+    pre.Apply_BC();
+
+    FEA_Solver solver(&pre);
+    solver.Set_preset(preset);
+    solver.Setup();
+    double t0, t1;
+    PetscTime(&t0);
+    solver.solve_disp();
+    PetscTime(&t1);
+
+    elems[l] = pre.Num_Elements();
+    dofs[l] = pre.Num_DOF();
+    setup[l] = solver.Setup_Time();
+    solve[l] = t1-t0;
+    its[l] = solver.Iterations();
+  }
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nScaling (%s, %s):\n",
+              preset == SOLVER_ELASTICITY ? "elasticity preset" : "default solver",
+              cmode == BC_ZERO_ROWS ? "zero rows" : (cmode == BC_SYMMETRIC ? "symmetric" : "eliminate"));
+  PetscPrintf(PETSC_COMM_WORLD,"%6s %12s %12s %10s %12s %12s\n","level","elements","DOFs","its","setup(s)","solve(s)");
+  for(int l = 0; l < nlevel; l++){
+    PetscPrintf(PETSC_COMM_WORLD,"%6d %12.0f %12.0f %10d %12.4e %12.4e\n",l,elems[l],dofs[l],its[l],setup[l],solve[l]);
+  }
+}
 
-  PreProcessor pre(&mesh,&steel);
-  pre.Set_quadrature_rule(Q2D_2point);
-  pre.Create_Quadrature_Objects();
 
+/*
+ * Parameter sweep on the assembled problem: one solve per Poisson's ratio, of
+ * the unit modulus, unit thickness system; K scales with E t, so every
+ * (E, thickness) pair is that solution divided by E t.
+ */
+void Parameter_Sweep(PreProcessor& pre, FEA_Solver& solver, vector<double> const& E,
+                     vector<double> const& t, vector<double> const& nu, bool write){
+
+  double t0, t1, t2;
+  PetscTime(&t0);
+  pre.Setup_Parameter_Sweep();
+  PetscTime(&t1);
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nParameter sweep: %d Poisson's ratios x %d (E, thickness) pairs\n",
+              int(nu.size()),int(E.size()));
+  PetscPrintf(PETSC_COMM_WORLD,"%8s %14s %8s %12s %8s %14s\n","case","E","nu","thickness","its","max |u|");
+  int c = 0;
+  for(size_t i = 0; i < nu.size(); i++){
+    pre.Set_Sweep_Parameters(1.0,nu[i],1.0);
+    solver.Update_Operator();
+    solver.solve_disp();
+    const int its = solver.Iterations();
+    double f = 1.0;   // solution = f times the unit solution
+    for(size_t j = 0; j < E.size(); j++, c++){
+      const double tj = t[t.size() == 1 ? 0 : j];
+      solver.Scale_Solution(1.0/(E[j]*tj*f));
+      f = 1.0/(E[j]*tj);
+      PetscPrintf(PETSC_COMM_WORLD,"%8d %14.6e %8.4f %12.6e %8d %14.6e\n",c,E[j],nu[i],tj,its,solver.Max_Displacement());
+      if(write){
+        ostringstream suffix;
+        suffix << "_sweep" << c;
+        solver.write_sol_disp(suffix.str());
+      }
+    }
+  }
+  PetscTime(&t2);
+  PetscPrintf(PETSC_COMM_WORLD,"Sweep: %d variants, %d solves, setup %.4e s, total %.4e s\n",
+              c,int(nu.size()),t1-t0,t2-t0);
+}
+
+
+/* one solve of the point load problem for the accuracy studies */
+typedef struct {
+  int nen, level;
+  Quadrature_Rule rule;
+  double elements, dofs, time, element_time, compliance, vm;
+} Study_Run;
+
+
+/*
+ * The mesh given by load_mesh, refined level times, with elements of nen
+ * nodes and the given rule for Quad4. Time is element setup, stiffness,
+ * assembly, solve and stress recovery; element_time the first two.
+ */
+template<class F>
+Study_Run Study_Solve(F load_mesh, Material& material, int nen, int level, Quadrature_Rule rule,
+                      Solver_Preset preset){
+  Mesh mesh;
+  load_mesh(mesh);
+  for(int l = 0; l < level; l++){
+    mesh.Refine();
+  }
+  if(nen > 4){
+    mesh.Elevate_Order(nen);
+  }
+  double t0, t1, t2;
+  PetscTime(&t0);
+  PreProcessor pre(&mesh,&material);
+  pre.Set_constraint_mode(BC_SYMMETRIC);
+  pre.Set_quadrature_rule(rule);
+  pre.Create_Quadrature_Objects();
   pre.Compute_Element_properties();
   pre.Compute_Element_stiffness();
+  PetscTime(&t1);
   pre.Assemble_Stiffness_Matrix();
   pre.set_pointload(-1000.0);
   pre.Apply_BC();
-
   FEA_Solver solver(&pre);
+  solver.Set_preset(preset);
   solver.solve_disp();
-  solver.write_sol_disp();
+  PostProcessor post(&pre,&solver);
+  post.Recover_Stresses();
+  PetscTime(&t2);
+
+  Study_Run r = {nen, level, rule, double(pre.Num_Elements()), double(pre.Num_DOF()), t2-t0, t1-t0,
+                 solver.Compliance(), post.Max_von_Mises()};
+  return r;
+}
+
+
+/*
+ * Element order study: the point load problem is solved with Quad4 on levels
+ * 0 .. levels+1 of uniform refinement of the mesh given by load_mesh, with
+ * Quad8 and Quad9 on levels 0 .. levels, and with Quad9 on level levels+1 as
+ * the reference. Accuracy is the relative energy norm of the error,
+ * sqrt(|F.u_ref - F.u|/F.u_ref), and the relative error of the largest nodal
+ * von Mises stress; time is element setup, stiffness, assembly, solve and
+ * stress recovery.
+ */
+template<class F>
+void Element_Order_Study(F load_mesh, Material& material, int levels, Solver_Preset preset){
+
+  vector<Study_Run> run;
+  run.push_back(Study_Solve(load_mesh,material,9,levels+1,Q2D_2point,preset));
+  const Study_Run ref = run.back();
+  const int nen[3] = {4, 8, 9};
+  for(int k = 0; k < 3; k++){
+    for(int l = 0; l <= levels + (nen[k] == 4); l++){
+      run.push_back(Study_Solve(load_mesh,material,nen[k],l,Q2D_2point,preset));
+    }
+  }
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nElement order study (reference Quad9, level %d: %.0f DOFs, F.u %.8e, max von Mises %.8e):\n",
+              levels+1,ref.dofs,ref.compliance,ref.vm);
+  PetscPrintf(PETSC_COMM_WORLD,"%8s %6s %10s %10s %12s %12s %12s\n","element","level","elements","DOFs",
+              "time(s)","energy err","vm err");
+  for(size_t i = 1; i < run.size(); i++){
+    const Study_Run& r = run[i];
+    const double err = sqrt(fabs(ref.compliance - r.compliance)/fabs(ref.compliance));
+    PetscPrintf(PETSC_COMM_WORLD,"%7s%d %6d %10.0f %10.0f %12.4e %12.4e %12.4e\n","Quad",r.nen,r.level,
+                r.elements,r.dofs,r.time,err,fabs(ref.vm - r.vm)/ref.vm);
+  }
+}
+
+
+/*
+ * Quadrature study for Quad4: the point load problem on levels 0 .. levels
+ * of uniform refinement with the 1 point (reduced, stabilized), 2x2 (full)
+ * and 3x3 rules, against Quad9 on level levels+1 as in the order study.
+ * Besides the errors, the element setup and stiffness time and the ratio of
+ * the compliance F.u to that of full integration on the same mesh: above 1
+ * the element is softer than the fully integrated one.
+ */
+template<class F>
+void Quadrature_Study(F load_mesh, Material& material, int levels, Solver_Preset preset){
+
+  const Study_Run ref = Study_Solve(load_mesh,material,9,levels+1,Q2D_2point,preset);
+  const Quadrature_Rule rule[3] = {Q2D_1point, Q2D_2point, Q2D_3point};
+  const char* name[3] = {"1 point","2x2","3x3"};
+  vector<Study_Run> run;
+  for(int l = 0; l <= levels; l++){
+    for(int k = 0; k < 3; k++){
+      run.push_back(Study_Solve(load_mesh,material,4,l,rule[k],preset));
+    }
+  }
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nQuad4 quadrature study (reference Quad9, level %d: %.0f DOFs, F.u %.8e, max von Mises %.8e):\n",
+              levels+1,ref.dofs,ref.compliance,ref.vm);
+  PetscPrintf(PETSC_COMM_WORLD,"%8s %6s %10s %12s %12s %12s %12s %12s\n","rule","level","elements",
+              "element(s)","time(s)","F.u / full","energy err","vm err");
+  for(size_t i = 0; i < run.size(); i++){
+    const Study_Run& r = run[i];
+    const Study_Run& full = run[i - i % 3 + 1];
+    const double err = sqrt(fabs(ref.compliance - r.compliance)/fabs(ref.compliance));
+    PetscPrintf(PETSC_COMM_WORLD,"%8s %6d %10.0f %12.4e %12.4e %12.6f %12.4e %12.4e\n",name[i % 3],r.level,
+                r.elements,r.element_time,r.time,r.compliance/full.compliance,err,fabs(ref.vm - r.vm)/ref.vm);
+  }
+}
+
+
+/* stage table with -profile, JSON report with -profile_json <file> */
+void Report_Profile(){
+  PetscBool profile, set_json;
+  char json[PETSC_MAX_PATH_LEN];
+  PetscOptionsHasName(NULL,NULL,"-profile",&profile);
+  PetscOptionsGetString(NULL,NULL,"-profile_json",json,sizeof(json),&set_json);
+  if(profile){
+    Profiler::Instance().Print();
+  }
+  if(set_json){
+    Profiler::Instance().Write_JSON(json);
+  }
+}
+
+
+/*
+ * Phase timings of main on generated meshes. For every size the mesh is
+ * generated and written once, then for every thread count read back and run
+ * through partitioning, element setup, element stiffness, assembly, boundary
+ * conditions, solve and output. One JSON object per run is appended to the
+ * file (JSON lines), so launches with different process counts add to the
+ * same results.
+ */
+void Phase_Benchmark(Mesh_Shape shape, vector<int> const& sizes, vector<int> const& threads,
+                     double perturb, bool shuffle, Quadrature_Rule rule, Material& material,
+                     Solver_Preset preset, string const& json){
+
+  const char* shape_name[] = {"rectangle","l_plate","plate_hole"};
+  const char* rule_name[] = {"2x2","3x3","1point"};
+  const char* phase[] = {"generate","write_mesh","read","partition","element_setup",
+                         "element_stiffness","assembly","bc","solve","write"};
+  const int nphase = 10;
+  PetscMPIInt rank, size;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  MPI_Comm_size(PETSC_COMM_WORLD,&size);
+  auto Stamp = [](){
+    double t;
+    MPI_Barrier(PETSC_COMM_WORLD);
+    PetscTime(&t);
+    return t;
+  };
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nPhase benchmark (%s, %s quadrature, %d processes), seconds:\n",shape_name[shape],rule_name[rule],size);
+  PetscPrintf(PETSC_COMM_WORLD,"%6s %10s %8s","n","elements","threads");
+  for(int p = 2; p < nphase; p++){
+    PetscPrintf(PETSC_COMM_WORLD," %11.11s",phase[p]);
+  }
+  PetscPrintf(PETSC_COMM_WORLD,"\n");
+
+  for(size_t i = 0; i < sizes.size(); i++){
+    double t[nphase+1];
+    Mesh_Generator gen(shape,sizes[i]);
+    gen.Set_Perturbation(perturb);
+    gen.Set_Shuffle(shuffle);
+    t[0] = Stamp();
+    gen.Build();
+    t[1] = Stamp();
+    if(rank == 0){
+      gen.Write("bench_mesh.dat");
+    }
+    const double t_mesh[2] = {t[1]-t[0],Stamp()-t[1]};
+
+    for(size_t j = 0; j < threads.size(); j++){
+#ifdef _OPENMP
+      omp_set_num_threads(max(1,threads[j]));
+#endif
+      t[2] = Stamp();
+      Mesh mesh("bench_mesh.dat");
+      mesh.Set_Mesh_Cache(false);
+      mesh.ReadMeshFile();
+      mesh.Set_Thickness(0.1);
+      t[3] = Stamp();
+      PreProcessor pre(&mesh,&material);
+      pre.Set_num_threads(threads[j]);
+      t[4] = Stamp();
+      pre.Set_quadrature_rule(rule);
+      pre.Create_Quadrature_Objects();
+      pre.Compute_Element_properties();
+      t[5] = Stamp();
+      pre.Compute_Element_stiffness();
+      t[6] = Stamp();
+      pre.Assemble_Stiffness_Matrix();
+      t[7] = Stamp();
+      pre.set_pointload(-1000.0);
+      pre.Apply_BC();
+      t[8] = Stamp();
+      FEA_Solver solver(&pre);
+      solver.Set_preset(preset);
+      solver.solve_disp();
+      t[9] = Stamp();
+      solver.write_sol_disp("_bench");
+      t[10] = Stamp();
+
+      double dt[nphase] = {t_mesh[0],t_mesh[1]};
+      for(int p = 2; p < nphase; p++){
+        dt[p] = t[p+1]-t[p];
+      }
+      PetscPrintf(PETSC_COMM_WORLD,"%6d %10zu %8d",sizes[i],pre.Num_Elements(),threads[j]);
+      for(int p = 2; p < nphase; p++){
+        PetscPrintf(PETSC_COMM_WORLD," %11.4e",dt[p]);
+      }
+      PetscPrintf(PETSC_COMM_WORLD,"\n");
+
+      if(rank == 0){
+        ofstream out(json,ios::app);
+        out << "{\"shape\": \"" << shape_name[shape] << "\", \"n\": " << sizes[i]
+            << ", \"elements\": " << pre.Num_Elements() << ", \"dofs\": " << pre.Num_DOF()
+            << ", \"ranks\": " << size << ", \"threads\": " << threads[j]
+            << ", \"quadrature\": \"" << rule_name[rule] << "\", \"perturb\": " << perturb << ", \"shuffle\": " << (shuffle ? "true" : "false")
+            << ", \"iterations\": " << solver.Iterations() << ", \"seconds\": {";
+        out.precision(6);
+        for(int p = 0; p < nphase; p++){
+          out << (p ? ", " : "") << "\"" << phase[p] << "\": " << scientific << dt[p];
+        }
+        out << "}}\n";
+      }
+    }
+  }
+  PetscPrintf(PETSC_COMM_WORLD,"results appended to %s\n",json.c_str());
+}
+
+
+int main(int argc, char* argv[]){
+
+  PetscInitialize(&argc,&argv,(char*)0,NULL);
+
+  PetscEnum shape;
+  PetscBool generate, gen_shuffle, set_gen_file, bench_phases;
+  PetscInt gen_size = 10;
+  PetscReal gen_perturb = 0.0;
+  char gen_file[PETSC_MAX_PATH_LEN];
+  PetscOptionsGetEnum(NULL,NULL,"-generate",mesh_shape_names,&shape,&generate);
+  PetscOptionsGetInt(NULL,NULL,"-gen_size",&gen_size,NULL);
+  PetscOptionsGetReal(NULL,NULL,"-gen_perturb",&gen_perturb,NULL);
+  PetscOptionsHasName(NULL,NULL,"-gen_shuffle",&gen_shuffle);
+  PetscOptionsGetString(NULL,NULL,"-gen_write",gen_file,sizeof(gen_file),&set_gen_file);
+  PetscOptionsHasName(NULL,NULL,"-bench_phases",&bench_phases);
+  // Quad4 rule: full (2x2), 3x3 or reduced (1 point, hourglass stabilized)
+  PetscEnum qrule;
+  PetscBool set_qrule;
+  PetscOptionsGetEnum(NULL,NULL,"-quadrature",quadrature_rule_names,&qrule,&set_qrule);
+  const Quadrature_Rule rule = set_qrule ? (Quadrature_Rule)qrule : Q2D_2point;
+  PetscEnum preset;
+  PetscBool set_preset;
+  PetscOptionsGetEnum(NULL,NULL,"-solver",solver_preset_names,&preset,&set_preset);
+
+  Material steel(3.0E+7,0.3);
+  steel.Compute_Elastic_Stiffness();
+
+  if(bench_phases){
+    PetscInt bsizes[64], bthreads[64], nsizes = 64, nthreads_list = 64;
+    PetscBool set_sizes, set_threads_list;
+    PetscOptionsGetIntArray(NULL,NULL,"-bench_sizes",bsizes,&nsizes,&set_sizes);
+    PetscOptionsGetIntArray(NULL,NULL,"-bench_threads_list",bthreads,&nthreads_list,&set_threads_list);
+    vector<int> sizes(1,gen_size), threads(1,0);
+    if(set_sizes){
+      sizes.assign(bsizes,bsizes+nsizes);
+    }
+    if(set_threads_list){
+      threads.assign(bthreads,bthreads+nthreads_list);
+    }
+    char json[PETSC_MAX_PATH_LEN] = "bench_phases.json";
+    PetscOptionsGetString(NULL,NULL,"-bench_json",json,sizeof(json),NULL);
+    Phase_Benchmark(generate ? (Mesh_Shape)shape : GEN_RECTANGLE,sizes,threads,gen_perturb,gen_shuffle,
+                    rule,steel,set_preset ? (Solver_Preset)preset : SOLVER_DEFAULT,json);
+    Report_Profile();
+    PetscFinalize();
+    return 0;
+  }
+
+  PetscInt order_levels, quad_levels;
+  PetscBool order_study, quad_study;
+  PetscOptionsGetInt(NULL,NULL,"-order_study",&order_levels,&order_study);
+  PetscOptionsGetInt(NULL,NULL,"-quadrature_study",&quad_levels,&quad_study);
+  if(order_study || quad_study){
+    auto Load_Mesh = [&](Mesh& m){
+      if(generate){
+        Mesh_Generator gen((Mesh_Shape)shape,gen_size);
+        gen.Set_Perturbation(gen_perturb);
+        gen.Build();
+        gen.Generate(m);
+      }else{
+        m.SetMeshFilename("4x4Quad.dat");
+        m.ReadMeshFile();
+      }
+      m.Set_Thickness(0.1);
+    };
+    if(order_study){
+      Element_Order_Study(Load_Mesh,steel,order_levels,set_preset ? (Solver_Preset)preset : SOLVER_DEFAULT);
+    }
+    if(quad_study){
+      Quadrature_Study(Load_Mesh,steel,quad_levels,set_preset ? (Solver_Preset)preset : SOLVER_DEFAULT);
+    }
+    Report_Profile();
+    PetscFinalize();
+    return 0;
+  }
+
+  // the PETSc objects of the problem are destroyed at the end of this block,
+  // before PetscFinalize()
+  {
+    Mesh mesh("4x4Quad.dat");
+    if(generate){
+      // in memory, nothing read
+      Profile_Stage stage("Mesh generation");
+      Mesh_Generator gen((Mesh_Shape)shape,gen_size);
+      gen.Set_Perturbation(gen_perturb);
+      gen.Set_Shuffle(gen_shuffle);
+      gen.Build();
+      PetscPrintf(PETSC_COMM_WORLD,"Generated mesh: %zu nodes, %zu elements\n",gen.Num_Nodes(),gen.Num_Elements());
+      PetscMPIInt rank;
+      MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+      if(set_gen_file && rank == 0){
+        const size_t bytes = gen.Write(gen_file);
+        PetscPrintf(PETSC_COMM_SELF,"  written to %s, %zu bytes\n",gen_file,bytes);
+      }
+      gen.Generate(mesh);
+    }else{
+      PetscBool no_cache;
+      PetscOptionsHasName(NULL,NULL,"-no_mesh_cache",&no_cache);
+      mesh.Set_Mesh_Cache(!no_cache);
+      Profile_Stage stage("Mesh read");
+      mesh.ReadMeshFile();
+    }
+    PetscInt nrefine;
+    PetscBool set_refine;
+    PetscOptionsGetInt(NULL,NULL,"-refine",&nrefine,&set_refine);
+    for(int i = 0; set_refine && i < nrefine; i++){
+      mesh.Refine();
+    }
+    // quadratic elements on the midpoints of the quad edges
+    PetscEnum element;
+    PetscBool set_element;
+    PetscOptionsGetEnum(NULL,NULL,"-element",element_type_names,&element,&set_element);
+    if(set_element && (Element_Type)element != ELEM_QUAD4){
+      mesh.Elevate_Order(element_type_nodes[element]);
+    }
+    mesh.Set_Thickness(0.1);
+    mesh.ValidateMesh();
+    // node coordinates for matlab (mesh.m), on request only
+    PetscBool write_mesh;
+    PetscOptionsHasName(NULL,NULL,"-write_mesh",&write_mesh);
+    if(write_mesh){
+      mesh.WriteMesh(Mesh::MATLAB);
+    }
+
+    steel.Print_Elastic_Stiffness();
+
+    PetscEnum cmode;
+    PetscBool set_cmode;
+    PetscOptionsGetEnum(NULL,NULL,"-constraints",constraint_mode_names,&cmode,&set_cmode);
+
+    PetscInt levels;
+    PetscBool scaling;
+    PetscOptionsGetInt(NULL,NULL,"-scaling_levels",&levels,&scaling);
+    if(scaling){
+      Scaling_Study(mesh,steel,levels,set_cmode ? (Constraint_Mode)cmode : BC_SYMMETRIC,
+                    set_preset ? (Solver_Preset)preset : SOLVER_ELASTICITY);
+      Report_Profile();
+      PetscFinalize();
+      return 0;
+    }
+
+    PreProcessor pre(&mesh,&steel);
+    pre.Report_Partition();
+    PetscBool rcm;
+    PetscOptionsHasName(NULL,NULL,"-rcm",&rcm);
+    if(rcm){
+      pre.Reorder_Nodes_RCM();
+    }
+    PetscInt nthreads;
+    PetscBool set_threads;
+    PetscOptionsGetInt(NULL,NULL,"-num_threads",&nthreads,&set_threads);
+    if(set_threads){
+      pre.Set_num_threads(nthreads);
+    }
+    if(set_cmode){
+      pre.Set_constraint_mode((Constraint_Mode)cmode);
+    }
+    PetscEnum shell;
+    PetscBool matrix_free;
+    PetscOptionsGetEnum(NULL,NULL,"-matrix_free",shell_mode_names,&shell,&matrix_free);
+    if(matrix_free){
+      pre.Set_matrix_format((Shell_Mode)shell == SHELL_RECOMPUTE ? K_SHELL_RECOMPUTE : K_SHELL);
+    }
+    pre.Set_quadrature_rule(rule);
+    pre.Create_Quadrature_Objects();
+
+    pre.Compute_Element_properties();
+    pre.Compute_Element_stiffness();
+
+    PetscBool bench_kernel;
+    PetscOptionsHasName(NULL,NULL,"-bench_kernel",&bench_kernel);
+    if(bench_kernel){
+      pre.Benchmark_Element_Stiffness(10000);
+    }
+
+    pre.Assemble_Stiffness_Matrix();
+
+    PetscBool bench_matrix_free;
+    PetscOptionsHasName(NULL,NULL,"-bench_matrix_free",&bench_matrix_free);
+    if(bench_matrix_free && matrix_free){
+      pre.Benchmark_Matrix_Free(100);
+    }
+
+    PetscBool bench_threads;
+    PetscOptionsHasName(NULL,NULL,"-bench_threads",&bench_threads);
+    if(bench_threads){
+      pre.Benchmark_Threads();
+    }
+
+    pre.set_pointload(-1000.0);
+    pre.Apply_BC();
+
+    FEA_Solver solver(&pre);
+    if(set_preset){
+      solver.Set_preset((Solver_Preset)preset);
+    }
+    PetscEnum eformat;
+    PetscBool set_format;
+    PetscOptionsGetEnum(NULL,NULL,"-output",output_format_names,&eformat,&set_format);
+    const Output_Format format = set_format ? (Output_Format)eformat : OUT_TEXT;
+    if(set_format){
+      solver.Set_output_format(format);
+    }
+    solver.solve_disp();
+
+    PostProcessor post(&pre,&solver);
+    post.Recover_Stresses();
+    if(format == OUT_VTK){
+      post.Write_VTK("solution.vtu");
+    }else{
+      solver.write_sol_disp();
+      post.Write_Nodal_Stress();
+    }
+    post.Write_Reactions();
+
+    char load_file[PETSC_MAX_PATH_LEN];
+    PetscBool set_cases;
+    PetscOptionsGetString(NULL,NULL,"-load_cases",load_file,sizeof(load_file),&set_cases);
+    if(set_cases){
+      pre.Read_Load_Cases(load_file);
+      solver.solve_load_cases();
+    }
+
+    PetscReal sweep_E[1024], sweep_t[1024], sweep_nu[1024];
+    PetscInt nE = 1024, nt = 1024, nnu = 1024;
+    PetscBool sweep, set_t, set_nu, sweep_write;
+    PetscOptionsGetRealArray(NULL,NULL,"-sweep_E",sweep_E,&nE,&sweep);
+    PetscOptionsGetRealArray(NULL,NULL,"-sweep_thickness",sweep_t,&nt,&set_t);
+    PetscOptionsGetRealArray(NULL,NULL,"-sweep_nu",sweep_nu,&nnu,&set_nu);
+    PetscOptionsHasName(NULL,NULL,"-sweep_write",&sweep_write);
+    if(sweep){
+      vector<double> E(sweep_E,sweep_E+nE);
+      vector<double> t(1,mesh.Get_Thickness()), nu(1,steel.Get_PoissonsRatio());
+      if(set_t){
+        assert(nt == 1 || nt == nE);
+        t.assign(sweep_t,sweep_t+nt);
+      }
+      if(set_nu){
+        nu.assign(sweep_nu,sweep_nu+nnu);
+      }
+      Parameter_Sweep(pre,solver,E,t,nu,sweep_write);
+    }
+
+    Report_Profile();
 
-  cout << "Program Finished!" << endl;
+    cout << "Program Finished!" << endl;
+  }
 
-  // call destructor to free PETSc objects before PetscFinalize()
-  pre.~PreProcessor();
-  solver.~FEA_Solver();
   PetscFinalize();
 
   return 0;
@@ -22,6 +22,8 @@ public:
   Material(double const&,double const&);
   void set_YoungsModulus(double const&);
   void set_PoissonsRatio(double const&);
+  double Get_YoungsModulus() const {return E;}
+  double Get_PoissonsRatio() const {return nu;}
   void Compute_Elastic_Stiffness();
   void Print_Elastic_Stiffness();
   double** Get_Element_Stiffness() const {return Estiff;}
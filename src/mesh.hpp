@@ -7,78 +7,182 @@
 #include <fstream>
 #include <cassert>
 #include <iomanip>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "meshparse.hpp"
+#include "meshcache.hpp"
+#include "writer.hpp"
 
 using namespace std;
 
 
 /*
- * CLASS NODE -> contains mesh coordinate details
+ * CLASS MESH_ARRAY -> mesh storage that either owns its records or views
+ * records living in a mapped mesh cache (see Attach). Both are used the same
+ * way; only an owning array can grow.
  */
-class Node{
-  friend class Mesh;
-  friend class PreProcessor;
-  friend class Quad4;
+template<class T>
+class Mesh_Array{
 private:
-  int NodeID;
-  double x,y,z;
+  vector<T> own;
+  T* data;
+  size_t n;
+
+public:
+  Mesh_Array() : data(NULL), n(0) {}
+  Mesh_Array(const Mesh_Array& a) : own(a.begin(),a.end()), data(own.data()), n(a.n) {}
+  Mesh_Array& operator=(const Mesh_Array& a){
+    own.assign(a.begin(),a.end()); data = own.data(); n = a.n;
+    return *this;
+  }
+
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  bool Is_View() const { return n > 0 && data != own.data(); }
+  T& operator[](size_t i){ return data[i]; }
+  const T& operator[](size_t i) const { return data[i]; }
+  T* begin(){ return data; }
+  T* end(){ return data+n; }
+  const T* begin() const { return data; }
+  const T* end() const { return data+n; }
+
+  void resize(size_t m){
+    assert(!Is_View());
+    own.resize(m); data = own.data(); n = m;
+  }
+  void reserve(size_t m){
+    assert(!Is_View());
+    own.reserve(m); data = own.data();
+  }
+  void push_back(const T& v){
+    assert(!Is_View());
+    own.push_back(v); data = own.data(); n = own.size();
+  }
+  void Attach(T* p, size_t m){
+    vector<T>().swap(own);
+    data = p; n = m;
+  }
+
+  size_t Heap_Bytes() const { return own.capacity()*sizeof(T); }
+  size_t Mapped_Bytes() const { return Is_View() ? n*sizeof(T) : 0; }
 };
 
 
 /*
- * CLASS FACE -> contains mesh faces and its connected nodes
+ * Element types, one connectivity block each. Elements are numbered block
+ * after block in this order (quadrilaterals before triangles), file order
+ * within a block.
  */
-class Face{
-  friend class Mesh;
-  friend class PreProcessor;
-  friend class Quad4;
+typedef enum {ELEM_QUAD4, ELEM_QUAD8, ELEM_QUAD9, ELEM_TRI3, ELEM_TYPES} Element_Type;
+
+static const int element_type_nodes[ELEM_TYPES] = {4, 8, 9, 3};
+/* the quadrilateral types, -element */
+static const char* const element_type_names[] = {"quad4","quad8","quad9","Element_Type","ELEM_",NULL};
+#define MAX_ELEMENT_NODES 9
+static_assert(ELEM_TYPES == MESH_CACHE_TYPES, "one cache section per element type");
+
+
+/*
+ * CLASS NODE_LIST -> view of node numbers (from 1) held by the mesh: the
+ * connectivity of one element or the nodes of one selection
+ */
+class Node_List{
 private:
-  typedef enum {TRI, QUAD} FaceType;
-  FaceType Ftype;
-  int FaceID;
-  vector<int> nodes;
+  const int32_t* p;
+  size_t n;
+
+public:
+  Node_List(const int32_t* q, size_t m) : p(q), n(m) {}
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  const int32_t& operator[](size_t i) const { return p[i]; }
+  const int32_t* begin() const { return p; }
+  const int32_t* end() const { return p+n; }
 };
 
 
 /*
- * CLASS BOUNDARY -> identifies boundary nodes
+ * CLASS ELEMENT_BLOCK -> the elements of one type: nen node numbers per
+ * element at a fixed stride, in one int32 array
  */
-class Boundary{
+class Element_Block{
   friend class Mesh;
-  friend class PreProcessor;
+  friend class Mesh_Generator;
 private:
-  typedef enum {NODE, ELEMENT} BoundaryType;
+  int nen;
+  size_t first;                   // mesh number of the first element
+  Mesh_Array<int32_t> conn;
 
-  string name;
-  BoundaryType BType;
-  vector<int> nodes;
+public:
+  Element_Block() : nen(0), first(0) {}
+  size_t size() const { return nen ? conn.size()/nen : 0; }
+  int Nodes_per_element() const { return nen; }
+  size_t First() const { return first; }
+  const int32_t* Connectivity() const { return conn.begin(); }
+  Node_List operator[](size_t e) const { return Node_List(&conn[e*nen],nen); }
 };
 
 
 /*
- * CLASS MESH -> Reads the mesh file and populates mesh data
+ * CLASS MESH -> Reads the mesh file and populates mesh data. Nodes are
+ * stored as separate x and y arrays (node n at n-1), elements in one block
+ * per type, named node selections as offsets into one node array.
  */
 class Mesh{
   friend class PreProcessor;
+  friend class Mesh_Generator;
 private:
-  vector<Node> node;
-  vector<Face> face;
-  vector<Boundary> boundary;
+  Mesh_Array<double> x, y;
+  Element_Block block[ELEM_TYPES];
+  vector<string> selection;       // names; selection s holds the nodes
+  Mesh_Array<int64_t> sel_ptr;    // sel_node[sel_ptr[s] .. sel_ptr[s+1]-1]
+  Mesh_Array<int32_t> sel_node;
   bool set_filename;
   string filename;
   bool isQuadPresent, isTriPresent;
+  bool isQuad8Present, isQuad9Present;
   double thickness;
+  bool use_cache;                 // read/write <filename>.bin
+  void* cache_map;                // mapped cache backing the arrays above
+  size_t cache_bytes;
+
+  bool Read_Mesh_Cache();
+  void Write_Mesh_Cache() const;
+  void Append_Elements(vector<int> const&, vector<unsigned char> const&);
+  void Add_Selection(string const&, vector<int> const&);
+  void Set_Element_Types();
+  void Extend_Selections(vector<int> const&, long long);
+  void Release_Cache();
 
 public:
 
   typedef enum {MATLAB,CSV} OUTPUT_MESH_FORMAT;
   Mesh();
   Mesh(string const&);
+  ~Mesh();
+  Mesh(const Mesh&) = delete;
+  Mesh& operator=(const Mesh&) = delete;
   void SetMeshFilename(string const&);
+  void Set_Mesh_Cache(bool);
   void ReadMeshFile();
+  void ReadMeshFile_Stream();
   void ValidateMesh();
+  void Refine();
+  void Elevate_Order(int);
   void WriteMesh(OUTPUT_MESH_FORMAT const&);
   void Set_Thickness(double const&);
   double Get_Thickness() const ;
+
+  size_t Nodes() const { return x.size(); }
+  size_t Elements() const;
+  Node_List Element(size_t) const;
+  size_t Selections() const { return selection.size(); }
+  Node_List Selection(size_t s) const { return Node_List(&sel_node[sel_ptr[s]],sel_ptr[s+1]-sel_ptr[s]); }
+  size_t Bytes() const;
 };
 
 
@@ -88,12 +192,25 @@ Mesh::Mesh(){
   set_filename = false;
   isQuadPresent = false;
   isTriPresent = false;
+  isQuad8Present = false;
+  isQuad9Present = false;
+  use_cache = true;
+  cache_map = NULL;
+  cache_bytes = 0;
+  for(int t = 0; t < ELEM_TYPES; t++){
+    block[t].nen = element_type_nodes[t];
+  }
+  sel_ptr.push_back(0);
 }
 
-Mesh::Mesh(const string &a){
+Mesh::Mesh(const string &a) : Mesh(){
   SetMeshFilename(a);
-  isQuadPresent = false;
-  isTriPresent = false;
+}
+
+Mesh::~Mesh(){
+  if(cache_map){
+    munmap(cache_map,cache_bytes);
+  }
 }
 
 void Mesh::SetMeshFilename(const string &a){
@@ -103,90 +220,464 @@ void Mesh::SetMeshFilename(const string &a){
 }
 
 
+void Mesh::Set_Mesh_Cache(bool flag){
+  use_cache = flag;
+}
+
+
+size_t Mesh::Elements() const {
+  size_t n = 0;
+  for(int t = 0; t < ELEM_TYPES; t++){
+    n += block[t].size();
+  }
+  return n;
+}
+
+
+/* nodes of element e in mesh numbering */
+Node_List Mesh::Element(size_t e) const {
+  int t = 0;
+  while(e >= block[t].first + block[t].size()){
+    t++;
+    assert(t < ELEM_TYPES);
+  }
+  return block[t][e - block[t].first];
+}
+
+
+/*
+ * Memory maps the mesh file and parses it in place. Node and element records
+ * are counted first so the containers are sized once, then the sections are
+ * parsed in parallel (see Parse_Lines). Gives the same mesh as
+ * ReadMeshFile_Stream.
+ *
+ * With the mesh cache on, a valid <filename>.bin is mapped instead and
+ * nothing is parsed; otherwise the cache is written after parsing.
+ */
 void Mesh::ReadMeshFile(){
 
   /* assert if input filename is set */
   assert(set_filename);
 
+  if(use_cache && Read_Mesh_Cache()){
+    return;
+  }
+
+  int fd = open(filename.c_str(),O_RDONLY);
+  assert(fd >= 0);
+  struct stat st;
+  fstat(fd,&st);
+  const size_t len = st.st_size;
+  assert(len > 0);
+  void* map = mmap(NULL,len,PROT_READ,MAP_PRIVATE,fd,0);
+  assert(map != MAP_FAILED);
+  madvise(map,len,MADV_WILLNEED);
+
+  const char* p = (const char*) map;
+  const char* end = p + len;
+
+  for(;;){
+
+    p = Skip_Blank(p,end);
+    if(p == end){
+      break;
+    }
+    const char* tok = p;
+    p = Skip_Token(p,end);
+    string parameter(tok,p);
+
+    if(parameter.compare("#Nodes") == 0){
+      size_t n;
+      const char* stop = Section_End(p,end,n);
+      const size_t n0 = x.size();
+      x.resize(n0+n);
+      y.resize(n0+n);
+
+      // node ids are the line numbers, z is not used
+      size_t nread = Parse_Lines(p,stop,[&](const char* q, const char* e, size_t r){
+        int id;
+        double z;
+        q = Parse_Int(q,e,id);
+        q = Parse_Double(q,e,x[n0+r]);
+        q = Parse_Double(q,e,y[n0+r]);
+        Parse_Double(q,e,z);
+      });
+      assert(nread == n);
+      p = Skip_Token(Skip_Blank(stop,end),end);
+    }
+
+    if(parameter.compare("#Elements") == 0){
+      size_t n;
+      const char* stop = Section_End(p,end,n);
+      // records at the largest stride first, sorted into the blocks after
+      vector<int> rec(n*MAX_ELEMENT_NODES);
+      vector<unsigned char> nen_rec(n);
+
+      size_t nread = Parse_Lines(p,stop,[&](const char* q, const char* e, size_t r){
+        int check, id, nen = 4;
+        int* nodes = &rec[r*MAX_ELEMENT_NODES];
+        q = Parse_Int(q,e,check);
+        // nine columns, the eighth is the node count (8 or 9 for quadratic
+        // elements), the others are not used by the solver
+        for(int i = 0; i < 9; i++){
+          if(i == 7){
+            q = Parse_Int(q,e,nen);
+          }else{
+            q = Skip_Token(Skip_Blank(q,e),e);
+          }
+        }
+        if(nen != 8 && nen != 9){
+          nen = 4;
+        }
+        q = Parse_Int(q,e,id);
+        for(int i = 0; i < nen; i++){
+          q = Parse_Int(q,e,nodes[i]);
+        }
+        // triangles come as quads with the last node repeated
+        if(nen == 4 && nodes[2] == nodes[3]){
+          nen = 3;
+        }
+        nen_rec[r] = nen;
+      });
+      assert(nread == n);
+
+      Append_Elements(rec,nen_rec);
+      p = Skip_Token(Skip_Blank(stop,end),end);
+    }
+
+    if(parameter.compare("#NamedSelection") == 0){
+
+      double size;
+      p = Skip_Blank(p,end); tok = p; p = Skip_Token(p,end);
+      string name(tok,p);
+      p = Skip_Blank(p,end); tok = p; p = Skip_Token(p,end);
+      string btype(tok,p);
+
+      if(btype.compare("NODE")!=0){
+        cerr << "ERROR in Boundary "<< name << endl;
+      }
+
+      p = Parse_Double(p,end,size);
+      vector<int> nodes(size);
+      for(int i = 0; i < size; i++){
+        p = Parse_Int(p,end,nodes[i]);
+      }
+      Add_Selection(name,nodes);
+    }
+
+    if(parameter.compare("#End") == 0 || parameter.compare("#end") == 0){
+      break;
+    }
+
+  } // end for
+
+  munmap(map,len);
+  close(fd);
+  Set_Element_Types();
+
+  if(use_cache){
+    Write_Mesh_Cache();
+  }
+} // end mesh read function
+
+
+/*
+ * Appends element records (MAX_ELEMENT_NODES ints each, nen[r] used) to the
+ * blocks of their types, in file order within each type.
+ */
+void Mesh::Append_Elements(vector<int> const& rec, vector<unsigned char> const& nen){
+
+  const size_t n = nen.size();
+  vector<Element_Type> type(n);
+  size_t count[ELEM_TYPES] = {0, 0, 0, 0};
+  for(size_t r = 0; r < n; r++){
+    type[r] = (nen[r] == 3) ? ELEM_TRI3 : (nen[r] == 8) ? ELEM_QUAD8 : (nen[r] == 9) ? ELEM_QUAD9 : ELEM_QUAD4;
+    count[type[r]]++;
+  }
+
+  size_t fill[ELEM_TYPES];
+  for(int t = 0; t < ELEM_TYPES; t++){
+    fill[t] = block[t].conn.size();
+    block[t].conn.resize(fill[t] + count[t]*block[t].nen);
+  }
+  for(size_t r = 0; r < n; r++){
+    Element_Block& b = block[type[r]];
+    memcpy(&b.conn[fill[type[r]]],&rec[r*MAX_ELEMENT_NODES],b.nen*sizeof(int32_t));
+    fill[type[r]] += b.nen;
+  }
+}
+
+
+/* one named node selection, appended to the selection arrays */
+void Mesh::Add_Selection(string const& name, vector<int> const& nodes){
+  selection.push_back(name);
+  for(size_t i = 0; i < nodes.size(); i++){
+    sel_node.push_back(nodes[i]);
+  }
+  sel_ptr.push_back(sel_node.size());
+}
+
+
+/* numbers the elements block after block and reports the types present */
+void Mesh::Set_Element_Types(){
+  size_t first = 0;
+  for(int t = 0; t < ELEM_TYPES; t++){
+    block[t].first = first;
+    first += block[t].size();
+  }
+  if(block[ELEM_QUAD4].size() > 0 && !isQuadPresent){
+    isQuadPresent = true;
+    cout << "Quad Face is present" << endl;
+  }
+  if(block[ELEM_TRI3].size() > 0 && !isTriPresent){
+    isTriPresent = true;
+    cout << "Tri Face is present" << endl;
+  }
+  if(block[ELEM_QUAD8].size() > 0 && !isQuad8Present){
+    isQuad8Present = true;
+    cout << "Quad8 Face is present" << endl;
+  }
+  if(block[ELEM_QUAD9].size() > 0 && !isQuad9Present){
+    isQuad9Present = true;
+    cout << "Quad9 Face is present" << endl;
+  }
+}
+
+
+/*
+ * Maps <filename>.bin copy-on-write and points the coordinate, connectivity
+ * and selection arrays into it. Returns false, leaving the mesh untouched,
+ * when the cache is missing, from another build or byte order, not made
+ * from the current ASCII file, has a section outside the file or fails the
+ * checksum.
+ */
+bool Mesh::Read_Mesh_Cache(){
+
+  struct stat src;
+  if(stat(filename.c_str(),&src) != 0){
+    return false;
+  }
+
+  const string cname = filename + ".bin";
+  int fd = open(cname.c_str(),O_RDONLY);
+  if(fd < 0){
+    return false;
+  }
+  struct stat st;
+  fstat(fd,&st);
+  const size_t len = st.st_size;
+  if(len < sizeof(Mesh_Cache_Header)){
+    close(fd);
+    return false;
+  }
+  void* map = mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(map == MAP_FAILED){
+    return false;
+  }
+
+  char* base = (char*) map;
+  const Mesh_Cache_Header& h = *(const Mesh_Cache_Header*) map;
+  bool valid = memcmp(h.magic,"2DFEAMSH",8) == 0 && h.version == MESH_CACHE_VERSION
+            && h.byte_order == 0x01020304 && h.types == ELEM_TYPES && h.file_bytes == len
+            && h.source_bytes == (uint64_t) src.st_size && h.source_mtime == (int64_t) src.st_mtim.tv_sec
+            && h.source_mtime_ns == (int64_t) src.st_mtim.tv_nsec;
+  // every section within the file before anything is read from it
+  valid = valid && Cache_Section(h.x_off,h.nnode,sizeof(double),len)
+                && Cache_Section(h.y_off,h.nnode,sizeof(double),len)
+                && Cache_Section(h.selection_off,h.nselection,sizeof(Cache_Selection),len)
+                && h.nselection < len && Cache_Section(h.sel_ptr_off,h.nselection+1,sizeof(int64_t),len)
+                && Cache_Section(h.sel_node_off,h.nsel_node,sizeof(int32_t),len);
+  for(int t = 0; valid && t < ELEM_TYPES; t++){
+    valid = Cache_Section(h.conn_off[t],h.nelem[t],block[t].nen*sizeof(int32_t),len);
+  }
+  if(valid){
+    valid = Cache_File_Checksum(base,len) == h.checksum;
+  }
+  if(valid){
+    const int64_t* ptr = (const int64_t*)(base+h.sel_ptr_off);
+    valid = ptr[0] == 0 && ptr[h.nselection] == (int64_t) h.nsel_node;
+  }
+  if(!valid){
+    munmap(map,len);
+    return false;
+  }
+
+  x.Attach((double*)(base+h.x_off),h.nnode);
+  y.Attach((double*)(base+h.y_off),h.nnode);
+  for(int t = 0; t < ELEM_TYPES; t++){
+    block[t].conn.Attach((int32_t*)(base+h.conn_off[t]),h.nelem[t]*block[t].nen);
+  }
+
+  const Cache_Selection* cs = (const Cache_Selection*)(base+h.selection_off);
+  selection.resize(h.nselection);
+  for(size_t i = 0; i < selection.size(); i++){
+    selection[i] = string(cs[i].name,strnlen(cs[i].name,MESH_CACHE_NAME));
+  }
+  sel_ptr.Attach((int64_t*)(base+h.sel_ptr_off),h.nselection+1);
+  sel_node.Attach((int32_t*)(base+h.sel_node_off),h.nsel_node);
+
+  cache_map = map;
+  cache_bytes = len;
+  Set_Element_Types();
+  return true;
+}
+
+
+/*
+ * Writes <filename>.bin from rank 0. The file is written under a temporary
+ * name and renamed, so a concurrent run never maps a partial cache.
+ */
+void Mesh::Write_Mesh_Cache() const {
+
+  int rank = 0, initialized = 0;
+  MPI_Initialized(&initialized);
+  if(initialized){
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  }
+  if(rank != 0){
+    return;
+  }
+
+  struct stat src;
+  if(stat(filename.c_str(),&src) != 0){
+    return;
+  }
+
+  Mesh_Cache_Header h;
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,"2DFEAMSH",8);
+  h.version = MESH_CACHE_VERSION;
+  h.byte_order = 0x01020304;
+  h.types = ELEM_TYPES;
+  h.nnode = x.size();
+  h.nselection = selection.size();
+  h.nsel_node = sel_node.size();
+  h.x_off = Cache_Align(sizeof(h));
+  h.y_off = Cache_Align(h.x_off + h.nnode*sizeof(double));
+  uint64_t off = h.y_off + h.nnode*sizeof(double);
+  for(int t = 0; t < ELEM_TYPES; t++){
+    h.nelem[t] = block[t].size();
+    h.conn_off[t] = Cache_Align(off);
+    off = h.conn_off[t] + block[t].conn.size()*sizeof(int32_t);
+  }
+  h.selection_off = Cache_Align(off);
+  h.sel_ptr_off = Cache_Align(h.selection_off + h.nselection*sizeof(Cache_Selection));
+  h.sel_node_off = Cache_Align(h.sel_ptr_off + (h.nselection+1)*sizeof(int64_t));
+  h.file_bytes = Cache_Align(h.sel_node_off + h.nsel_node*sizeof(int32_t));
+  h.source_bytes = src.st_size;
+  h.source_mtime = src.st_mtim.tv_sec;
+  h.source_mtime_ns = src.st_mtim.tv_nsec;
+
+  vector<char> buf(h.file_bytes,0);
+  char* base = buf.data();
+  memcpy(base+h.x_off,x.begin(),h.nnode*sizeof(double));
+  memcpy(base+h.y_off,y.begin(),h.nnode*sizeof(double));
+  for(int t = 0; t < ELEM_TYPES; t++){
+    memcpy(base+h.conn_off[t],block[t].conn.begin(),block[t].conn.size()*sizeof(int32_t));
+  }
+  Cache_Selection* cs = (Cache_Selection*)(base+h.selection_off);
+  for(size_t i = 0; i < selection.size(); i++){
+    assert(selection[i].size() < MESH_CACHE_NAME);
+    strncpy(cs[i].name,selection[i].c_str(),MESH_CACHE_NAME-1);
+  }
+  memcpy(base+h.sel_ptr_off,sel_ptr.begin(),(h.nselection+1)*sizeof(int64_t));
+  memcpy(base+h.sel_node_off,sel_node.begin(),h.nsel_node*sizeof(int32_t));
+  memcpy(base,&h,sizeof(h));
+  h.checksum = Cache_File_Checksum(base,h.file_bytes);
+  memcpy(base,&h,sizeof(h));
+
+  const string cname = filename + ".bin";
+  const string tname = cname + ".tmp";
+  ofstream cfile(tname,ios::binary);
+  if(!cfile.is_open()){
+    cerr << "Warning: cannot write mesh cache " << cname << endl;
+    return;
+  }
+  cfile.write(base,h.file_bytes);
+  cfile.close();
+  if(!cfile || rename(tname.c_str(),cname.c_str()) != 0){
+    cerr << "Warning: cannot write mesh cache " << cname << endl;
+    remove(tname.c_str());
+  }
+}
+
+
+/* token by token reader, kept as the reference for ReadMeshFile */
+void Mesh::ReadMeshFile_Stream(){
+
+  /* assert if input filename is set */
+  assert(set_filename);
+
   ifstream mfile(filename);
   assert(mfile.is_open());
 
   string parameter;
 
-  while(!mfile.eof()){
+  // stop when no token is left, files need not end with #End
+  while(mfile >> parameter){
 
-    mfile >> parameter;
     //cout << parameter << endl;
     if(parameter.compare("#Nodes") == 0){
       for(;;){
-        Node read_node;
-        mfile >> read_node.NodeID;
-        if(read_node.NodeID == -1){
+        int id;
+        double px, py, pz;
+        mfile >> id;
+        if(id == -1){
           break;
         }
-        mfile >> read_node.x >> read_node.y >> read_node.z;
-        node.push_back(read_node);
-        //cout << setw(12) << read_node.x << setw(12) << read_node.y << setw(12) << read_node.z << endl;
+        mfile >> px >> py >> pz;
+        x.push_back(px);
+        y.push_back(py);
       }
     }
 
     if(parameter.compare("#Elements") == 0){
 
+      vector<int> rec;
+      vector<unsigned char> nen_rec;
       for(;;){
-        Face read_face;
-        int check, temp;
+        int check, temp, id;
         mfile >> check;
         if(check == -1){
           break;
         }
-        mfile >> temp >> temp >> temp >> temp >> temp >> temp >> temp >> temp >> temp;
-        mfile >> read_face.FaceID;
-        mfile >> temp; read_face.nodes.push_back(temp);
-        mfile >> temp; read_face.nodes.push_back(temp);
-        mfile >> temp; read_face.nodes.push_back(temp);
-        mfile >> temp; read_face.nodes.push_back(temp);
-
-        assert(read_face.nodes[2] != read_face.nodes[3]);
-        read_face.Ftype = Face::QUAD;
-        if(read_face.Ftype == Face::QUAD && !isQuadPresent){
-          isQuadPresent = true;
-          cout << "Quad Face is present" << endl;
+        int nen;
+        mfile >> temp >> temp >> temp >> temp >> temp >> temp >> temp >> nen >> temp;
+        if(nen != 8 && nen != 9){
+          nen = 4;
         }
-        if(read_face.Ftype == Face::TRI && !isTriPresent){
-          isTriPresent = true;
-          cout << "Tri Face is present" << endl;
+        mfile >> id;
+        const size_t r = nen_rec.size();
+        rec.resize((r+1)*MAX_ELEMENT_NODES);
+        for(int i = 0; i < nen; i++){
+          mfile >> rec[r*MAX_ELEMENT_NODES+i];
         }
 
-        face.push_back(read_face);
-
-        //cout << setw(12) << read_face.FaceID << setw(12) << read_face.nodes[0] << setw(12) << read_face.nodes[1]
-        //     << setw(12) << read_face.nodes[2] << setw(12) << read_face.nodes[3] << endl;
+        if(nen == 4 && rec[r*MAX_ELEMENT_NODES+2] == rec[r*MAX_ELEMENT_NODES+3]){
+          nen = 3;
+        }
+        nen_rec.push_back(nen);
       }
+      Append_Elements(rec,nen_rec);
     }
 
     if(parameter.compare("#NamedSelection") == 0){
 
       double size;
-      Boundary read_b;
-      mfile >> read_b.name;
-      string btype;
-      mfile >> btype;
+      string name, btype;
+      mfile >> name >> btype;
 
-      if(btype.compare("NODE")==0){
-        read_b.BType = Boundary::NODE;
-      }else{
-        cerr << "ERROR in Boundary "<< read_b.name << endl;
+      if(btype.compare("NODE")!=0){
+        cerr << "ERROR in Boundary "<< name << endl;
       }
 
       mfile >> size;
+      vector<int> nodes(size);
       for(int i = 0; i < size; i++){
-        int buf;
-        mfile >> buf;
-        read_b.nodes.push_back(buf);
-        //cout << read_b.nodes[i] << "\t";
+        mfile >> nodes[i];
       }
-      //cout << endl;
-      boundary.push_back(read_b);
+      Add_Selection(name,nodes);
     }
 
     if(parameter.compare("#End") == 0 || parameter.compare("#end") == 0){
@@ -195,15 +686,232 @@ void Mesh::ReadMeshFile(){
 
   } // end while
   mfile.close();
+  Set_Element_Types();
 } // end mesh read function
 
 
+/*
+ * Uniform refinement: every quad is split into four through its edge
+ * midpoints and its centre, children keep the orientation of the parent.
+ * A midpoint joins a node selection when both ends of its edge belong to
+ * it, so supports along edges stay supports; single nodes (point loads)
+ * stay single. New nodes are numbered after the existing ones.
+ */
+void Mesh::Refine(){
+
+  assert(!isTriPresent && !isQuad8Present && !isQuad9Present);
+
+  const Element_Block& quad = block[ELEM_QUAD4];
+  Mesh_Array<double> new_x = x, new_y = y;
+  Mesh_Array<int32_t> new_conn;
+  new_conn.reserve(16*quad.size());
+  const long long nold = x.size();
+
+  // edge (lo,hi) -> midpoint, and the edges in order of creation
+  unordered_map<long long,int> edge_mid;
+  edge_mid.reserve(2*quad.size());
+  vector<int> edge_list;
+
+  auto Add_Node = [&](double px, double py){
+    new_x.push_back(px);
+    new_y.push_back(py);
+    return int(new_x.size());
+  };
+  auto Midpoint = [&](int a, int b){
+    const long long key = (long long)min(a,b)*(nold+1) + max(a,b);
+    unordered_map<long long,int>::iterator it = edge_mid.find(key);
+    if(it != edge_mid.end()){
+      return it->second;
+    }
+    const int m = Add_Node(0.5*(x[a-1]+x[b-1]),0.5*(y[a-1]+y[b-1]));
+    edge_mid[key] = m;
+    edge_list.push_back(min(a,b));
+    edge_list.push_back(max(a,b));
+    edge_list.push_back(m);
+    return m;
+  };
+
+  for(size_t i = 0; i < quad.size(); i++){
+    const Node_List n = quad[i];
+    int m[4];
+    for(int k = 0; k < 4; k++){
+      m[k] = Midpoint(n[k],n[(k+1)%4]);
+    }
+    double cx = 0, cy = 0;
+    for(int k = 0; k < 4; k++){
+      cx += 0.25*x[n[k]-1];
+      cy += 0.25*y[n[k]-1];
+    }
+    const int c = Add_Node(cx,cy);
+
+    // child k keeps corner k: (corner, next midpoint, centre, previous midpoint)
+    for(int k = 0; k < 4; k++){
+      const int corner[4] = {n[k], m[k], c, m[(k+3)%4]};
+      for(int a = 0; a < 4; a++){
+        new_conn.push_back(corner[a]);
+      }
+    }
+  }
+
+  Extend_Selections(edge_list,nold);
+  x = new_x;
+  y = new_y;
+  block[ELEM_QUAD4].conn = new_conn;
+  Set_Element_Types();
+
+  // nothing views the mesh cache any more
+  Release_Cache();
+}
+
+
+/*
+ * Quadratic elements from the quads (nen = 8 or 9): a node at the midpoint of
+ * every edge and, for Quad9, at the centre of every face, numbered after the
+ * existing nodes; the corners keep their numbers. Midpoints join the node
+ * selections as in Refine. Edges stay straight, so curved boundaries are
+ * not recovered.
+ */
+void Mesh::Elevate_Order(int nen){
+
+  assert(nen == 8 || nen == 9);
+  assert(!isTriPresent && !isQuad8Present && !isQuad9Present);
+
+  const Element_Block& quad = block[ELEM_QUAD4];
+  Mesh_Array<double> new_x = x, new_y = y;
+  Mesh_Array<int32_t> new_conn;
+  new_conn.reserve(nen*quad.size());
+  const long long nold = x.size();
+  unordered_map<long long,int> edge_mid;
+  edge_mid.reserve(2*quad.size());
+  vector<int> edge_list;
+
+  auto Add_Node = [&](double px, double py){
+    new_x.push_back(px);
+    new_y.push_back(py);
+    return int(new_x.size());
+  };
+
+  for(size_t i = 0; i < quad.size(); i++){
+    const Node_List n = quad[i];
+    for(int k = 0; k < 4; k++){
+      new_conn.push_back(n[k]);
+    }
+    for(int k = 0; k < 4; k++){
+      const int a = n[k], b = n[(k+1)%4];
+      const long long key = (long long)min(a,b)*(nold+1) + max(a,b);
+      unordered_map<long long,int>::iterator it = edge_mid.find(key);
+      int m;
+      if(it != edge_mid.end()){
+        m = it->second;
+      }else{
+        m = Add_Node(0.5*(x[a-1]+x[b-1]),0.5*(y[a-1]+y[b-1]));
+        edge_mid[key] = m;
+        edge_list.push_back(min(a,b));
+        edge_list.push_back(max(a,b));
+        edge_list.push_back(m);
+      }
+      new_conn.push_back(m);
+    }
+    if(nen == 9){
+      double cx = 0, cy = 0;
+      for(int k = 0; k < 4; k++){
+        cx += 0.25*x[n[k]-1];
+        cy += 0.25*y[n[k]-1];
+      }
+      new_conn.push_back(Add_Node(cx,cy));
+    }
+  }
+
+  Extend_Selections(edge_list,nold);
+  x = new_x;
+  y = new_y;
+  block[nen == 8 ? ELEM_QUAD8 : ELEM_QUAD9].conn = new_conn;
+  block[ELEM_QUAD4].conn = Mesh_Array<int32_t>();
+  isQuadPresent = false;
+  Set_Element_Types();
+
+  Release_Cache();
+}
+
+
+/* edge_list holds (lo, hi, midpoint) triples; a midpoint joins every selection
+ * of more than one node that holds both ends of its edge. The selection
+ * arrays are rebuilt, none may view the mesh cache afterwards. */
+void Mesh::Extend_Selections(vector<int> const& edge_list, long long nold){
+  Mesh_Array<int64_t> new_ptr;
+  Mesh_Array<int32_t> new_node;
+  new_ptr.push_back(0);
+  vector<char> in(nold+1,0);
+  for(size_t s = 0; s < selection.size(); s++){
+    const Node_List nodes = Selection(s);
+    for(size_t i = 0; i < nodes.size(); i++){
+      new_node.push_back(nodes[i]);
+    }
+    if(nodes.size() >= 2){
+      for(size_t i = 0; i < nodes.size(); i++){
+        in[nodes[i]] = 1;
+      }
+      for(size_t e = 0; e < edge_list.size(); e += 3){
+        if(in[edge_list[e]] && in[edge_list[e+1]]){
+          new_node.push_back(edge_list[e+2]);
+        }
+      }
+      for(size_t i = 0; i < nodes.size(); i++){
+        in[nodes[i]] = 0;
+      }
+    }
+    new_ptr.push_back(new_node.size());
+  }
+  sel_ptr = new_ptr;
+  sel_node = new_node;
+}
+
+
+void Mesh::Release_Cache(){
+  if(cache_map){
+    munmap(cache_map,cache_bytes);
+    cache_map = NULL;
+  }
+}
+
+
+/* heap held by the mesh arrays (capacity, not size), arrays mapped from the
+ * cache not included */
+size_t Mesh::Bytes() const {
+  size_t bytes = x.Heap_Bytes() + y.Heap_Bytes() + sel_ptr.Heap_Bytes() + sel_node.Heap_Bytes()
+               + selection.capacity()*sizeof(string);
+  for(int t = 0; t < ELEM_TYPES; t++){
+    bytes += block[t].conn.Heap_Bytes();
+  }
+  for(size_t s = 0; s < selection.size(); s++){
+    if(selection[s].capacity() > string().capacity()){
+      bytes += selection[s].capacity()+1;
+    }
+  }
+  return bytes;
+}
+
+
 void Mesh::ValidateMesh(){
-  cout << "Number of nodes = " << node.size() << endl;
-  cout << "Number of faces = " << face.size() << endl;
-  cout << "Number of boundaries = " << boundary.size() << endl;
-  cout << "size of nodes: " << sizeof(Node)*node.size() << " bytes" << endl;
-  cout << "size of faces: " << sizeof(Face)*face.size() << " bytes" << endl;
+  const char* type_name[ELEM_TYPES] = {"Quad4","Quad8","Quad9","Tri3"};
+  const size_t nnode = Nodes(), nelem = Elements();
+  cout << "Number of nodes = " << nnode << endl;
+  cout << "Number of faces = " << nelem << " (";
+  for(int t = 0; t < ELEM_TYPES; t++){
+    cout << (t ? ", " : "") << type_name[t] << " " << block[t].size();
+  }
+  cout << ")" << endl;
+  cout << "Number of boundaries = " << selection.size() << endl;
+  size_t mapped = x.Mapped_Bytes() + y.Mapped_Bytes() + sel_ptr.Mapped_Bytes() + sel_node.Mapped_Bytes();
+  for(int t = 0; t < ELEM_TYPES; t++){
+    mapped += block[t].conn.Mapped_Bytes();
+  }
+  const size_t bytes = Bytes();
+  cout << "mesh storage: " << bytes << " bytes of heap";
+  if(nnode > 0 && nelem > 0){
+    cout << " (" << double(bytes)/nelem << " per element)";
+  }
+  cout << ", " << mapped << " bytes mapped from the mesh cache" << endl;
   cout << endl;
 }
 
@@ -212,39 +920,38 @@ void Mesh::WriteMesh(OUTPUT_MESH_FORMAT const& output_mesh_format){
 
   if(output_mesh_format == MATLAB){
 
-    ofstream mfile("mesh.m");
-    assert(mfile.is_open());
+    Buffered_Writer mfile("mesh.m");
 
     // write x component
-    mfile << "x = [" << endl;
-    for(size_t i = 0; i < node.size(); i++){
-      mfile << node[i].x << endl;
+    mfile.Write("x = [\n");
+    for(size_t i = 0; i < x.size(); i++){
+      mfile.Write_Line(x[i]);
     }
-    mfile << "];" << endl;
+    mfile.Write("];\n");
     // write y component
-    mfile << "y = [" << endl;
-    for(size_t i = 0; i < node.size(); i++){
-      mfile << node[i].y << endl;
+    mfile.Write("y = [\n");
+    for(size_t i = 0; i < y.size(); i++){
+      mfile.Write_Line(y[i]);
     }
-    mfile << "];" << endl;
-    // write z component
-    mfile << "z = [" << endl;
-    for(size_t i = 0; i < node.size(); i++){
-      mfile << node[i].z << endl;
+    mfile.Write("];\n");
+    // write z component, the mesh is planar
+    mfile.Write("z = [\n");
+    for(size_t i = 0; i < x.size(); i++){
+      mfile.Write("0\n",2);
     }
-    mfile << "];" << endl;
-    mfile.close();
+    mfile.Write("];\n");
+    mfile.Close();
 
   } // end matlab mesh format write
 
 
   if(output_mesh_format == CSV){
-    ofstream mfile("mesh.csv");
-    assert(mfile.is_open());
+    Buffered_Writer mfile("mesh.csv");
 
-    mfile << "x,y,z"<< endl;
-    for(size_t i = 0; i < node.size(); i++){
-      mfile << node[i].x << "," << node[i].y << "," << node[i].z << "," << endl;
+    mfile.Write("x,y,z\n");
+    char line[64];
+    for(size_t i = 0; i < x.size(); i++){
+      mfile.Write(line,snprintf(line,sizeof(line),"%g,%g,0,\n",x[i],y[i]));
     }
 
   }
@@ -0,0 +1,79 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * Binary mesh cache, written next to the ASCII mesh as <file>.bin.
+ *
+ * Layout: header, then the node coordinates x[nnode] and y[nnode], the int32
+ * connectivity of every element block (nelem[t] x nodes of type t), the
+ * selection names Cache_Selection[nselection], the selection offsets
+ * int64[nselection+1] and the selection nodes int32[nsel_node], every
+ * section starting on a 64 byte boundary. The arrays are stored as held in
+ * memory, so a mapped cache is used in place. The header records a byte
+ * order mark; a cache from another build, another machine or another
+ * version of the source file (size and nanosecond mtime) is rejected and
+ * rewritten, as is one whose sections do not fit in the file or that fails
+ * the checksum, which covers the header too.
+ */
+
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_ALIGN 64
+#define MESH_CACHE_NAME 64
+#define MESH_CACHE_TYPES 4
+
+typedef struct {
+  char magic[8];                    // "2DFEAMSH"
+  uint32_t version;
+  uint32_t byte_order;              // 0x01020304 as written
+  uint32_t types, pad;              // element blocks
+  uint64_t nnode, nelem[MESH_CACHE_TYPES], nselection, nsel_node;
+  uint64_t x_off, y_off, conn_off[MESH_CACHE_TYPES];
+  uint64_t selection_off, sel_ptr_off, sel_node_off, file_bytes;
+  uint64_t source_bytes;            // size and mtime of the ASCII file
+  int64_t source_mtime, source_mtime_ns;
+  uint64_t checksum;                // of the whole file, this field taken as 0
+} Mesh_Cache_Header;
+
+typedef struct {
+  char name[MESH_CACHE_NAME];
+} Cache_Selection;
+
+
+inline uint64_t Cache_Align(uint64_t off){
+  return (off + MESH_CACHE_ALIGN - 1)/MESH_CACHE_ALIGN*MESH_CACHE_ALIGN;
+}
+
+/* FNV-1a over 64 bit words, the tail is zero padded (sections are aligned) */
+inline uint64_t Cache_Checksum(const char* p, uint64_t bytes, uint64_t h = 1469598103934665603ULL){
+  uint64_t w;
+  for(uint64_t i = 0; i < bytes; i += 8){
+    w = 0;
+    memcpy(&w,p+i,bytes-i < 8 ? bytes-i : 8);
+    h = (h ^ w)*1099511628211ULL;
+  }
+  return h;
+}
+
+/* checksum of a cache file of the given size, header included */
+inline uint64_t Cache_File_Checksum(const char* base, uint64_t bytes){
+  Mesh_Cache_Header h;
+  memcpy(&h,base,sizeof(h));
+  h.checksum = 0;
+  return Cache_Checksum(base+sizeof(h),bytes-sizeof(h),Cache_Checksum((const char*)&h,sizeof(h)));
+}
+
+/* section of n items of the given size at off lies within a file of len bytes */
+inline bool Cache_Section(uint64_t off, uint64_t n, uint64_t size, uint64_t len){
+  return off >= sizeof(Mesh_Cache_Header) && off % MESH_CACHE_ALIGN == 0 && off <= len
+      && n <= (len - off)/size;
+}
+
+
+#endif // MESHCACHE_HPP
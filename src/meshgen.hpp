@@ -0,0 +1,431 @@
+#ifndef MESHGEN_HPP
+#define MESHGEN_HPP
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <charconv>
+#include <type_traits>
+#include "mesh.hpp"
+#include "writer.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/* generated geometries, each with the named selections of the input files:
+ * FIXED along one edge and a single POINT_LOAD node at a free corner
+ *   rectangle    10 x 5, FIXED at x = 0, load at (10,5)
+ *   L-plate      [0,5]x[0,10] + [5,10]x[5,10], FIXED at y = 0, load at (10,10)
+ *   plate hole   10 x 4, hole of radius 1 at (5,2), FIXED at x = 0, load at (10,4) */
+typedef enum {GEN_RECTANGLE, GEN_L_PLATE, GEN_PLATE_HOLE} Mesh_Shape;
+static const char* const mesh_shape_names[] = {"rectangle","l_plate","plate_hole","Mesh_Shape","GEN_",NULL};
+
+
+/*
+ * CLASS MESH_GENERATOR -> parametric quad meshes of any size. n is the number
+ * of elements across the short side (n = 2300 gives about 10M elements for
+ * the rectangle). Structured meshes can be turned unstructured by a random
+ * displacement of the interior nodes (a fraction of the shortest adjacent
+ * edge) and a random numbering of nodes and elements.
+ */
+class Mesh_Generator{
+private:
+  Mesh_Shape shape;
+  int n;
+  double perturb;
+  bool renumber;
+  unsigned seed;
+
+  vector<double> x, y;
+  vector<int> quad;                 // 4 node indices (from 0) per element, counterclockwise
+  vector<int> fixed;
+  int load;
+
+  int Add_Node(double, double);
+  void Rectangle();
+  void L_Plate();
+  void Plate_Hole();
+  void Perturb_Interior();
+  void Shuffle_Numbering();
+
+public:
+  Mesh_Generator(Mesh_Shape, int);
+  void Set_Perturbation(double);
+  void Set_Shuffle(bool, unsigned s = 1);
+  void Build();
+  void Generate(Mesh&);
+  size_t Write(string const&);
+  size_t Num_Nodes() const {return x.size();}
+  size_t Num_Elements() const {return quad.size()/4;}
+};
+
+
+/******************* Functions **************************/
+
+Mesh_Generator :: Mesh_Generator(Mesh_Shape s, int size)
+  : shape(s), n(size), perturb(0.0), renumber(false), seed(1), load(-1)
+{
+  assert(n >= 1);
+}
+
+
+void Mesh_Generator :: Set_Perturbation(double p){
+  assert(p >= 0.0 && p < 0.5);
+  perturb = p;
+}
+
+
+void Mesh_Generator :: Set_Shuffle(bool flag, unsigned s){
+  renumber = flag;
+  seed = s;
+}
+
+
+int Mesh_Generator :: Add_Node(double px, double py){
+  x.push_back(px);
+  y.push_back(py);
+  return x.size()-1;
+}
+
+
+/* 2n x n squares */
+void Mesh_Generator :: Rectangle(){
+
+  const int nx = 2*n, ny = n;
+  const double h = 5.0/n;
+  for(int j = 0; j <= ny; j++){
+    for(int i = 0; i <= nx; i++){
+      Add_Node(i*h,j*h);
+    }
+  }
+  auto id = [&](int i, int j){return j*(nx+1) + i;};
+  quad.reserve(4*nx*ny);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      const int q[4] = {id(i,j),id(i+1,j),id(i+1,j+1),id(i,j+1)};
+      quad.insert(quad.end(),q,q+4);
+    }
+  }
+  for(int j = 0; j <= ny; j++){
+    fixed.push_back(id(0,j));
+  }
+  load = id(nx,ny);
+}
+
+
+/* 2n x 2n lattice without the lower right quarter */
+void Mesh_Generator :: L_Plate(){
+
+  const int m = 2*n;
+  const double h = 10.0/m;
+  vector<int> id((m+1)*(m+1),-1);
+  for(int j = 0; j <= m; j++){
+    for(int i = 0; i <= m; i++){
+      if(i <= n || j >= n){
+        id[j*(m+1)+i] = Add_Node(i*h,j*h);
+      }
+    }
+  }
+  quad.reserve(4*3*n*n);
+  for(int j = 0; j < m; j++){
+    for(int i = 0; i < m; i++){
+      if(i < n || j >= n){
+        const int q[4] = {id[j*(m+1)+i],id[j*(m+1)+i+1],id[(j+1)*(m+1)+i+1],id[(j+1)*(m+1)+i]};
+        quad.insert(quad.end(),q,q+4);
+      }
+    }
+  }
+  for(int i = 0; i <= n; i++){
+    fixed.push_back(id[i]);
+  }
+  load = id[(m+1)*(m+1)-1];
+}
+
+
+/*
+ * O-grid of 4n x n/2 elements between the hole and the square [3,7]x[0,4]
+ * around it, structured blocks [0,3]x[0,4] and [7,10]x[0,4] on both sides
+ * sharing the nodes of the square's left and right edges.
+ */
+void Mesh_Generator :: Plate_Hole(){
+
+  const double cx = 5.0, cy = 2.0, R = 1.0, a = 2.0;
+  const int nc = 4*n, nr = max(1,n/2), nb = max(1,(3*n+2)/4);
+  const double pi = acos(-1.0);
+
+  // ring r, position k counterclockwise from the corner (7,0)
+  vector<int> ring((nr+1)*nc);
+  for(int r = 0; r <= nr; r++){
+    const double s = double(r)/nr;
+    for(int k = 0; k < nc; k++){
+      const double th = -0.25*pi + 0.5*pi*k/n;
+      const int side = k/n;
+      const double t = double(k%n)/n;
+      double sx, sy;
+      if(side == 0){ sx = cx+a;       sy = cy-a+2*a*t; }
+      else if(side == 1){ sx = cx+a-2*a*t; sy = cy+a; }
+      else if(side == 2){ sx = cx-a;       sy = cy+a-2*a*t; }
+      else{ sx = cx-a+2*a*t; sy = cy-a; }
+      ring[r*nc+k] = Add_Node((1-s)*(cx+R*cos(th)) + s*sx,(1-s)*(cy+R*sin(th)) + s*sy);
+    }
+  }
+  quad.reserve(4*(nc*nr + 2*nb*n));
+  for(int r = 0; r < nr; r++){
+    for(int k = 0; k < nc; k++){
+      const int k1 = (k+1)%nc;
+      const int q[4] = {ring[r*nc+k],ring[(r+1)*nc+k],ring[(r+1)*nc+k1],ring[r*nc+k1]};
+      quad.insert(quad.end(),q,q+4);
+    }
+  }
+
+  // side blocks, column 0 of the right block and column nb of the left one
+  // are the outer ring
+  const double h = 2*a/n, w = (cx-a)/nb;
+  vector<int> left((nb+1)*(n+1)), right((nb+1)*(n+1));
+  for(int j = 0; j <= n; j++){
+    for(int i = 0; i <= nb; i++){
+      left[j*(nb+1)+i] = (i == nb) ? ring[nr*nc + 3*n - j]
+                                   : Add_Node(i*w,j*h);
+      right[j*(nb+1)+i] = (i == 0) ? ring[nr*nc + j]
+                                   : Add_Node(cx+a+i*w,j*h);
+    }
+  }
+  for(int j = 0; j < n; j++){
+    for(int i = 0; i < nb; i++){
+      const int l = j*(nb+1)+i, u = (j+1)*(nb+1)+i;
+      const int ql[4] = {left[l],left[l+1],left[u+1],left[u]};
+      const int qr[4] = {right[l],right[l+1],right[u+1],right[u]};
+      quad.insert(quad.end(),ql,ql+4);
+      quad.insert(quad.end(),qr,qr+4);
+    }
+  }
+  for(int j = 0; j <= n; j++){
+    fixed.push_back(left[j*(nb+1)]);
+  }
+  load = right[(n+1)*(nb+1)-1];
+}
+
+
+/*
+ * Nodes with four elements are interior in these meshes (boundary nodes have
+ * one to three); they move by up to perturb times their shortest edge in x
+ * and y, from a hash of the seed and the node so the result does not depend
+ * on the number of threads.
+ */
+void Mesh_Generator :: Perturb_Interior(){
+
+  const size_t nn = x.size();
+  vector<int> count(nn,0);
+  vector<double> hmin(nn,1e300);
+  for(size_t e = 0; e < quad.size(); e += 4){
+    for(int k = 0; k < 4; k++){
+      const int p = quad[e+k], q = quad[e+(k+1)%4];
+      const double l = hypot(x[p]-x[q],y[p]-y[q]);
+      count[p]++;
+      hmin[p] = min(hmin[p],l);
+      hmin[q] = min(hmin[q],l);
+    }
+  }
+
+  auto Uniform = [&](uint64_t v){
+    v += 0x9e3779b97f4a7c15ULL*(seed+1);
+    v = (v ^ (v >> 30))*0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27))*0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return 2.0*(v >> 11)*(1.0/9007199254740992.0) - 1.0;
+  };
+  #pragma omp parallel for
+  for(size_t i = 0; i < nn; i++){
+    if(count[i] == 4){
+      x[i] += perturb*hmin[i]*Uniform(2*i);
+      y[i] += perturb*hmin[i]*Uniform(2*i+1);
+    }
+  }
+}
+
+
+/* random node and element numbering */
+void Mesh_Generator :: Shuffle_Numbering(){
+
+  mt19937_64 rng(seed);
+  vector<int> perm(x.size());
+  for(size_t i = 0; i < perm.size(); i++){
+    perm[i] = i;
+  }
+  shuffle(perm.begin(),perm.end(),rng);   // old -> new node
+  vector<double> nx(x.size()), ny(y.size());
+  for(size_t i = 0; i < perm.size(); i++){
+    nx[perm[i]] = x[i];
+    ny[perm[i]] = y[i];
+  }
+  x.swap(nx);
+  y.swap(ny);
+
+  vector<int> order(quad.size()/4);
+  for(size_t e = 0; e < order.size(); e++){
+    order[e] = e;
+  }
+  shuffle(order.begin(),order.end(),rng);
+  vector<int> q(quad.size());
+  for(size_t e = 0; e < order.size(); e++){
+    for(int k = 0; k < 4; k++){
+      q[4*e+k] = perm[quad[4*order[e]+k]];
+    }
+  }
+  quad.swap(q);
+  for(size_t i = 0; i < fixed.size(); i++){
+    fixed[i] = perm[fixed[i]];
+  }
+  sort(fixed.begin(),fixed.end());
+  load = perm[load];
+}
+
+
+void Mesh_Generator :: Build(){
+
+  x.clear(); y.clear(); quad.clear(); fixed.clear();
+  if(shape == GEN_RECTANGLE){
+    Rectangle();
+  }else if(shape == GEN_L_PLATE){
+    L_Plate();
+  }else{
+    Plate_Hole();
+  }
+  if(perturb > 0.0){
+    Perturb_Interior();
+  }
+  if(renumber){
+    Shuffle_Numbering();
+  }
+}
+
+
+/* the generated mesh as if read from a file, into an empty mesh */
+void Mesh_Generator :: Generate(Mesh& mesh){
+
+  assert(mesh.Nodes() == 0 && mesh.Elements() == 0);
+  if(x.empty()){
+    Build();
+  }
+  mesh.x.resize(x.size());
+  mesh.y.resize(y.size());
+  #pragma omp parallel for
+  for(size_t i = 0; i < x.size(); i++){
+    mesh.x[i] = x[i];
+    mesh.y[i] = y[i];
+  }
+  Element_Block& b = mesh.block[ELEM_QUAD4];
+  b.conn.resize(quad.size());
+  #pragma omp parallel for
+  for(size_t k = 0; k < quad.size(); k++){
+    b.conn[k] = quad[k]+1;
+  }
+  mesh.Set_Element_Types();
+
+  vector<int> nodes(fixed.size());
+  for(size_t i = 0; i < fixed.size(); i++){
+    nodes[i] = fixed[i]+1;
+  }
+  mesh.Add_Selection("FIXED",nodes);
+  mesh.Add_Selection("POINT_LOAD",vector<int>(1,load+1));
+}
+
+
+/* value right aligned in a column of width characters (numbers longer
+ * than that are written in full), returns the end */
+template<class T>
+char* Put_Column(char* p, T v, int width){
+  char s[32];
+  char* e;
+  if constexpr (is_floating_point<T>::value){
+    e = to_chars(s,s+sizeof(s),v,chars_format::scientific,10).ptr;
+  }else{
+    e = to_chars(s,s+sizeof(s),v).ptr;
+  }
+  const int n = e-s;
+  for(int k = n; k < width; k++){
+    *p++ = ' ';
+  }
+  memcpy(p,s,n);
+  return p+n;
+}
+
+
+/* lines 0 .. n-1 from line(i, buffer) -> length, formatted by the threads a
+ * block at a time and written in order */
+template<class Line>
+void Write_Lines(Buffered_Writer& out, size_t n, Line line){
+  const size_t block = 1 << 16;
+  int nt = 1;
+#ifdef _OPENMP
+  nt = omp_get_max_threads();
+#endif
+  vector<string> text(nt);
+  for(size_t b0 = 0; b0 < n; b0 += nt*block){
+    #pragma omp parallel num_threads(nt)
+    {
+      int t = 0;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+#endif
+      const size_t lo = min(n,b0 + t*block), hi = min(n,lo + block);
+      char s[256];
+      text[t].clear();
+      for(size_t i = lo; i < hi; i++){
+        text[t].append(s,line(i,s));
+      }
+    }
+    for(int t = 0; t < nt; t++){
+      out.Write(text[t]);
+    }
+  }
+}
+
+
+/* the mesh file format read by Mesh::ReadMeshFile, returns the bytes written */
+size_t Mesh_Generator :: Write(string const& filename){
+
+  if(x.empty()){
+    Build();
+  }
+  Buffered_Writer out(filename);
+  char line[160];
+  out.Write(string("#Nodes\n"));
+  Write_Lines(out,x.size(),[&](size_t i, char* s){
+    char* p = Put_Column(s,i+1,9);
+    p = Put_Column(p,x[i],19);
+    p = Put_Column(p,y[i],19);
+    p = Put_Column(p,0.0,19);
+    *p++ = '\n';
+    return p-s;
+  });
+  out.Write(string("-1\n\n#Elements\n"));
+  // nine columns not used by the solver, as in the input files
+  const char lead[] = "        1        1        1        1        0        0        0        0        4        0";
+  Write_Lines(out,quad.size()/4,[&](size_t e, char* s){
+    memcpy(s,lead,sizeof(lead)-1);
+    char* p = Put_Column(s+sizeof(lead)-1,e+1,9);
+    for(int k = 0; k < 4; k++){
+      p = Put_Column(p,quad[4*e+k]+1,9);
+    }
+    *p++ = '\n';
+    return p-s;
+  });
+  out.Write(string("-1\n\n#NamedSelection\n"));
+  out.Write(line,snprintf(line,sizeof(line),"FIXED\tNODE\t%zu\n",fixed.size()));
+  for(size_t i = 0; i < fixed.size(); i++){
+    out.Write(line,snprintf(line,sizeof(line),"%d%c",fixed[i]+1,(i+1)%10 == 0 || i+1 == fixed.size() ? '\n' : '\t'));
+  }
+  out.Write(line,snprintf(line,sizeof(line),"\n#NamedSelection\nPOINT_LOAD\tNODE\t1\n%d\n\n#End\n",load+1));
+  out.Close();
+  return out.Bytes();
+}
+
+
+#endif // MESHGEN_HPP
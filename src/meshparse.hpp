@@ -0,0 +1,162 @@
+#ifndef MESHPARSE_HPP
+#define MESHPARSE_HPP
+
+#include <charconv>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/*
+ * In-place tokenizer for memory mapped mesh files. Every routine takes the
+ * current position and the end of the buffer, never reads past the end and
+ * returns the position after what it consumed.
+ */
+
+inline bool Is_Blank(char c){
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+inline const char* Skip_Blank(const char* p, const char* end){
+  while(p < end && Is_Blank(*p)){
+    p++;
+  }
+  return p;
+}
+
+inline const char* Skip_Token(const char* p, const char* end){
+  while(p < end && !Is_Blank(*p)){
+    p++;
+  }
+  return p;
+}
+
+// first character after the end of the current line
+inline const char* Next_Line(const char* p, const char* end){
+  const char* nl = (const char*) memchr(p,'\n',end-p);
+  return nl ? nl+1 : end;
+}
+
+// start of the first line beginning at or after p
+inline const char* Line_Start(const char* begin, const char* end, const char* p){
+  return p == begin ? begin : Next_Line(p-1,end);
+}
+
+// true if the line starting at p holds nothing but blanks
+inline bool Blank_Line(const char* p, const char* end){
+  while(p < end && *p != '\n'){
+    if(!Is_Blank(*p)){
+      return false;
+    }
+    p++;
+  }
+  return true;
+}
+
+/*
+ * Records of a section run from p up to the line whose first token is -1.
+ * Returns the start of that line (or end) and the number of records.
+ */
+inline const char* Section_End(const char* p, const char* end, size_t& nrec){
+  nrec = 0;
+  for(; p < end; p = Next_Line(p,end)){
+    const char* t = p;
+    while(t < end && *t != '\n' && Is_Blank(*t)){
+      t++;
+    }
+    if(t == end || *t == '\n'){
+      continue;
+    }
+    if(end - t >= 2 && t[0] == '-' && t[1] == '1' && (t+2 == end || Is_Blank(t[2]))){
+      return p;
+    }
+    nrec++;
+  }
+  return end;
+}
+
+inline const char* Parse_Int(const char* p, const char* end, int& value){
+  p = Skip_Blank(p,end);
+  bool neg = false;
+  if(p < end && (*p == '-' || *p == '+')){
+    neg = (*p == '-');
+    p++;
+  }
+  int v = 0;
+  while(p < end && *p >= '0' && *p <= '9'){
+    v = 10*v + (*p - '0');
+    p++;
+  }
+  value = neg ? -v : v;
+  return p;
+}
+
+// correctly rounded, so the result matches the stream extraction operator
+inline const char* Parse_Double(const char* p, const char* end, double& value){
+  p = Skip_Blank(p,end);
+  if(p < end && *p == '+'){
+    p++;
+  }
+  std::from_chars_result r = std::from_chars(p,end,value);
+  assert(r.ec == std::errc());
+  return r.ptr;
+}
+
+
+/*
+ * Section body [begin,end) holds one record per non-blank line. The bytes are
+ * cut into one slab per thread, each slab snapped to line starts; the threads
+ * count their records, take an exclusive prefix sum and then call
+ * parse(line, end, record) for every record, so records land in file order.
+ * Returns the number of records.
+ */
+template<class F>
+size_t Parse_Lines(const char* begin, const char* end, F parse){
+
+  int maxthreads = 1;
+#ifdef _OPENMP
+  maxthreads = omp_get_max_threads();
+#endif
+  vector<size_t> first(maxthreads+1,0);
+  size_t total = 0;
+
+#pragma omp parallel
+  {
+    int nt = 1, t = 0;
+#ifdef _OPENMP
+    nt = omp_get_num_threads();
+    t = omp_get_thread_num();
+#endif
+    const size_t len = end - begin;
+    const char* lo = Line_Start(begin,end,begin + len*t/nt);
+    const char* hi = Line_Start(begin,end,begin + len*(t+1)/nt);
+
+    size_t n = 0;
+    for(const char* p = lo; p < hi; p = Next_Line(p,hi)){
+      if(!Blank_Line(p,hi)) n++;
+    }
+    first[t+1] = n;
+
+#pragma omp barrier
+#pragma omp single
+    {
+      for(int i = 0; i < nt; i++){
+        first[i+1] += first[i];
+      }
+      total = first[nt];
+    }
+
+    size_t r = first[t];
+    for(const char* p = lo; p < hi; p = Next_Line(p,hi)){
+      if(!Blank_Line(p,hi)) parse(p,hi,r++);
+    }
+  }
+  return total;
+}
+
+
+#endif // MESHPARSE_HPP
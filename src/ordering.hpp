@@ -0,0 +1,125 @@
+#ifndef ORDERING_HPP
+#define ORDERING_HPP
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+/*
+ * Reverse Cuthill-McKee ordering of a graph in CSR form (ptr, adj; self
+ * loops allowed). Every connected component is numbered breadth first from a
+ * pseudo-peripheral vertex (George-Liu search), neighbours in order of
+ * increasing degree, and the whole sequence is reversed at the end.
+ * order[k] is the vertex that gets number k. Ties go to the lower vertex
+ * index, so the ordering is deterministic.
+ */
+class RCM_Ordering{
+private:
+  const vector<int>& ptr;
+  const vector<int>& adj;
+  vector<int>& order;
+  vector<int> mark;               // BFS visit stamp of each vertex
+  int stamp;
+
+  int Degree(int v) const { return ptr[v+1] - ptr[v]; }
+  int Level_Structure(int, vector<int>&, size_t&);
+  int Pseudo_Peripheral(int);
+
+public:
+  RCM_Ordering(const vector<int>& Ptr, const vector<int>& Adj, vector<int>& Order)
+    : ptr(Ptr), adj(Adj), order(Order), stamp(0) {}
+  void Order();
+};
+
+
+/******************* Functions **************************/
+
+/* breadth first search from root: vertices in level order, start of the last
+ * level and the number of levels */
+int RCM_Ordering :: Level_Structure(int root, vector<int>& queue, size_t& last){
+  stamp++;
+  queue.clear();
+  queue.push_back(root);
+  mark[root] = stamp;
+  int depth = 0;
+  size_t head = 0;
+  while(head < queue.size()){
+    const size_t tail = queue.size();
+    last = head;
+    depth++;
+    for(; head < tail; head++){
+      const int v = queue[head];
+      for(int k = ptr[v]; k < ptr[v+1]; k++){
+        if(mark[adj[k]] != stamp){
+          mark[adj[k]] = stamp;
+          queue.push_back(adj[k]);
+        }
+      }
+    }
+  }
+  return depth;
+}
+
+
+int RCM_Ordering :: Pseudo_Peripheral(int start){
+  vector<int> queue;
+  size_t last;
+  int root = start;
+  int depth = Level_Structure(root,queue,last);
+  for(;;){
+    int x = queue[last];
+    for(size_t i = last+1; i < queue.size(); i++){
+      const int v = queue[i];
+      if(Degree(v) < Degree(x) || (Degree(v) == Degree(x) && v < x)){
+        x = v;
+      }
+    }
+    const int d = Level_Structure(x,queue,last);
+    if(d <= depth){
+      return root;
+    }
+    root = x;
+    depth = d;
+  }
+}
+
+
+void RCM_Ordering :: Order(){
+  const int n = ptr.size()-1;
+  mark.assign(n,0);
+  stamp = 0;
+  order.clear();
+  order.reserve(n);
+  vector<char> done(n,0);
+  vector<int> nbr;
+
+  for(int s = 0; s < n; s++){
+    if(done[s]){
+      continue;
+    }
+    const int root = Pseudo_Peripheral(s);
+    size_t head = order.size();
+    order.push_back(root);
+    done[root] = 1;
+    for(; head < order.size(); head++){
+      const int v = order[head];
+      nbr.clear();
+      for(int k = ptr[v]; k < ptr[v+1]; k++){
+        if(!done[adj[k]]){
+          done[adj[k]] = 1;
+          nbr.push_back(adj[k]);
+        }
+      }
+      sort(nbr.begin(),nbr.end(),[this](int a, int b){
+        return Degree(a) < Degree(b) || (Degree(a) == Degree(b) && a < b);
+      });
+      order.insert(order.end(),nbr.begin(),nbr.end());
+    }
+  }
+  reverse(order.begin(),order.end());
+}
+
+
+#endif // ORDERING_HPP
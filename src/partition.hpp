@@ -0,0 +1,80 @@
+#ifndef PARTITION_HPP
+#define PARTITION_HPP
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+/*
+ * Recursive coordinate bisection: splits the points into nparts parts of
+ * (almost) equal size by cutting the wider extent of the bounding box, with
+ * the cut placed in proportion to the number of parts on either side so any
+ * nparts works. Ties are broken by point index, so every process computes
+ * the same partition.
+ */
+class RCB_Partitioner{
+private:
+  const vector<double>& x;
+  const vector<double>& y;
+  vector<int>& part;
+
+  struct Compare{
+    const vector<double>& c;
+    Compare(const vector<double>& coord) : c(coord) {}
+    bool operator()(int a, int b) const {
+      return c[a] < c[b] || (c[a] == c[b] && a < b);
+    }
+  };
+
+  void Bisect(vector<int>::iterator, vector<int>::iterator, int, int);
+
+public:
+  RCB_Partitioner(const vector<double>& X, const vector<double>& Y, vector<int>& P)
+    : x(X), y(Y), part(P) {}
+  void Partition(int);
+};
+
+
+/******************* Functions **************************/
+
+void RCB_Partitioner :: Partition(int nparts){
+  vector<int> idx(x.size());
+  for(size_t i = 0; i < idx.size(); i++){
+    idx[i] = i;
+  }
+  part.assign(x.size(),0);
+  Bisect(idx.begin(),idx.end(),0,nparts);
+}
+
+
+void RCB_Partitioner :: Bisect(vector<int>::iterator first, vector<int>::iterator last, int p0, int np){
+
+  if(np == 1 || last - first <= 1){
+    for(vector<int>::iterator i = first; i != last; ++i){
+      part[*i] = p0;
+    }
+    return;
+  }
+
+  double xmin = x[*first], xmax = xmin, ymin = y[*first], ymax = ymin;
+  for(vector<int>::iterator i = first; i != last; ++i){
+    xmin = min(xmin,x[*i]); xmax = max(xmax,x[*i]);
+    ymin = min(ymin,y[*i]); ymax = max(ymax,y[*i]);
+  }
+
+  const int nl = np/2;
+  vector<int>::iterator cut = first + (long long)(last - first)*nl/np;
+  if(xmax - xmin >= ymax - ymin){
+    nth_element(first,cut,last,Compare(x));
+  }else{
+    nth_element(first,cut,last,Compare(y));
+  }
+
+  Bisect(first,cut,p0,nl);
+  Bisect(cut,last,p0+nl,np-nl);
+}
+
+
+#endif // PARTITION_HPP
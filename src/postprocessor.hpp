@@ -0,0 +1,547 @@
+#ifndef POSTPROCESSOR_HPP
+#define POSTPROCESSOR_HPP
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "preprocessor.hpp"
+#include "solver.hpp"
+#include "stresskernel.hpp"
+
+using namespace std;
+
+// per node: averaged STRESS_FIELDS, number of elements, internal force x, y
+#define NODAL_BS (STRESS_FIELDS + 3)
+// per element of nn nodes: STRESS_FIELDS at each node, internal forces
+#define ELEM_OUT(nn) ((nn)*STRESS_FIELDS + QUAD_DOF(nn))
+
+
+/*
+ * CLASS POSTPROCESSOR -> strains, stresses and von Mises stress of the
+ * solution at the quadrature points of the local elements, extrapolated to
+ * the element nodes and averaged over the elements of every node, and the
+ * reactions at the FIXED nodes from the internal forces K u of the
+ * unconstrained stiffness. Elements are processed by the batched kernels,
+ * quadrilaterals then triangles (one value per triangle), nodal sums are
+ * added across processes by one reverse scatter.
+ */
+class PostProcessor{
+private:
+  const PreProcessor* prep;
+  const FEA_Solver* solver;
+  vector<PetscInt> node;          // equation nodes touched by local elements
+  int nen;                        // nodes per quadrilateral
+  size_t nquad, ntri;             // local quadrilaterals, then triangles
+  vector<int> elem_node;          // element -> nen (quadrilateral) or 3 (triangle) indices into node
+  vector<double> X;               // extrapolation quadrature points -> nodes, nen x Qpoints
+  vector<double> gauss;           // [element][quadrature point][STRESS_FIELDS], one point per triangle
+  Vec Nodal;                      // NODAL_BS values per owned node
+  double vm_gauss;                // largest von Mises stress at a quadrature point
+  double vm_node;                 // largest averaged nodal von Mises stress
+
+  void Compute_Extrapolation();
+  template<int W> void Process_Batch(size_t, const PetscScalar*, double*);
+  template<int W> void Process_Tri_Batch(size_t, const PetscScalar*, double*);
+  size_t Write_Nodal_Field(const PetscScalar*, int, const char*) const;
+  void Gathered_Stress(const PetscScalar*, vector<double>&) const;
+  void Write_Parallel(string const&) const;
+
+public:
+  PostProcessor(const PreProcessor*, const FEA_Solver*);
+  ~PostProcessor();
+
+  void Recover_Stresses();
+  void Write_Nodal_Stress() const;
+  void Write_Reactions() const;
+  void Write_VTK(string const&) const;
+  double const* Gauss_Values(size_t e) const {
+    const size_t nq = prep->Geometry.Qpoints();
+    return &gauss[(e < nquad ? e*nq : nquad*nq + e-nquad)*STRESS_FIELDS];
+  }
+  double Max_von_Mises() const {return vm_node;}
+};
+
+
+/******************* Functions **************************/
+
+PostProcessor :: PostProcessor(const PreProcessor* pre, const FEA_Solver* sol)
+  : prep(pre), solver(sol), nen(pre->Geometry.Nodes_per_element()), nquad(pre->nquad_local),
+    ntri(pre->elem_local.size()-pre->nquad_local), Nodal(NULL), vm_gauss(0.0), vm_node(0.0)
+{
+  prep->Local_Connectivity(node,elem_node);
+  if(nquad > 0){
+    Compute_Extrapolation();
+  }
+}
+
+
+PostProcessor :: ~PostProcessor(){
+  VecDestroy(&Nodal);
+}
+
+
+/* X = (N N^T)^-1 N with N[a][q] the shape functions at the quadrature
+ * points: the exact inverse for as many points as nodes (Quad4 with 2x2,
+ * Quad9), a least squares fit otherwise. With one point (reduced Quad4) the
+ * centre values are taken at every node. */
+void PostProcessor :: Compute_Extrapolation(){
+
+  const int nq = prep->Quad_Quad->Qpoints();
+  double** N = prep->Quad_Quad->QShape();
+  if(nq == 1){
+    X.assign(nen,1.0);
+    return;
+  }
+  assert(nen <= nq);
+  double A[QUAD_MAX_NODES][2*QUAD_MAX_NODES];
+  for(int a = 0; a < nen; a++){
+    for(int b = 0; b < nen; b++){
+      A[a][b] = 0.0;
+      for(int q = 0; q < nq; q++){
+        A[a][b] += N[a][q]*N[b][q];
+      }
+      A[a][nen+b] = (a == b) ? 1.0 : 0.0;
+    }
+  }
+  // Gauss-Jordan, N N^T is symmetric positive definite
+  for(int c = 0; c < nen; c++){
+    const double p = A[c][c];
+    assert(p > 0.0);
+    for(int j = 0; j < 2*nen; j++){
+      A[c][j] /= p;
+    }
+    for(int r = 0; r < nen; r++){
+      if(r != c){
+        const double m = A[r][c];
+        for(int j = 0; j < 2*nen; j++){
+          A[r][j] -= m*A[c][j];
+        }
+      }
+    }
+  }
+  X.assign(nen*nq,0.0);
+  for(int a = 0; a < nen; a++){
+    for(int q = 0; q < nq; q++){
+      for(int b = 0; b < nen; b++){
+        X[a*nq + q] += A[a][nen+b]*N[b][q];
+      }
+    }
+  }
+}
+
+
+/* elements e0 .. e0+W-1: gather their DOFs, run the kernel, store the
+ * quadrature point values and the element outputs element by element */
+template<int W>
+void PostProcessor :: Process_Batch(size_t e0, const PetscScalar* u, double* elem_out){
+
+  const Element_Geometry& G = prep->Geometry;
+  const int nq = G.Qpoints();
+  const int eout = ELEM_OUT(nen);
+  double ue[QUAD_DOF(QUAD_MAX_NODES)*W], gp[9*STRESS_FIELDS*W];
+  double nodal[QUAD_MAX_NODES*STRESS_FIELDS*W], force[QUAD_DOF(QUAD_MAX_NODES)*W];
+
+  for(int l = 0; l < W; l++){
+    for(int a = 0; a < nen; a++){
+      const int n = elem_node[nen*(e0+l)+a];
+      ue[(2*a)*W + l]   = u[2*n];
+      ue[(2*a+1)*W + l] = u[2*n+1];
+    }
+  }
+  Quad_Stress_Kernel<W>(G,e0,ue,prep->Quad_Quad->QWeights(),prep->material->Get_Element_Stiffness(),
+                        prep->mesh->Get_Thickness(),&X[0],gp,nodal,force);
+
+  for(int l = 0; l < W; l++){
+    double* g = &gauss[(e0+l)*nq*STRESS_FIELDS];
+    for(int k = 0; k < nq*STRESS_FIELDS; k++){
+      g[k] = gp[k*W + l];
+    }
+    double* out = &elem_out[(e0+l)*eout];
+    for(int k = 0; k < nen*STRESS_FIELDS; k++){
+      out[k] = nodal[k*W + l];
+    }
+    for(int k = 0; k < QUAD_DOF(nen); k++){
+      out[nen*STRESS_FIELDS + k] = force[k*W + l];
+    }
+  }
+}
+
+
+/* triangles t0 .. t0+W-1, after the quadrilaterals in elem_node, gauss and
+ * elem_out */
+template<int W>
+void PostProcessor :: Process_Tri_Batch(size_t t0, const PetscScalar* u, double* elem_out){
+
+  const int* en = elem_node.data() + nen*nquad;
+  const size_t gq = nquad*prep->Geometry.Qpoints()*STRESS_FIELDS;
+  const int eout = ELEM_OUT(3);
+  double ue[TRI3_DOF*W], gp[STRESS_FIELDS*W], nodal[3*STRESS_FIELDS*W], force[TRI3_DOF*W];
+
+  for(int l = 0; l < W; l++){
+    for(int a = 0; a < 3; a++){
+      const int n = en[3*(t0+l)+a];
+      ue[(2*a)*W + l]   = u[2*n];
+      ue[(2*a+1)*W + l] = u[2*n+1];
+    }
+  }
+  Tri3_Stress_Batch<W>(prep->Tri_Geometry,t0,ue,prep->material->Get_Element_Stiffness(),
+                       prep->mesh->Get_Thickness(),gp,nodal,force);
+
+  for(int l = 0; l < W; l++){
+    double* g = &gauss[gq + (t0+l)*STRESS_FIELDS];
+    for(int k = 0; k < STRESS_FIELDS; k++){
+      g[k] = gp[k*W + l];
+    }
+    double* out = &elem_out[(t0+l)*eout];
+    for(int k = 0; k < 3*STRESS_FIELDS; k++){
+      out[k] = nodal[k*W + l];
+    }
+    for(int k = 0; k < TRI3_DOF; k++){
+      out[3*STRESS_FIELDS + k] = force[k*W + l];
+    }
+  }
+}
+
+
+void PostProcessor :: Recover_Stresses(){
+  Profile_Stage stage("Stress recovery");
+
+  double t0, t1, t2, t3;
+  PetscTime(&t0);
+  const size_t nelem = nquad;
+  const int nq = prep->Geometry.Qpoints();
+  const int eout = ELEM_OUT(nen);
+
+  // displacements of the nodes of the local elements
+  Vec u_loc;
+  VecScatter gather;
+  IS is;
+  VecCreateSeq(PETSC_COMM_SELF,2*node.size(),&u_loc);
+  ISCreateBlock(PETSC_COMM_SELF,2,node.size(),node.data(),PETSC_COPY_VALUES,&is);
+  VecScatterCreate(solver->Solution,is,u_loc,NULL,&gather);
+  VecScatterBegin(gather,solver->Solution,u_loc,INSERT_VALUES,SCATTER_FORWARD);
+  VecScatterEnd(gather,solver->Solution,u_loc,INSERT_VALUES,SCATTER_FORWARD);
+  VecScatterDestroy(&gather);
+  const PetscScalar* _u;
+  VecGetArrayRead(u_loc,&_u);
+  PetscTime(&t1);
+
+  // kernel: full batches, then the remainder one element at a time;
+  // quadrilaterals, then triangles
+  vector<double> elem_out(eout*nelem + ELEM_OUT(3)*ntri);
+  gauss.resize((nelem*nq + ntri)*STRESS_FIELDS);
+  const long nbatch = nelem/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(prep->Num_Threads,1)) schedule(static)
+  for(long b = 0; b < nbatch; b++){
+    Process_Batch<STIFF_BATCH>(b*STIFF_BATCH,_u,&elem_out[0]);
+  }
+  for(size_t e = nbatch*STIFF_BATCH; e < nelem; e++){
+    Process_Batch<1>(e,_u,&elem_out[0]);
+  }
+  double* tri_out = elem_out.data() + eout*nelem;
+  const long ntbatch = ntri/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(prep->Num_Threads,1)) schedule(static)
+  for(long b = 0; b < ntbatch; b++){
+    Process_Tri_Batch<STIFF_BATCH>(b*STIFF_BATCH,_u,tri_out);
+  }
+  for(size_t t = ntbatch*STIFF_BATCH; t < ntri; t++){
+    Process_Tri_Batch<1>(t,_u,tri_out);
+  }
+  VecRestoreArrayRead(u_loc,&_u);
+  VecDestroy(&u_loc);
+  Profiler::Instance().Add_Flops(nelem*QUAD_STRESS_FLOPS(nen,nq) + ntri*TRI3_STRESS_FLOPS);
+  PetscTime(&t2);
+
+  // sums over the elements of every node, then over processes
+  vector<double> acc(NODAL_BS*node.size(),0.0);
+  // count elements of n nodes, outputs from out, node indices from en
+  auto Accumulate = [&](size_t count, int n, const double* out, const int* en){
+    for(size_t e = 0; e < count; e++, out += ELEM_OUT(n), en += n){
+      for(int a = 0; a < n; a++){
+        double* v = &acc[NODAL_BS*en[a]];
+        for(int i = 0; i < STRESS_FIELDS; i++){
+          v[i] += out[a*STRESS_FIELDS + i];
+        }
+        v[STRESS_FIELDS]   += 1.0;
+        v[STRESS_FIELDS+1] += out[n*STRESS_FIELDS + 2*a];
+        v[STRESS_FIELDS+2] += out[n*STRESS_FIELDS + 2*a+1];
+      }
+    }
+  };
+  Accumulate(nelem,nen,elem_out.data(),elem_node.data());
+  Accumulate(ntri,3,tri_out,elem_node.data() + nen*nelem);
+
+  Vec acc_loc;
+  VecDestroy(&Nodal);
+  VecCreate(PETSC_COMM_WORLD,&Nodal);
+  VecSetSizes(Nodal,NODAL_BS*(prep->node_hi-prep->node_lo),NODAL_BS*prep->GDof/2);
+  VecSetBlockSize(Nodal,NODAL_BS);
+  VecSetFromOptions(Nodal);
+  VecSet(Nodal,0.0);
+  VecCreateSeq(PETSC_COMM_SELF,acc.size(),&acc_loc);
+  PetscScalar* _a;
+  VecGetArray(acc_loc,&_a);
+  memcpy(_a,acc.data(),acc.size()*sizeof(double));
+  VecRestoreArray(acc_loc,&_a);
+  ISDestroy(&is);
+  ISCreateBlock(PETSC_COMM_SELF,NODAL_BS,node.size(),node.data(),PETSC_COPY_VALUES,&is);
+  VecScatterCreate(Nodal,is,acc_loc,NULL,&gather);
+  VecScatterBegin(gather,acc_loc,Nodal,ADD_VALUES,SCATTER_REVERSE);
+  VecScatterEnd(gather,acc_loc,Nodal,ADD_VALUES,SCATTER_REVERSE);
+  VecScatterDestroy(&gather);
+  ISDestroy(&is);
+  VecDestroy(&acc_loc);
+
+  PetscInt n;
+  VecGetLocalSize(Nodal,&n);
+  VecGetArray(Nodal,&_a);
+  vm_node = 0.0;
+  for(PetscInt i = 0; i < n; i += NODAL_BS){
+    if(_a[i+STRESS_FIELDS] > 0.0){
+      for(int f = 0; f < STRESS_FIELDS; f++){
+        _a[i+f] /= _a[i+STRESS_FIELDS];
+      }
+    }
+    vm_node = max(vm_node,_a[i+STRESS_FIELDS-1]);
+  }
+  VecRestoreArray(Nodal,&_a);
+
+  vm_gauss = 0.0;
+  for(size_t k = STRESS_FIELDS-1; k < gauss.size(); k += STRESS_FIELDS){
+    vm_gauss = max(vm_gauss,gauss[k]);
+  }
+  MPI_Allreduce(MPI_IN_PLACE,&vm_gauss,1,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE,&vm_node,1,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD);
+  PetscTime(&t3);
+
+  PetscPrintf(PETSC_COMM_WORLD,"Stress recovery (%d lanes): gather %.4e s, kernel %.4e s, averaging %.4e s, total %.4e s\n",
+              STIFF_BATCH,t1-t0,t2-t1,t3-t2,t3-t0);
+  PetscPrintf(PETSC_COMM_WORLD,"  max von Mises stress: %g at quadrature points, %g at nodes\n",vm_gauss,vm_node);
+}
+
+
+/* one field of the gathered nodal values, in file node order */
+size_t PostProcessor :: Write_Nodal_Field(const PetscScalar* v, int f, const char* filename) const {
+  Buffered_Writer out(filename);
+  for(size_t i = 0; i < prep->node_perm.size(); i++){
+    out.Write_Line(v[NODAL_BS*prep->node_perm[i] + f]);
+  }
+  out.Close();
+  return out.Bytes();
+}
+
+
+/*
+ * Averaged nodal strains and stresses in the output format of the solver:
+ * strain_*.dat and stress_*.dat, or stress.bin with the STRESS_FIELDS values
+ * of every node in file node order as little endian doubles, or stress.pbin
+ * written by all processes.
+ */
+void PostProcessor :: Write_Nodal_Stress() const {
+  Profile_Stage stage("Output");
+
+  assert(Nodal != NULL);
+  if(solver->Get_output_format() == OUT_PARALLEL){
+    Write_Parallel("stress.pbin");
+    return;
+  }
+  double t0, t1;
+  PetscTime(&t0);
+  Vec Seq_Nodal;
+  VecScatter gather;
+  PetscMPIInt rank;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  VecScatterCreateToZero(Nodal,&gather,&Seq_Nodal);
+  VecScatterBegin(gather,Nodal,Seq_Nodal,INSERT_VALUES,SCATTER_FORWARD);
+  VecScatterEnd(gather,Nodal,Seq_Nodal,INSERT_VALUES,SCATTER_FORWARD);
+
+  if(rank == 0){
+    const char* name[STRESS_FIELDS] = {"strain_xx.dat","strain_yy.dat","strain_xy.dat",
+                                       "stress_xx.dat","stress_yy.dat","stress_xy.dat","stress_vm.dat"};
+    const PetscScalar* _v;
+    size_t bytes = 0;
+    VecGetArrayRead(Seq_Nodal,&_v);
+    if(solver->Get_output_format() == OUT_BINARY){
+      vector<double> s;
+      Gathered_Stress(_v,s);
+      Buffered_Writer out("stress.bin");
+      out.Write_LE(s.data(),s.size());
+      out.Close();
+      bytes = out.Bytes();
+    }else{
+      for(int f = 0; f < STRESS_FIELDS; f++){
+        bytes += Write_Nodal_Field(_v,f,name[f]);
+      }
+    }
+    VecRestoreArrayRead(Seq_Nodal,&_v);
+    PetscTime(&t1);
+    PetscPrintf(PETSC_COMM_SELF,"Output: %s, %zu bytes in %.4e s\n",
+                solver->Get_output_format() == OUT_BINARY ? "stress.bin" : "strain_*.dat, stress_*.dat",bytes,t1-t0);
+  }
+  VecScatterDestroy(&gather);
+  VecDestroy(&Seq_Nodal);
+}
+
+
+/* x, y and the STRESS_FIELDS values of every owned node into one shared
+ * file, as FEA_Solver::Write_Parallel */
+void PostProcessor :: Write_Parallel(string const& filename) const {
+
+  double t0, t1;
+  PetscTime(&t0);
+  vector<int> index;
+  vector<double> xy;
+  prep->Owned_Nodes(index,xy);
+
+  const int nv = 2 + STRESS_FIELDS;
+  vector<double> rec(nv*index.size());
+  const PetscScalar* _v;
+  VecGetArrayRead(Nodal,&_v);
+  for(size_t k = 0; k < index.size(); k++){
+    const int n = prep->node_perm[index[k]] - prep->node_lo;
+    rec[nv*k]   = xy[2*k];
+    rec[nv*k+1] = xy[2*k+1];
+    memcpy(&rec[nv*k+2],&_v[NODAL_BS*n],STRESS_FIELDS*sizeof(double));
+  }
+  VecRestoreArrayRead(Nodal,&_v);
+  const size_t bytes = Write_Node_Records(filename,prep->GDof/2,nv,index,rec,PETSC_COMM_WORLD);
+  PetscTime(&t1);
+  PetscPrintf(PETSC_COMM_WORLD,"Output: %s, %zu bytes in %.4e s\n",filename.c_str(),bytes,t1-t0);
+}
+
+
+/* gathered nodal values -> STRESS_FIELDS per node in file node order */
+void PostProcessor :: Gathered_Stress(const PetscScalar* v, vector<double>& s) const {
+  s.resize(STRESS_FIELDS*prep->node_perm.size());
+  for(size_t i = 0; i < prep->node_perm.size(); i++){
+    memcpy(&s[STRESS_FIELDS*i],&v[NODAL_BS*prep->node_perm[i]],STRESS_FIELDS*sizeof(double));
+  }
+}
+
+
+/*
+ * One VTK file with the mesh, the displacement and, once recovered, the
+ * nodal strain and stress fields.
+ */
+void PostProcessor :: Write_VTK(string const& filename) const {
+  Profile_Stage stage("Output");
+
+  double t0, t1;
+  PetscTime(&t0);
+  Vec Seq_Solution, Seq_Nodal = NULL;
+  VecScatter gather, gather_nodal = NULL;
+  PetscMPIInt rank;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  VecScatterCreateToZero(solver->Solution,&gather,&Seq_Solution);
+  VecScatterBegin(gather,solver->Solution,Seq_Solution,INSERT_VALUES,SCATTER_FORWARD);
+  VecScatterEnd(gather,solver->Solution,Seq_Solution,INSERT_VALUES,SCATTER_FORWARD);
+  if(Nodal != NULL){
+    VecScatterCreateToZero(Nodal,&gather_nodal,&Seq_Nodal);
+    VecScatterBegin(gather_nodal,Nodal,Seq_Nodal,INSERT_VALUES,SCATTER_FORWARD);
+    VecScatterEnd(gather_nodal,Nodal,Seq_Nodal,INSERT_VALUES,SCATTER_FORWARD);
+  }
+
+  if(rank == 0){
+    const size_t nn = prep->node_perm.size();
+    VTK_Writer vtk;
+    prep->VTK_Mesh(vtk);
+
+    const PetscScalar* _v;
+    vector<double> d(3*nn,0.0);
+    VecGetArrayRead(Seq_Solution,&_v);
+    for(size_t i = 0; i < nn; i++){
+      const int n = prep->node_perm[i];
+      d[3*i]   = _v[2*n];
+      d[3*i+1] = _v[2*n+1];
+    }
+    VecRestoreArrayRead(Seq_Solution,&_v);
+    vtk.Add_Point_Data("displacement",3,d);
+
+    if(Seq_Nodal != NULL){
+      // strain and stress as symmetric tensors xx yy zz xy yz xz, von Mises as a scalar
+      vector<double> s, strain(6*nn,0.0), stress(6*nn,0.0), vm(nn);
+      VecGetArrayRead(Seq_Nodal,&_v);
+      Gathered_Stress(_v,s);
+      VecRestoreArrayRead(Seq_Nodal,&_v);
+      for(size_t i = 0; i < nn; i++){
+        const double* f = &s[STRESS_FIELDS*i];
+        strain[6*i] = f[0]; strain[6*i+1] = f[1]; strain[6*i+3] = 0.5*f[2];
+        stress[6*i] = f[3]; stress[6*i+1] = f[4]; stress[6*i+3] = f[5];
+        vm[i] = f[6];
+      }
+      vtk.Add_Point_Data("strain",6,strain);
+      vtk.Add_Point_Data("stress",6,stress);
+      vtk.Add_Point_Data("von_mises",1,vm);
+    }
+    const size_t bytes = vtk.Write(filename);
+    PetscTime(&t1);
+    PetscPrintf(PETSC_COMM_SELF,"Output: %s, %zu bytes in %.4e s\n",filename.c_str(),bytes,t1-t0);
+  }
+  VecScatterDestroy(&gather);
+  VecDestroy(&Seq_Solution);
+  if(Nodal != NULL){
+    VecScatterDestroy(&gather_nodal);
+    VecDestroy(&Seq_Nodal);
+  }
+}
+
+
+/*
+ * Reactions at the FIXED nodes: the internal force K u of the unconstrained
+ * stiffness minus the applied load there (none, the load vector is zero on
+ * constrained DOFs). Written to reactions.dat as node id, Rx, Ry; the sums
+ * balance the applied loads.
+ */
+void PostProcessor :: Write_Reactions() const {
+  Profile_Stage stage("Output");
+
+  assert(Nodal != NULL);
+  vector<int> fixed;
+  prep->Boundary_Nodes("FIXED",fixed);
+
+  // every process sends the forces of its own fixed nodes to the first one
+  vector<double> R(2*fixed.size(),0.0);
+  const PetscScalar* _v;
+  VecGetArrayRead(Nodal,&_v);
+  for(size_t k = 0; k < fixed.size(); k++){
+    const int n = prep->node_perm[fixed[k]-1];
+    if(n >= prep->node_lo && n < prep->node_hi){
+      R[2*k]   = _v[NODAL_BS*(n-prep->node_lo) + STRESS_FIELDS+1];
+      R[2*k+1] = _v[NODAL_BS*(n-prep->node_lo) + STRESS_FIELDS+2];
+    }
+  }
+  VecRestoreArrayRead(Nodal,&_v);
+  MPI_Allreduce(MPI_IN_PLACE,R.data(),R.size(),MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+
+  PetscScalar Fsum[2] = {0.0, 0.0};
+  PetscInt nrhs;
+  const PetscScalar* _f;
+  VecGetLocalSize(prep->RHS,&nrhs);
+  VecGetArrayRead(prep->RHS,&_f);
+  for(PetscInt i = 0; i < nrhs; i++){
+    Fsum[i%2] += _f[i];
+  }
+  VecRestoreArrayRead(prep->RHS,&_f);
+  MPI_Allreduce(MPI_IN_PLACE,Fsum,2,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+
+  PetscMPIInt rank;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  double Rsum[2] = {0.0, 0.0};
+  for(size_t k = 0; k < fixed.size(); k++){
+    Rsum[0] += R[2*k];
+    Rsum[1] += R[2*k+1];
+  }
+  if(rank == 0){
+    Buffered_Writer out("reactions.dat");
+    char line[64];
+    for(size_t k = 0; k < fixed.size(); k++){
+      out.Write(line,snprintf(line,sizeof(line),"%d %g %g\n",fixed[k],R[2*k],R[2*k+1]));
+    }
+    out.Close();
+  }
+  PetscPrintf(PETSC_COMM_WORLD,"Reactions at %d FIXED nodes: sum %g %g, applied load %g %g\n",
+              int(fixed.size()),Rsum[0],Rsum[1],Fsum[0],Fsum[1]);
+}
+
+
+#endif // POSTPROCESSOR_HPP
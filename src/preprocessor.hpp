@@ -3,29 +3,115 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
 #include "petscksp.h"
 #include "mesh.hpp"
 #include "material.hpp"
 #include "element.hpp"
 #include "quadrature.hpp"
 #include "stiffelement.hpp"
+#include "stiffkernel.hpp"
+#include "elemoperator.hpp"
+#include "profiler.hpp"
+#include "partition.hpp"
+#include "ordering.hpp"
 #include "functions.h"
+#include "writer.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
+/* storage of the global stiffness matrix: scalar AIJ, 2x2 node blocks (BAIJ)
+ * or upper triangle of 2x2 node blocks (SBAIJ); or no global matrix, a
+ * matrix-free operator with stored element matrices or with element matrices
+ * recomputed from the geometry in every product */
+typedef enum {K_AIJ, K_BAIJ, K_SBAIJ, K_SHELL, K_SHELL_RECOMPUTE} Matrix_Format;
+
+/* element matrices of the matrix-free operator, -matrix_free */
+typedef enum {SHELL_STORED, SHELL_RECOMPUTE} Shell_Mode;
+static const char* const shell_mode_names[] = {"stored","recompute","Shell_Mode","SHELL_",NULL};
+
+/* enforcement of the FIXED nodes: zero their rows (nonsymmetric), drop their
+ * rows and columns during assembly (symmetric), or solve for the free DOFs
+ * only (reduced system) */
+typedef enum {BC_ZERO_ROWS, BC_SYMMETRIC, BC_ELIMINATE} Constraint_Mode;
+static const char* const constraint_mode_names[] = {"zero_rows","symmetric","eliminate","Constraint_Mode","BC_",NULL};
+
+
+/*
+ * CLASS LOAD_CASE -> named set of nodal forces, nodes by file node id
+ */
+class Load_Case{
+  friend class PreProcessor;
+private:
+  string name;
+  vector<int> node;
+  vector<double> fx, fy;
+
+public:
+  Load_Case(string const& Name) : name(Name) {}
+  void Add_Force(int NodeID, double Fx, double Fy){
+    node.push_back(NodeID);
+    fx.push_back(Fx);
+    fy.push_back(Fy);
+  }
+  string const& Name() const { return name; }
+};
+
 class PreProcessor{
   friend class FEA_Solver;
+  friend class PostProcessor;
 private:
   const Mesh *mesh;
   const Material *material;
   Quadrature_Rule QRule;
+  Matrix_Format MFormat;
+  Constraint_Mode CMode;
   Quadrature *Quad_Quad, *Quad_Tri;
-  vector<Element*> element;
-  vector<EStiffness*> stiffness;
+  Element_Geometry Geometry;      // quadrature point geometry of the local quadrilaterals
+  Tri_Coordinates Tri_Geometry;   // nodal coordinates of the local triangles
+  Element_Matrices stiffness;      // packed element matrices of elem_local, one array
   Mat KMat;
+  Element_Operator* KShell;       // operator behind KMat when matrix-free
+  Mat KFree;                      // free DOF block of KMat (BC_ELIMINATE)
+  Mat K_unit[2];                  // constrained K of E = 1, thickness = 1: K = E t/(1-nu^2) (K_unit[0] + nu K_unit[1])
+  IS Free_DOF;                    // owned free DOFs (BC_ELIMINATE)
   Vec RHS;
   double Point_Load;
+  vector<Load_Case> load_case;
   size_t GDof;
+  vector<int> adj_ptr, adj_node;  // node adjacency graph of the local nodes (CSR, includes self)
+  int node_lo, node_hi;           // range of nodes whose rows are owned by this process
+  vector<int> ghost_node;         // other nodes of the local elements and neighbours of owned nodes, sorted
+  vector<int> node_range;         // first node owned by each process, plus the node count
+  vector<int> node_perm, node_iperm;  // file node index -> equation node number, and back
+  vector<int> elem_local;         // faces computed by this process, quadrilaterals first
+  size_t nquad_local;             // quadrilaterals in elem_local, the triangles follow
+  vector<int> row_index;          // local node -> block row of K_csr, -1 if untouched locally
+  bool Sym_Storage;               // KMat holds the upper triangle only
+  vector<char> fixed_node;        // local nodes eliminated during assembly (symmetric storage or constraints)
+  vector<PetscInt> fixed_rows;    // owned equations of the FIXED nodes, whatever the constraint mode
+  int Num_Threads;                // threads for the element loops, 0 = serial insertion path
+  vector<int> color_ptr, color_elem;  // elements grouped by color, no shared node within a color
+  vector<double> K_csr;           // block rows touched by local elements, laid out on the node graph
+
+  void Partition_Mesh();
+  void Element_Ghost_Nodes(vector<int>&) const;
+  int Local_Node(int) const;
+  int Global_Node(int) const;
+  int Local_Nodes() const;
+  void Mark_Fixed_Nodes();
+  void Matrix_Bandwidth(long&, long&) const;
+  void Compute_Element_Colors();
+  void Scatter_Element_Stiffness(size_t);
+  void Assemble_Colored();
+  void Create_Shell_Operator();
+  void Compute_Element_stiffness(double const* const*, double);
+  void Constrain_Stiffness_Matrix();
 
 public:
 
@@ -33,12 +119,38 @@ public:
   ~PreProcessor();
 
   void Set_quadrature_rule(Quadrature_Rule const &);
+  void Set_matrix_format(Matrix_Format const &);
+  void Set_constraint_mode(Constraint_Mode const &);
+  bool Symmetric_System() const;
+  bool Matrix_Free() const;
+  void Set_num_threads(int);
   void Create_Quadrature_Objects();
   void Compute_Element_properties();
   void Compute_Element_stiffness();
+  void Benchmark_Element_Stiffness(int);
+  void Compute_Node_Graph();
+  void Preallocate_Stiffness_Matrix();
   void Assemble_Stiffness_Matrix();
+  void Benchmark_Threads();
+  void Benchmark_Matrix_Free(int);
+  void Setup_Parameter_Sweep();
+  void Set_Sweep_Parameters(double, double, double);
   void Apply_BC();
   void set_pointload(double);
+  void Add_Load_Case(Load_Case const&);
+  void Read_Load_Cases(string const&);
+  size_t Num_Load_Cases() const;
+  Load_Case const& Get_Load_Case(size_t) const;
+  void Build_Load_Vector(Load_Case const&, Vec) const;
+  void Create_Coordinates(Vec*) const;
+  size_t Num_Elements() const;
+  size_t Num_DOF() const;
+  void Report_Partition();
+  void Local_Connectivity(vector<PetscInt>&, vector<int>&) const;
+  void Boundary_Nodes(string const&, vector<int>&) const;
+  void VTK_Mesh(VTK_Writer&) const;
+  void Owned_Nodes(vector<int>&, vector<double>&) const;
+  void Reorder_Nodes_RCM();
 
 };
 
@@ -47,9 +159,293 @@ public:
 
 PreProcessor::PreProcessor(Mesh const* msh, Material const* matrl)
   :mesh(msh), material(matrl){
-  GDof = 2*mesh->node.size();
+  GDof = 2*mesh->Nodes();
   Quad_Quad = NULL;
   Quad_Tri = NULL;
+  nquad_local = 0;
+  MFormat = K_AIJ;
+  CMode = BC_ZERO_ROWS;
+  Sym_Storage = false;
+  Num_Threads = 0;
+  KMat = NULL;
+  KShell = NULL;
+  KFree = NULL;
+  K_unit[0] = K_unit[1] = NULL;
+  Free_DOF = NULL;
+  RHS = NULL;
+
+  Partition_Mesh();
+}
+
+
+/*
+ * Distribute the mesh: nodes are split by recursive coordinate bisection and
+ * renumbered so that every process owns one contiguous range of nodes, i.e.
+ * of block rows of K. Each face is computed by the owner of its lowest
+ * numbered node. Whole nodes are owned, so u and v stay on one process.
+ */
+void PreProcessor :: Partition_Mesh(){
+  Profile_Stage stage("Partition");
+
+  PetscMPIInt rank, size;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  MPI_Comm_size(PETSC_COMM_WORLD,&size);
+  const int nnode = mesh->Nodes();
+
+  vector<double> x(mesh->x.begin(),mesh->x.end()), y(mesh->y.begin(),mesh->y.end());
+  vector<int> part;
+  RCB_Partitioner(x,y,part).Partition(size);
+
+  // contiguous numbering by part, file order within a part
+  node_range.assign(size+1,0);
+  for(int i = 0; i < nnode; i++){
+    node_range[part[i]+1]++;
+  }
+  for(int p = 0; p < size; p++){
+    node_range[p+1] += node_range[p];
+  }
+  node_perm.resize(nnode);
+  node_iperm.resize(nnode);
+  vector<int> fill(node_range.begin(),node_range.end()-1);
+  for(int i = 0; i < nnode; i++){
+    node_perm[i] = fill[part[i]]++;
+    node_iperm[node_perm[i]] = i;
+  }
+  node_lo = node_range[rank];
+  node_hi = node_range[rank+1];
+
+  elem_local.clear();
+  for(size_t i = 0; i < mesh->Elements(); i++){
+    const Node_List fn = mesh->Element(i);
+    int nmin = node_perm[fn[0]-1];
+    for(size_t a = 1; a < fn.size(); a++){
+      nmin = min(nmin,node_perm[fn[a]-1]);
+    }
+    if(nmin >= node_lo && nmin < node_hi){
+      elem_local.push_back(i);
+    }
+  }
+  // the mesh numbers the quadrilaterals before the triangles, so the local
+  // elements already form one homogeneous block per type
+  nquad_local = lower_bound(elem_local.begin(),elem_local.end(),int(mesh->block[ELEM_TRI3].First())) - elem_local.begin();
+  Element_Ghost_Nodes(ghost_node);
+}
+
+
+/* equation nodes of the local elements owned by other processes, sorted */
+void PreProcessor :: Element_Ghost_Nodes(vector<int>& ghosts) const {
+  ghosts.clear();
+  for(size_t i = 0; i < elem_local.size(); i++){
+    const Node_List fn = mesh->Element(elem_local[i]);
+    for(size_t a = 0; a < fn.size(); a++){
+      const int n = node_perm[fn[a]-1];
+      if(n < node_lo || n >= node_hi){
+        ghosts.push_back(n);
+      }
+    }
+  }
+  sort(ghosts.begin(),ghosts.end());
+  ghosts.erase(unique(ghosts.begin(),ghosts.end()),ghosts.end());
+}
+
+
+/* local node numbering: the owned nodes, then the ghost nodes. Local index of
+ * equation node n, -1 if it is not local, and back */
+int PreProcessor :: Local_Node(int n) const {
+  if(n >= node_lo && n < node_hi){
+    return n - node_lo;
+  }
+  vector<int>::const_iterator it = lower_bound(ghost_node.begin(),ghost_node.end(),n);
+  if(it == ghost_node.end() || *it != n){
+    return -1;
+  }
+  return (node_hi - node_lo) + int(it - ghost_node.begin());
+}
+
+int PreProcessor :: Global_Node(int r) const {
+  const int nlocal = node_hi - node_lo;
+  return r < nlocal ? node_lo + r : ghost_node[r - nlocal];
+}
+
+int PreProcessor :: Local_Nodes() const {
+  return (node_hi - node_lo) + ghost_node.size();
+}
+
+
+/*
+ * Reverse Cuthill-McKee renumbering of the nodes of every process, on the
+ * node graph restricted to its own range, so the partition and the element
+ * owners do not change. Every process orders its own rows, the new numbers
+ * are then gathered on all of them as the mesh is replicated. Must be called
+ * before the element equation numbers are generated; results are still
+ * written in file node order (node_perm).
+ */
+void PreProcessor :: Reorder_Nodes_RCM(){
+  Profile_Stage stage("RCM ordering");
+
+  assert(stiffness.empty() && KShell == NULL);
+  Compute_Node_Graph();
+
+  long bw0, prof0;
+  Matrix_Bandwidth(bw0,prof0);
+
+  const int nnode = mesh->Nodes();
+  const int nlocal = node_hi - node_lo;
+  vector<int> ptr(1,0), adj, order;
+  for(int r = 0; r < nlocal; r++){
+    for(int k = adj_ptr[r]; k < adj_ptr[r+1]; k++){
+      if(adj_node[k] >= node_lo && adj_node[k] < node_hi){
+        adj.push_back(adj_node[k]-node_lo);
+      }
+    }
+    ptr.push_back(adj.size());
+  }
+  RCM_Ordering(ptr,adj,order).Order();
+  vector<int> renum_local(nlocal);
+  for(int k = 0; k < nlocal; k++){
+    renum_local[order[k]] = node_lo+k;
+  }
+
+  const int nproc = node_range.size()-1;
+  vector<int> count(nproc);
+  for(int p = 0; p < nproc; p++){
+    count[p] = node_range[p+1] - node_range[p];
+  }
+  vector<int> renum(nnode);
+  MPI_Allgatherv(renum_local.data(),nlocal,MPI_INT,renum.data(),count.data(),node_range.data(),MPI_INT,PETSC_COMM_WORLD);
+
+  for(int i = 0; i < nnode; i++){
+    node_perm[i] = renum[node_perm[i]];
+    node_iperm[node_perm[i]] = i;
+  }
+
+  Compute_Node_Graph();
+  long bw1, prof1;
+  Matrix_Bandwidth(bw1,prof1);
+
+  PetscPrintf(PETSC_COMM_WORLD,"Node ordering (RCM): %12s %12s\n","before","after");
+  PetscPrintf(PETSC_COMM_WORLD,"  %-18s %12ld %12ld\n","bandwidth",bw0,bw1);
+  PetscPrintf(PETSC_COMM_WORLD,"  %-18s %12ld %12ld\n","profile",prof0,prof1);
+}
+
+
+/* half bandwidth and profile (sum over rows of the distance from the first
+ * nonzero to the diagonal) of the scalar matrix, from the owned rows of the
+ * node graph of every process */
+void PreProcessor :: Matrix_Bandwidth(long& bandwidth, long& profile) const {
+  bandwidth = 0;
+  profile = 0;
+  for(int r = 0; r < node_hi - node_lo; r++){
+    const long d = node_lo + r - adj_node[adj_ptr[r]];   // rows sorted, first is lowest
+    bandwidth = max(bandwidth,2*d+1);
+    profile += 4*d+1;                                    // rows 2n and 2n+1
+  }
+  MPI_Allreduce(MPI_IN_PLACE,&bandwidth,1,MPI_LONG,MPI_MAX,PETSC_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE,&profile,1,MPI_LONG,MPI_SUM,PETSC_COMM_WORLD);
+}
+
+
+/* equation nodes touched by the local elements, sorted, and for every local
+ * element the indices of its nodes in that list: nen per quadrilateral (as in
+ * the geometry), then 3 per triangle */
+void PreProcessor :: Local_Connectivity(vector<PetscInt>& node, vector<int>& elem_node) const {
+
+  const int nen = Geometry.Nodes_per_element();
+  node.clear();
+  for(size_t e = 0; e < elem_local.size(); e++){
+    const Node_List fn = mesh->Element(elem_local[e]);
+    assert(fn.size() == (e < nquad_local ? size_t(nen) : 3));
+    for(size_t a = 0; a < fn.size(); a++){
+      node.push_back(node_perm[fn[a]-1]);
+    }
+  }
+  sort(node.begin(),node.end());
+  node.erase(unique(node.begin(),node.end()),node.end());
+
+  elem_node.clear();
+  elem_node.reserve(nen*nquad_local + 3*(elem_local.size()-nquad_local));
+  for(size_t e = 0; e < elem_local.size(); e++){
+    const Node_List fn = mesh->Element(elem_local[e]);
+    for(size_t a = 0; a < fn.size(); a++){
+      elem_node.push_back(lower_bound(node.begin(),node.end(),node_perm[fn[a]-1]) - node.begin());
+    }
+  }
+}
+
+
+/* file node ids of all boundaries with the given name, sorted and unique */
+void PreProcessor :: Boundary_Nodes(string const& name, vector<int>& ids) const {
+  ids.clear();
+  for(size_t s = 0; s < mesh->Selections(); s++){
+    if(mesh->selection[s] == name){
+      ids.insert(ids.end(),mesh->Selection(s).begin(),mesh->Selection(s).end());
+    }
+  }
+  sort(ids.begin(),ids.end());
+  ids.erase(unique(ids.begin(),ids.end()),ids.end());
+}
+
+
+/* all nodes (file order) and elements (mesh order) of the mesh */
+void PreProcessor :: VTK_Mesh(VTK_Writer& vtk) const {
+
+  vector<double> xyz(3*mesh->Nodes());
+  for(size_t i = 0; i < mesh->Nodes(); i++){
+    xyz[3*i]   = mesh->x[i];
+    xyz[3*i+1] = mesh->y[i];
+    xyz[3*i+2] = 0.0;
+  }
+  vtk.Set_Points(xyz);
+
+  vector<int32_t> conn, offs(mesh->Elements());
+  vector<uint8_t> type(mesh->Elements());
+  for(size_t e = 0; e < mesh->Elements(); e++){
+    const Node_List fn = mesh->Element(e);
+    for(size_t a = 0; a < fn.size(); a++){
+      conn.push_back(fn[a]-1);
+    }
+    offs[e] = conn.size();
+    type[e] = (fn.size() == 3) ? VTK_Writer::VTK_TRIANGLE :
+              (fn.size() == 8) ? VTK_Writer::VTK_QUADRATIC_QUAD :
+              (fn.size() == 9) ? VTK_Writer::VTK_BIQUADRATIC_QUAD : VTK_Writer::VTK_QUAD;
+  }
+  vtk.Set_Cells(conn,offs,type);
+}
+
+
+/* file indices (from 0, ascending) and x, y of the nodes owned by this process */
+void PreProcessor :: Owned_Nodes(vector<int>& index, vector<double>& xy) const {
+  index.clear();
+  xy.clear();
+  for(size_t i = 0; i < node_perm.size(); i++){
+    if(node_perm[i] >= node_lo && node_perm[i] < node_hi){
+      index.push_back(i);
+      xy.push_back(mesh->x[i]);
+      xy.push_back(mesh->y[i]);
+    }
+  }
+}
+
+
+/* load balance of the distribution: elements, owned and ghost nodes per process */
+void PreProcessor :: Report_Partition(){
+
+  vector<int> ghosts;
+  Element_Ghost_Nodes(ghosts);
+  const int ghost = ghosts.size();
+
+  PetscMPIInt size;
+  MPI_Comm_size(PETSC_COMM_WORLD,&size);
+  int local[3] = {int(elem_local.size()), node_hi-node_lo, ghost}, lmax[3], lmin[3], lsum[3];
+  MPI_Allreduce(local,lmax,3,MPI_INT,MPI_MAX,PETSC_COMM_WORLD);
+  MPI_Allreduce(local,lmin,3,MPI_INT,MPI_MIN,PETSC_COMM_WORLD);
+  MPI_Allreduce(local,lsum,3,MPI_INT,MPI_SUM,PETSC_COMM_WORLD);
+
+  PetscPrintf(PETSC_COMM_WORLD,"Partition (RCB) on %d processes:  %12s %12s %12s\n",size,"min","max","avg");
+  const char* name[3] = {"elements","owned nodes","ghost nodes"};
+  for(int k = 0; k < 3; k++){
+    PetscPrintf(PETSC_COMM_WORLD,"  %-32s %12d %12d %12.1f\n",name[k],lmin[k],lmax[k],double(lsum[k])/size);
+  }
 }
 
 
@@ -57,6 +453,33 @@ void PreProcessor :: Set_quadrature_rule(const Quadrature_Rule &qrule){
   QRule = qrule;
 }
 
+void PreProcessor :: Set_matrix_format(const Matrix_Format &mformat){
+  MFormat = mformat;
+}
+
+/* must be chosen before the first assembly */
+void PreProcessor :: Set_constraint_mode(const Constraint_Mode &cmode){
+  assert(KMat == NULL);
+  CMode = cmode;
+}
+
+/* true if the system handed to the solver is symmetric; the matrix-free
+ * operator always has the symmetric constraints */
+bool PreProcessor :: Symmetric_System() const {
+  return Sym_Storage || CMode != BC_ZERO_ROWS || Matrix_Free();
+}
+
+bool PreProcessor :: Matrix_Free() const {
+  return MFormat == K_SHELL || MFormat == K_SHELL_RECOMPUTE;
+}
+
+/* n >= 1 selects the threaded path (colored CSR assembly), whose result does
+ * not depend on n; 0 keeps the serial element-by-element insertion */
+void PreProcessor :: Set_num_threads(int n){
+  assert(n >= 0);
+  Num_Threads = n;
+}
+
 PreProcessor :: ~PreProcessor(){
   if(Quad_Quad != NULL){
     delete Quad_Quad;
@@ -64,16 +487,49 @@ PreProcessor :: ~PreProcessor(){
   if(Quad_Tri != NULL){
     delete Quad_Tri;
   }
-  for(size_t i = 0; i < element.size(); i++){
-    delete element[i];
-    delete stiffness[i];
-  }
   VecDestroy(&RHS);
   MatDestroy(&KMat);
+  delete KShell;
+  MatDestroy(&KFree);
+  MatDestroy(&K_unit[0]);
+  MatDestroy(&K_unit[1]);
+  ISDestroy(&Free_DOF);
 }
 
 
+/*
+ * Quad4 meshes use the requested rule. Quad8 and Quad9 meshes always get the
+ * 3x3 rule, the full integration of their stiffness (2x2 would leave spurious
+ * zero energy modes), and an assembled matrix, the matrix-free operator
+ * being written for Quad4. Triangles (alone or mixed with Quad4) are
+ * constant strain elements with an assembled matrix as well.
+ */
 void PreProcessor :: Create_Quadrature_Objects(){
+  Profile_Stage stage("Quadrature");
+  if(mesh->isTriPresent){
+    if(Matrix_Free()){
+      PetscPrintf(PETSC_COMM_WORLD,"Matrix-free operator: not available for triangles, using AIJ\n");
+      MFormat = K_AIJ;
+    }
+    Quad_Tri = new Quadrature_1PTri3;
+    Quad_Tri->Setup_Quadrature();
+    Quad_Tri->Print_Quadrature_Info();
+  }
+  if(mesh->isQuad8Present || mesh->isQuad9Present){
+    assert(!mesh->isQuadPresent && !mesh->isTriPresent && !(mesh->isQuad8Present && mesh->isQuad9Present));
+    if(Matrix_Free()){
+      PetscPrintf(PETSC_COMM_WORLD,"Matrix-free operator: not available for quadratic elements, using AIJ\n");
+      MFormat = K_AIJ;
+    }
+    if(mesh->isQuad8Present){
+      Quad_Quad = new Quadrature_3PQuad8;
+    }else{
+      Quad_Quad = new Quadrature_3PQuad9;
+    }
+    Quad_Quad->Setup_Quadrature();
+    Quad_Quad->Print_Quadrature_Info();
+    return;
+  }
   if(QRule == Q2D_2point && mesh->isQuadPresent){
     Quad_Quad = new Quadrature_2PQuad4;
     Quad_Quad->Setup_Quadrature();
@@ -84,19 +540,54 @@ void PreProcessor :: Create_Quadrature_Objects(){
     Quad_Quad->Setup_Quadrature();
     Quad_Quad->Print_Quadrature_Info();
   }
+  if(QRule == Q2D_1point && mesh->isQuadPresent){
+    Quad_Quad = new Quadrature_1PQuad4;
+    Quad_Quad->Setup_Quadrature();
+    Quad_Quad->Print_Quadrature_Info();
+  }
 }
 
 
 
 void PreProcessor :: Compute_Element_properties(){
+  Profile_Stage stage("Element setup");
+
+  const long nelem = nquad_local;
+  const long ntri = elem_local.size() - nquad_local;
+  assert(nelem == 0 || Quad_Quad != NULL);
+  assert(ntri == 0 || Quad_Tri != NULL);
+
+  /* one allocation for the geometry of all local quadrilaterals */
+  if(Quad_Quad != NULL){
+    const int nen = Quad_Quad->Nodes();
+    Geometry.Allocate(nelem,nen,Quad_Quad->Qpoints());
+
+    // one kernel per element kind, batches over the contiguous quads
+    const Element_Block& quads = mesh->block[Quad_Quad->Nodes() == 4 ? ELEM_QUAD4 : Quad_Quad->Nodes() == 8 ? ELEM_QUAD8 : ELEM_QUAD9];
+    Setup_Quad_Geometry(*Quad_Quad,mesh->x.begin(),mesh->y.begin(),quads,elem_local.data(),nelem,Num_Threads,Geometry);
 
-  Element *elem;
-  for(size_t i = 0; i < mesh->face.size(); i++){
-    if(mesh->face[i].Ftype == Face::QUAD){
-      elem = new Quad4(Quad_Quad,mesh->face[i]);
+    PetscPrintf(PETSC_COMM_WORLD,"Element geometry: %g bytes per element, %g bytes total\n",
+                Geometry.Bytes_per_element(),double(Geometry.Bytes()));
+  }
+
+  /* triangles: node coordinates only, the kernels need nothing else */
+  if(ntri > 0){
+    Tri_Geometry.Allocate(ntri);
+    for(long i = 0; i < ntri; i++){
+      const Node_List fn = mesh->Element(elem_local[nelem+i]);
+      for(int a = 0; a < 3; a++){
+        Tri_Geometry.x(i,a) = mesh->x[fn[a]-1];
+        Tri_Geometry.y(i,a) = mesh->y[fn[a]-1];
+      }
+      const double twoA = (Tri_Geometry.x(i,1)-Tri_Geometry.x(i,0))*(Tri_Geometry.y(i,2)-Tri_Geometry.y(i,0))
+                        - (Tri_Geometry.x(i,2)-Tri_Geometry.x(i,0))*(Tri_Geometry.y(i,1)-Tri_Geometry.y(i,0));
+      if(twoA <= 0.0){
+        cout << "Triangle " << fn[0] << " " << fn[1] << " " << fn[2] << ": area " << 0.5*twoA
+             << " (nodes must be counterclockwise)" << endl;
+      }
+      assert(twoA > 0.0);
     }
-    elem->Element_setup(mesh->node);
-    element.push_back(elem);
+    PetscPrintf(PETSC_COMM_WORLD,"Triangle geometry: %g bytes total\n",double(Tri_Geometry.Bytes()));
   }
 
 }
@@ -105,89 +596,819 @@ void PreProcessor :: Compute_Element_properties(){
 
 void PreProcessor :: Compute_Element_stiffness(){
   assert(mesh->Get_Thickness() != 0);
-  EStiffness *estiff;
-  for(size_t i = 0; i < mesh->face.size(); i++){
-    estiff= new EStiffness(material,element[i]);
-    estiff->Compute_Element_Stiffness(mesh->Get_Thickness());
-    estiff->Compute_Equation_Number(mesh->face[i].nodes);
-    stiffness.push_back(estiff);
+  Compute_Element_stiffness(material->Get_Element_Stiffness(),mesh->Get_Thickness());
+}
+
+
+/* element matrices for the elastic stiffness C and the given thickness */
+void PreProcessor :: Compute_Element_stiffness(double const* const* C, double thickness){
+  Profile_Stage stage("Element stiffness");
+  const long nelem = nquad_local;
+  const long ntri = elem_local.size() - nquad_local;
+  const double* QW = (Quad_Quad != NULL) ? Quad_Quad->QWeights() : NULL;
+
+  // matrix-free: packed element matrices of the operator only (or none)
+  if(Matrix_Free()){
+    if(KShell == NULL){
+      vector<PetscInt> node;
+      vector<int> elem_node;
+      Local_Connectivity(node,elem_node);
+      KShell = new Element_Operator(&Geometry,QW,C,thickness,MFormat == K_SHELL_RECOMPUTE);
+      KShell->Set_Elements(node,elem_node);
+    }
+    KShell->Compute_Element_Matrices(Num_Threads);
+    return;
+  }
+
+  if(stiffness.size() != elem_local.size()){
+    stiffness.Allocate(nelem,Quad_Quad != NULL ? Quad_Quad->Nodes() : 4,ntri);
+    for(size_t i = 0; i < elem_local.size(); i++){
+      stiffness.Set_Equations(i,mesh->Element(elem_local[i]),node_perm);
+    }
+    double bytes = stiffness.Bytes();
+    MPI_Allreduce(MPI_IN_PLACE,&bytes,1,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+    PetscPrintf(PETSC_COMM_WORLD,"Element matrices: %g bytes total, %g bytes per element\n",
+                bytes,bytes/mesh->Elements());
+  }
+
+  /* full SIMD batches, then the remainder one element at a time */
+  const long nbatch = nelem/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(Num_Threads,1)) schedule(static)
+  for(long b = 0; b < nbatch; b++){
+    double Kup[QUAD_MAX_UPPER*STIFF_BATCH];
+    const long e = b*STIFF_BATCH;
+    Quad_Stiffness_Kernel<STIFF_BATCH>(Geometry,e,QW,C,thickness,Kup);
+    for(int l = 0; l < STIFF_BATCH; l++){
+      stiffness.Set(e+l,&Kup[l],STIFF_BATCH);
+    }
+  }
+  for(long e = nbatch*STIFF_BATCH; e < nelem; e++){
+    double Kup[QUAD_MAX_UPPER];
+    Quad_Stiffness_Kernel<1>(Geometry,e,QW,C,thickness,Kup);
+    stiffness.Set(e,Kup,1);
   }
+  if(nelem > 0){
+    Profiler::Instance().Add_Flops(nelem*QUAD_STIFFNESS_FLOPS(Quad_Quad->Nodes(),Quad_Quad->Qpoints()));
+  }
+
+  /* triangles, their own batches after the quadrilaterals */
+  const long ntbatch = ntri/STIFF_BATCH;
+#pragma omp parallel for num_threads(max(Num_Threads,1)) schedule(static)
+  for(long b = 0; b < ntbatch; b++){
+    double Kup[TRI3_UPPER*STIFF_BATCH];
+    const long e = b*STIFF_BATCH;
+    Tri3_Stiffness_Batch<STIFF_BATCH>(Tri_Geometry,e,C,thickness,Kup);
+    for(int l = 0; l < STIFF_BATCH; l++){
+      stiffness.Set(nelem+e+l,&Kup[l],STIFF_BATCH);
+    }
+  }
+  for(long e = ntbatch*STIFF_BATCH; e < ntri; e++){
+    double Kup[TRI3_UPPER];
+    Tri3_Stiffness_Batch<1>(Tri_Geometry,e,C,thickness,Kup);
+    stiffness.Set(nelem+e,Kup,1);
+  }
+  Profiler::Instance().Add_Flops(ntri*TRI3_STIFFNESS_FLOPS);
 }
 
 
+/* element stiffness throughput: cblas reference path vs batched kernel,
+ * quadrilaterals only */
+void PreProcessor :: Benchmark_Element_Stiffness(int nrepeat){
+  assert(stiffness.size() == elem_local.size() && Quad_Quad != NULL);
+  const size_t nelem = nquad_local;
+  const double thickness = mesh->Get_Thickness();
+  const double* QW = Quad_Quad->QWeights();
+  double** C = material->Get_Element_Stiffness();
+  const int ndof = QUAD_DOF(Geometry.Nodes_per_element()), nup = QUAD_UPPER(Geometry.Nodes_per_element());
+  vector<double> Kup(nup*nelem + nup*STIFF_BATCH), K(ndof*ndof);
+  PetscLogDouble t0, t1, t2;
 
-void PreProcessor :: Assemble_Stiffness_Matrix(){
-  assert(stiffness.size() != 0);
-  int GDof = 2*mesh->node.size();
+  PetscTime(&t0);
+  for(int r = 0; r < nrepeat; r++){
+    for(size_t e = 0; e < nelem; e++){
+      Reference_Quad_Stiffness(Geometry,e,QW,C,thickness,&K[0]);
+    }
+  }
+  PetscTime(&t1);
+  for(int r = 0; r < nrepeat; r++){
+    size_t e = 0;
+    for(; e + STIFF_BATCH <= nelem; e += STIFF_BATCH){
+      Quad_Stiffness_Kernel<STIFF_BATCH>(Geometry,e,QW,C,thickness,&Kup[nup*e]);
+    }
+    for(; e < nelem; e++){
+      Quad_Stiffness_Kernel<1>(Geometry,e,QW,C,thickness,&Kup[nup*e]);
+    }
+  }
+  PetscTime(&t2);
+
+  // compare the last batched result with the cblas matrices
+  const size_t nfull = nelem - nelem % STIFF_BATCH;
+  double maxdiff = 0.0, maxval = 0.0;
+  for(size_t e = 0; e < nelem; e++){
+    const size_t e0 = (e < nfull) ? e - e % STIFF_BATCH : e;
+    const int W = (e < nfull) ? STIFF_BATCH : 1;
+    Reference_Quad_Stiffness(Geometry,e,QW,C,thickness,&K[0]);
+    int k = 0;
+    for(int i = 0; i < ndof; i++){
+      for(int j = i; j < ndof; j++){
+        const double v = Kup[nup*e0 + k*W + (e-e0)];
+        maxdiff = max(maxdiff,fabs(v-K[i*ndof + j]));
+        maxval = max(maxval,fabs(K[i*ndof + j]));
+        k++;
+      }
+    }
+  }
+
+  const double n = double(nelem)*nrepeat;
+  PetscPrintf(PETSC_COMM_WORLD,"Element stiffness benchmark (%d lanes, %d nodes, %d quadrature points, %g elements):\n",
+              STIFF_BATCH,Quad_Quad->Nodes(),Quad_Quad->Qpoints(),n);
+  PetscPrintf(PETSC_COMM_WORLD,"  cblas   : %12.4e elements/s\n",n/(t1-t0));
+  PetscPrintf(PETSC_COMM_WORLD,"  batched : %12.4e elements/s  (speedup %.2fx)\n",n/(t2-t1),(t1-t0)/(t2-t1));
+  PetscPrintf(PETSC_COMM_WORLD,"  max relative difference %g\n",maxdiff/maxval);
+}
+
+
+
+/*
+ * symbolic phase: node to node connectivity through shared faces, for the
+ * local nodes only, rows and columns in equation node numbering, sorted.
+ * Every process gets the couplings of its local elements; the rows of the
+ * ghost nodes are then sent to their owners, so that owned rows include the
+ * couplings of off-process faces. Ghost rows keep the local couplings only.
+ */
+void PreProcessor :: Compute_Node_Graph(){
+
+  PetscMPIInt size;
+  MPI_Comm_size(PETSC_COMM_WORLD,&size);
+  Element_Ghost_Nodes(ghost_node);
+  const int nlocal = node_hi - node_lo;
+  const int nrow = Local_Nodes();
+
+  // local elements attached to each local node
+  vector<int> ne_ptr(nrow+1,0), ne;
+  for(size_t e = 0; e < elem_local.size(); e++){
+    const Node_List fn = mesh->Element(elem_local[e]);
+    for(size_t a = 0; a < fn.size(); a++){
+      ne_ptr[Local_Node(node_perm[fn[a]-1])+1]++;
+    }
+  }
+  for(int r = 0; r < nrow; r++){
+    ne_ptr[r+1] += ne_ptr[r];
+  }
+  ne.resize(ne_ptr[nrow]);
+  vector<int> fill(ne_ptr.begin(),ne_ptr.end()-1);
+  for(size_t e = 0; e < elem_local.size(); e++){
+    const Node_List fn = mesh->Element(elem_local[e]);
+    for(size_t a = 0; a < fn.size(); a++){
+      ne[fill[Local_Node(node_perm[fn[a]-1])]++] = e;
+    }
+  }
+
+  // couplings through the local elements, sorted and unique
+  vector<int> loc_ptr(nrow+1,0), loc_node, nbr;
+  for(int r = 0; r < nrow; r++){
+    nbr.clear();
+    for(int k = ne_ptr[r]; k < ne_ptr[r+1]; k++){
+      const Node_List fn = mesh->Element(elem_local[ne[k]]);
+      for(size_t a = 0; a < fn.size(); a++){
+        nbr.push_back(node_perm[fn[a]-1]);
+      }
+    }
+    sort(nbr.begin(),nbr.end());
+    nbr.erase(unique(nbr.begin(),nbr.end()),nbr.end());
+    loc_node.insert(loc_node.end(),nbr.begin(),nbr.end());
+    loc_ptr[r+1] = loc_node.size();
+  }
+
+  // ghost rows to their owners as (node, count, neighbours); ghosts are
+  // sorted and ranges contiguous, so the buffer is already grouped by owner
+  vector<int> sendcount(size,0), recvcount(size), senddispl(size+1,0), recvdispl(size+1,0);
+  vector<int> sendbuf;
+  for(size_t g = 0; g < ghost_node.size(); g++){
+    const int r = nlocal + g;
+    const int p = upper_bound(node_range.begin(),node_range.end(),ghost_node[g]) - node_range.begin() - 1;
+    sendbuf.push_back(ghost_node[g]);
+    sendbuf.push_back(loc_ptr[r+1] - loc_ptr[r]);
+    sendbuf.insert(sendbuf.end(),loc_node.begin()+loc_ptr[r],loc_node.begin()+loc_ptr[r+1]);
+    sendcount[p] += 2 + loc_ptr[r+1] - loc_ptr[r];
+  }
+  MPI_Alltoall(sendcount.data(),1,MPI_INT,recvcount.data(),1,MPI_INT,PETSC_COMM_WORLD);
+  for(int p = 0; p < size; p++){
+    senddispl[p+1] = senddispl[p] + sendcount[p];
+    recvdispl[p+1] = recvdispl[p] + recvcount[p];
+  }
+  vector<int> recvbuf(recvdispl[size]);
+  MPI_Alltoallv(sendbuf.data(),sendcount.data(),senddispl.data(),MPI_INT,
+                recvbuf.data(),recvcount.data(),recvdispl.data(),MPI_INT,PETSC_COMM_WORLD);
+
+  // received couplings of each owned row
+  vector<int> rcv_ptr(nlocal+1,0), rcv_node;
+  for(size_t k = 0; k < recvbuf.size(); k += 2 + recvbuf[k+1]){
+    rcv_ptr[recvbuf[k]-node_lo+1] += recvbuf[k+1];
+  }
+  for(int r = 0; r < nlocal; r++){
+    rcv_ptr[r+1] += rcv_ptr[r];
+  }
+  rcv_node.resize(rcv_ptr[nlocal]);
+  fill.assign(rcv_ptr.begin(),rcv_ptr.end()-1);
+  for(size_t k = 0; k < recvbuf.size(); k += 2 + recvbuf[k+1]){
+    const int r = recvbuf[k]-node_lo;
+    for(int j = 0; j < recvbuf[k+1]; j++){
+      rcv_node[fill[r]++] = recvbuf[k+2+j];
+    }
+  }
+
+  // owned rows: local and received couplings; their off-process neighbours
+  // become ghost nodes too
+  vector<int> own_ptr(nlocal+1,0), own_node, ghosts;
+  for(int r = 0; r < nlocal; r++){
+    nbr.assign(loc_node.begin()+loc_ptr[r],loc_node.begin()+loc_ptr[r+1]);
+    nbr.insert(nbr.end(),rcv_node.begin()+rcv_ptr[r],rcv_node.begin()+rcv_ptr[r+1]);
+    if(nbr.empty()){
+      nbr.push_back(node_lo + r); // keep a diagonal entry for unconnected nodes
+    }
+    sort(nbr.begin(),nbr.end());
+    nbr.erase(unique(nbr.begin(),nbr.end()),nbr.end());
+    for(size_t k = 0; k < nbr.size(); k++){
+      if(nbr[k] < node_lo || nbr[k] >= node_hi){
+        ghosts.push_back(nbr[k]);
+      }
+    }
+    own_node.insert(own_node.end(),nbr.begin(),nbr.end());
+    own_ptr[r+1] = own_node.size();
+  }
+  ghosts.insert(ghosts.end(),ghost_node.begin(),ghost_node.end());
+  sort(ghosts.begin(),ghosts.end());
+  ghosts.erase(unique(ghosts.begin(),ghosts.end()),ghosts.end());
+
+  // graph of the local nodes: owned rows, then ghost rows (empty for the
+  // neighbours of owned nodes that no local element touches)
+  adj_ptr.swap(own_ptr);
+  adj_node.swap(own_node);
+  adj_ptr.resize(nlocal + ghosts.size() + 1);
+  for(size_t g = 0, h = 0; g < ghosts.size(); g++){
+    if(h < ghost_node.size() && ghost_node[h] == ghosts[g]){
+      const int r = nlocal + h++;
+      adj_node.insert(adj_node.end(),loc_node.begin()+loc_ptr[r],loc_node.begin()+loc_ptr[r+1]);
+    }
+    adj_ptr[nlocal+g+1] = adj_node.size();
+  }
+  ghost_node.swap(ghosts);
+}
+
+
+/* exact per-node-block nonzero counts for the block rows owned by this process */
+void PreProcessor :: Preallocate_Stiffness_Matrix(){
+
+  if(adj_ptr.empty()){
+    Compute_Node_Graph();
+  }
+
+  const int nlocal = node_hi - node_lo;
 
-  /* initialize K matrix */
   MatCreate(PETSC_COMM_WORLD,&KMat);
-  MatSetSizes(KMat,PETSC_DECIDE,PETSC_DECIDE,GDof,GDof);
+  MatSetSizes(KMat,2*nlocal,2*nlocal,GDof,GDof);
+  MatSetBlockSize(KMat,2);
+  if(MFormat == K_BAIJ){
+    MatSetType(KMat,MATBAIJ);
+  }else if(MFormat == K_SBAIJ){
+    MatSetType(KMat,MATSBAIJ);
+  }else{
+    MatSetType(KMat,MATAIJ);
+  }
   MatSetFromOptions(KMat);
-  MatSetUp(KMat);
-  MatZeroEntries(KMat);
+
+  // -mat_type may have overridden the requested format
+  MatType mtype;
+  MatGetType(KMat,&mtype);
+  Sym_Storage = (strstr(mtype,"sbaij") != NULL);
+  Mark_Fixed_Nodes();
+
+  // couplings of eliminated nodes are never inserted, their rows hold the diagonal only
+  vector<PetscInt> d_nnz(nlocal), o_nnz(nlocal), du_nnz(nlocal), ou_nnz(nlocal);
+
+  for(int n = node_lo; n < node_hi; n++){
+    const int r = n - node_lo;
+    int d = 0, o = 0, du = 0, ou = 0;
+    for(int k = adj_ptr[r]; k < adj_ptr[r+1]; k++){
+      const int m = adj_node[k];
+      if((fixed_node[r] || fixed_node[Local_Node(m)]) && m != n){
+        continue;
+      }
+      if(m >= node_lo && m < node_hi){
+        d++;
+        if(m >= n) du++;
+      }else{
+        o++;
+        if(m >= node_hi) ou++;
+      }
+    }
+    d_nnz[r] = d;
+    o_nnz[r] = o;
+    du_nnz[r] = du;
+    ou_nnz[r] = ou;
+  }
+
+  // counts are per 2x2 node block, AIJ expands them to scalar rows
+  MatXAIJSetPreallocation(KMat,2,&d_nnz[0],&o_nnz[0],&du_nnz[0],&ou_nnz[0]);
+  MatSetOption(KMat,MAT_NEW_NONZERO_ALLOCATION_ERR,PETSC_TRUE);
+  // zeroed rows keep their entries, so the matrix can be assembled again
+  MatSetOption(KMat,MAT_KEEP_NONZERO_PATTERN,PETSC_TRUE);
+  if(Sym_Storage){
+    MatSetOption(KMat,MAT_IGNORE_LOWER_TRIANGULAR,PETSC_TRUE);
+  }
+}
+
+
+
+/*
+ * Rows cannot be zeroed in symmetric storage, and zeroing rows only breaks
+ * symmetry, so unless the constraints are BC_ZERO_ROWS on a nonsymmetric
+ * format the fixed nodes are dropped from the element matrices during
+ * assembly and get an identity block instead. The owned equations of the
+ * FIXED nodes are listed in every mode, for the rows and the load vectors.
+ */
+void PreProcessor :: Mark_Fixed_Nodes(){
+  fixed_node.assign(Local_Nodes(),0);
+  fixed_rows.clear();
+  for(size_t s = 0; s < mesh->Selections(); s++){
+    if(mesh->selection[s] == "FIXED"){
+      const Node_List nodes = mesh->Selection(s);
+      for(size_t bc = 0; bc < nodes.size(); bc++){
+        const int n = node_perm[nodes[bc]-1];
+        if(n >= node_lo && n < node_hi){
+          fixed_rows.push_back(n*2);      // u displacement
+          fixed_rows.push_back(n*2 + 1);  // v displacement
+        }
+        const int r = Local_Node(n);
+        if(Symmetric_System() && r >= 0){
+          fixed_node[r] = 1;
+        }
+      }
+    }
+  }
+}
+
+
+/* greedy coloring in element order: elements of one color share no node */
+void PreProcessor :: Compute_Element_Colors(){
+
+  const size_t nelem = elem_local.size();
+  vector<unsigned long long> node_colors(Local_Nodes(),0);
+  vector<int> color(nelem);
+  int ncolor = 0;
+
+  for(size_t e = 0; e < nelem; e++){
+    const Node_List fn = mesh->Element(elem_local[e]);
+    unsigned long long used = 0;
+    int r[QUAD_MAX_NODES];
+    for(size_t a = 0; a < fn.size(); a++){
+      r[a] = Local_Node(node_perm[fn[a]-1]);
+      used |= node_colors[r[a]];
+    }
+    int c = 0;
+    while(used & (1ULL << c)){
+      c++;
+    }
+    assert(c < 64);
+    color[e] = c;
+    ncolor = max(ncolor,c+1);
+    for(size_t a = 0; a < fn.size(); a++){
+      node_colors[r[a]] |= (1ULL << c);
+    }
+  }
+
+  // group elements by color, keeping element order within a color
+  color_ptr.assign(ncolor+1,0);
+  for(size_t e = 0; e < nelem; e++){
+    color_ptr[color[e]+1]++;
+  }
+  for(int c = 0; c < ncolor; c++){
+    color_ptr[c+1] += color_ptr[c];
+  }
+  color_elem.resize(nelem);
+  vector<int> fill(color_ptr.begin(),color_ptr.end()-1);
+  for(size_t e = 0; e < nelem; e++){
+    color_elem[fill[color[e]]++] = e;
+  }
+
+  PetscPrintf(PETSC_COMM_WORLD,"Element coloring: %d colors\n",ncolor);
+}
+
+
+/* add the rows of local element e into K_csr */
+void PreProcessor :: Scatter_Element_Stiffness(size_t e){
+
+  const int* P = stiffness.Equations(e);
+  const int ndof = stiffness.DOF(e), nblock = ndof/2;
+  double K[QUAD_DOF(QUAD_MAX_NODES)*QUAD_DOF(QUAD_MAX_NODES)];
+  stiffness.Unpack(e,K);
+
+  for(int a = 0; a < nblock; a++){
+    const int n = Local_Node(P[2*a]/2);
+    const int* row = &adj_node[adj_ptr[n]];
+    const int deg = adj_ptr[n+1] - adj_ptr[n];
+    double* slab = &K_csr[4*row_index[n]];
+
+    for(int b = 0; b < nblock; b++){
+      const int k = lower_bound(row,row+deg,P[2*b]/2) - row;
+      for(int bi = 0; bi < 2; bi++){
+        for(int bj = 0; bj < 2; bj++){
+          slab[bi*2*deg + 2*k + bj] += K[(2*a+bi)*ndof + 2*b+bj];
+        }
+      }
+    }
+  }
+}
+
+
+/*
+ * Threaded assembly: colors are processed one after the other and the
+ * elements of a color in parallel, so every entry receives its contributions
+ * in color order whatever the number of threads. The block rows touched by
+ * local elements are then inserted into KMat one row at a time, rows of
+ * off-process nodes are sent to their owner by the matrix assembly.
+ */
+void PreProcessor :: Assemble_Colored(){
+
+  if(color_ptr.empty()){
+    Compute_Element_Colors();
+  }
+
+  // block row offsets of the local nodes touched by local elements
+  vector<int> rows;
+  if(row_index.empty()){
+    row_index.assign(Local_Nodes(),-1);
+    for(size_t e = 0; e < stiffness.size(); e++){
+      const int* P = stiffness.Equations(e);
+      for(int a = 0; a < stiffness.DOF(e)/2; a++){
+        row_index[Local_Node(P[2*a]/2)] = 0;
+      }
+    }
+    int off = 0;
+    for(size_t r = 0; r < row_index.size(); r++){
+      if(row_index[r] == 0){
+        row_index[r] = off;
+        off += adj_ptr[r+1] - adj_ptr[r];
+      }
+    }
+  }
+  int nslab = 0;
+  for(size_t r = 0; r < row_index.size(); r++){
+    if(row_index[r] >= 0){
+      rows.push_back(r);
+      nslab += adj_ptr[r+1] - adj_ptr[r];
+    }
+  }
+
+  K_csr.assign(4*nslab,0.0);
+  for(size_t c = 0; c + 1 < color_ptr.size(); c++){
+#pragma omp parallel for num_threads(Num_Threads) schedule(static)
+    for(long k = color_ptr[c]; k < color_ptr[c+1]; k++){
+      Scatter_Element_Stiffness(color_elem[k]);
+    }
+  }
+
+  vector<int> cols;
+  for(size_t i = 0; i < rows.size(); i++){
+    const int r = rows[i], n = Global_Node(r);
+    if(fixed_node[r]){
+      continue;
+    }
+    const int deg = adj_ptr[r+1] - adj_ptr[r];
+    cols.resize(deg);
+    for(int k = 0; k < deg; k++){
+      const int m = adj_node[adj_ptr[r]+k];
+      cols[k] = fixed_node[Local_Node(m)] ? -1 : m; // negative indices are ignored
+    }
+    MatSetValuesBlocked(KMat,1,&n,deg,&cols[0],&K_csr[4*row_index[r]],ADD_VALUES);
+  }
+}
+
+
+
+/*
+ * Matrix-free operator: KMat becomes a shell matrix over KShell. Its fixed
+ * nodes are always eliminated symmetrically, as rows cannot be zeroed and
+ * submatrices cannot be extracted from a shell matrix.
+ */
+void PreProcessor :: Create_Shell_Operator(){
+
+  if(CMode == BC_ELIMINATE){
+    PetscPrintf(PETSC_COMM_WORLD,"Matrix-free operator: eliminated constraints not available, using symmetric constraints\n");
+    CMode = BC_SYMMETRIC;
+  }
+  Mark_Fixed_Nodes();
+  if(Num_Threads > 0 && color_ptr.empty()){
+    Compute_Element_Colors();
+  }
+  vector<PetscInt> fixed;
+  for(int r = 0; r < Local_Nodes(); r++){
+    if(fixed_node[r]){
+      fixed.push_back(Global_Node(r));
+    }
+  }
+  sort(fixed.begin(),fixed.end());
+  MatDestroy(&KMat);
+  KShell->Create(fixed,GDof,node_lo,node_hi,Num_Threads,&color_ptr,&color_elem,&KMat);
+
+  double bytes = KShell->Bytes();
+  MPI_Allreduce(MPI_IN_PLACE,&bytes,1,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+  PetscPrintf(PETSC_COMM_WORLD,"Stiffness operator (matrix-free, %s): %g bytes, %g bytes per element\n",
+              KShell->Recompute() ? "element matrices recomputed" : "element matrices stored",
+              bytes,bytes/mesh->Elements());
+}
+
+
+void PreProcessor :: Assemble_Stiffness_Matrix(){
+  Profile_Stage stage("Assembly");
+
+  if(Matrix_Free()){
+    assert(KShell != NULL);
+    Create_Shell_Operator();
+    return;
+  }
+  assert(stiffness.size() != 0);
+
+  /* initialize K matrix with exact preallocation, no assembly before insertion
+   * as that would squeeze out the unused preallocated space. A second call
+   * keeps the assembled nonzero pattern (rows zeroed for the constraints
+   * included, see MAT_KEEP_NONZERO_PATTERN) and only refills the values. */
+  if(KMat == NULL){
+    Preallocate_Stiffness_Matrix();
+  }else{
+    MatZeroEntries(KMat);
+  }
+
+  if(Num_Threads > 0){
+    Assemble_Colored();
+  }else{
+    /* numeric phase: one blocked insertion per element matrix */
+    double K[QUAD_DOF(QUAD_MAX_NODES)*QUAD_DOF(QUAD_MAX_NODES)];
+    for(size_t e = 0; e < stiffness.size(); e++){
+      const int* P = stiffness.Equations(e);
+      int nblock = stiffness.DOF(e)/2;
+      int idx[nblock];
+
+      for(int a = 0; a < nblock; a++){
+        idx[a] = fixed_node[Local_Node(P[2*a]/2)] ? -1 : P[2*a]/2; // negative indices are ignored
+      }
+      stiffness.Unpack(e,K);
+      MatSetValuesBlocked(KMat,nblock,idx,nblock,idx,K,ADD_VALUES);
+    }
+  }
+
+  const double identity[4] = {1.0, 0.0, 0.0, 1.0};
+  for(int n = node_lo; n < node_hi; n++){
+    if(fixed_node[n-node_lo]){
+      MatSetValuesBlocked(KMat,1,&n,1,&n,identity,ADD_VALUES);
+    }
+  }
+
   MatAssemblyBegin(KMat,MAT_FINAL_ASSEMBLY);
   MatAssemblyEnd(KMat,MAT_FINAL_ASSEMBLY);
 
-  for(size_t e = 0; e < element.size(); e++){
-    const int*  P = stiffness[e]->Get_P();
-    double** K = stiffness[e]->Get_K();
-    int K_size = stiffness[e]->Get_K_size();
+  MatType mtype;
+  MatInfo info;
+  MatGetType(KMat,&mtype);
+  MatGetInfo(KMat,MAT_GLOBAL_SUM,&info);
+  PetscPrintf(PETSC_COMM_WORLD,"Stiffness matrix (%s): %g nonzeros, %g bytes, %g mallocs during assembly\n",
+              mtype,info.nz_used,info.memory,info.mallocs);
+
+  //WriteMat(KMat,"KMat");
+
+}
 
-    for(int z = 0; z < K_size; z++){
-      MatSetValues(KMat,1,&P[z],K_size,P,K[z],ADD_VALUES);
+
+/* time the threaded element setup, stiffness and assembly for 1, 2, 4, ...
+ * threads and check that the assembled values are bitwise identical */
+void PreProcessor :: Benchmark_Threads(){
+
+  assert(!Matrix_Free());
+  int maxthreads = 1;
+#ifdef _OPENMP
+  maxthreads = omp_get_max_threads();
+#endif
+  const int nthreads_saved = Num_Threads;
+  vector<double> K_ref;
+  double t_ref = 0.0;
+
+  PetscPrintf(PETSC_COMM_WORLD,"%8s %12s %12s %12s %12s %8s %10s\n",
+              "threads","setup(s)","stiff(s)","assem(s)","total(s)","speedup","identical");
+  for(int nt = 1; ; nt = min(2*nt,maxthreads)){
+    PetscLogDouble t0, t1, t2, t3;
+    Num_Threads = nt;
+    PetscTime(&t0);
+    Compute_Element_properties();
+    PetscTime(&t1);
+    Compute_Element_stiffness();
+    PetscTime(&t2);
+    Assemble_Stiffness_Matrix();
+    PetscTime(&t3);
+
+    bool identical = true;
+    if(nt == 1){
+      K_ref = K_csr;
+      t_ref = t3-t0;
+    }else{
+      identical = (K_ref.size() == K_csr.size()) &&
+                  memcmp(&K_ref[0],&K_csr[0],K_csr.size()*sizeof(double)) == 0;
+    }
+    PetscPrintf(PETSC_COMM_WORLD,"%8d %12.4e %12.4e %12.4e %12.4e %8.2f %10s\n",
+                nt,t1-t0,t2-t1,t3-t2,t3-t0,t_ref/(t3-t0),identical ? "yes" : "NO");
+    if(nt == maxthreads){
+      break;
     }
   }
+  Num_Threads = nthreads_saved;
+}
 
+
+/*
+ * Matrix-free operator against the assembled matrix: the same element
+ * matrices are assembled into an AIJ matrix, then memory, build time and the
+ * time of nrepeat products are compared, as well as the products themselves.
+ */
+void PreProcessor :: Benchmark_Matrix_Free(int nrepeat){
+
+  assert(Matrix_Free() && KMat != NULL);
+  Mat Shell = KMat;
+  PetscLogDouble t0, t1, t2, t3;
+
+  // KMat is borrowed for the preallocation, the format falls back to AIJ
+  KMat = NULL;
+  PetscTime(&t0);
+  Preallocate_Stiffness_Matrix();
+  KShell->Assemble(KMat);
   MatAssemblyBegin(KMat,MAT_FINAL_ASSEMBLY);
   MatAssemblyEnd(KMat,MAT_FINAL_ASSEMBLY);
+  PetscTime(&t1);
+  const double build_time = t1-t0;
+  Mat Assembled = KMat;
+  KMat = Shell;
 
-  //WriteMat(KMat,"KMat");
+  Vec x, y_asm, y_shell;
+  MatCreateVecs(Shell,&x,&y_asm);
+  VecDuplicate(y_asm,&y_shell);
+  PetscInt lo, n;
+  PetscScalar* _x;
+  VecGetOwnershipRange(x,&lo,NULL);
+  VecGetLocalSize(x,&n);
+  VecGetArray(x,&_x);
+  for(PetscInt i = 0; i < n; i++){
+    _x[i] = sin(0.37*(lo+i));
+  }
+  VecRestoreArray(x,&_x);
 
+  PetscTime(&t1);
+  for(int r = 0; r < nrepeat; r++){
+    MatMult(Assembled,x,y_asm);
+  }
+  PetscTime(&t2);
+  for(int r = 0; r < nrepeat; r++){
+    MatMult(Shell,x,y_shell);
+  }
+  PetscTime(&t3);
+
+  double ymax, diff;
+  VecNorm(y_asm,NORM_INFINITY,&ymax);
+  VecAXPY(y_shell,-1.0,y_asm);
+  VecNorm(y_shell,NORM_INFINITY,&diff);
+
+  MatInfo info;
+  MatGetInfo(Assembled,MAT_GLOBAL_SUM,&info);
+  double bytes = KShell->Bytes();
+  MPI_Allreduce(MPI_IN_PLACE,&bytes,1,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+  double shell_time = KShell->Setup_Time();
+  MPI_Allreduce(MPI_IN_PLACE,&shell_time,1,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD);
+
+  PetscPrintf(PETSC_COMM_WORLD,"Matrix-free benchmark (%d products):  %14s %14s\n",nrepeat,"assembled","matrix-free");
+  PetscPrintf(PETSC_COMM_WORLD,"  %-32s %14g %14g\n","bytes",info.memory,bytes);
+  PetscPrintf(PETSC_COMM_WORLD,"  %-32s %14.4e %14.4e\n","build (s)",build_time,shell_time);
+  PetscPrintf(PETSC_COMM_WORLD,"  %-32s %14.4e %14.4e\n","MatMult (s)",(t2-t1)/nrepeat,(t3-t2)/nrepeat);
+  PetscPrintf(PETSC_COMM_WORLD,"  max relative difference %g\n",diff/ymax);
+
+  VecDestroy(&x);
+  VecDestroy(&y_asm);
+  VecDestroy(&y_shell);
+  MatDestroy(&Assembled);
 }
 
 
-void PreProcessor :: Apply_BC(){
+/*
+ * Parameter sweep: with C = E/(1-nu^2) (C_a + nu C_b), C_a = diag(1,1,1/2)
+ * and C_b = [0 1 0; 1 0 0; 0 0 -1/2], every element matrix is linear in E,
+ * thickness and C, so the constrained system of any (E, nu, thickness) is
+ * E t/(1-nu^2) (K_a + nu K_b) with K_a, K_b assembled once for E = 1 and unit
+ * thickness. Both keep the nonzero pattern of the solved matrix (KMat, or
+ * KFree under BC_ELIMINATE). The geometry is reused; the element matrices are
+ * recomputed for the material at the end, the solved matrix is set for it.
+ */
+void PreProcessor :: Setup_Parameter_Sweep(){
+  Profile_Stage stage("Sweep setup");
+
+  assert(!Matrix_Free());
+  const double Ca[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 0.5}};
+  const double Cb[3][3] = {{0.0, 1.0, 0.0}, {1.0, 0.0, 0.0}, {0.0, 0.0, -0.5}};
+  const double* Cunit[2][3] = {{Ca[0], Ca[1], Ca[2]}, {Cb[0], Cb[1], Cb[2]}};
+
+  for(int k = 0; k < 2; k++){
+    Compute_Element_stiffness(Cunit[k],1.0);
+    Assemble_Stiffness_Matrix();
+    Constrain_Stiffness_Matrix();
+    MatDestroy(&K_unit[k]);
+    MatDuplicate(KFree ? KFree : KMat,MAT_COPY_VALUES,&K_unit[k]);
+  }
+
+  Compute_Element_stiffness();
+  Set_Sweep_Parameters(material->E,material->nu,mesh->Get_Thickness());
+}
+
+
+/* solved matrix for Young's modulus E, Poisson's ratio nu and thickness t;
+ * the rows of fixed nodes become E t/(1-nu) times the identity */
+void PreProcessor :: Set_Sweep_Parameters(double E, double nu, double t){
+  Profile_Stage stage("Sweep update");
+
+  assert(K_unit[0] != NULL && nu > -1.0 && nu < 1.0);
+  Mat K = KFree ? KFree : KMat;
+  MatCopy(K_unit[0],K,SAME_NONZERO_PATTERN);
+  MatAXPY(K,nu,K_unit[1],SAME_NONZERO_PATTERN);
+  MatScale(K,E*t/(1.0-nu*nu));
+}
 
-  VecCreate(PETSC_COMM_WORLD,&RHS);
-  VecSetSizes(RHS,PETSC_DECIDE,GDof);
-  VecSetFromOptions(RHS);
-  VecSet(RHS,0.0);
-  //VecDuplicate(RHS,&Solution);
 
-  PetscReal *_RHS;
-  VecGetArray(RHS,&_RHS);
+/*
+ * Load vector of one case in equation numbering. Every process adds the
+ * forces on its own nodes, forces on one node add up.
+ */
+void PreProcessor :: Build_Load_Vector(Load_Case const& lc, Vec F) const {
 
-  // apply point load bc
-  for(size_t i = 0; i < mesh->boundary.size(); i++){
-    if(mesh->boundary[i].name == "POINT_LOAD"){
-      int BCnode = mesh->boundary[i].nodes[0];
-      int BCP = (BCnode-1)*2 + 1;
-      _RHS[BCP] = Point_Load;
+  VecSet(F,0.0);
+  for(size_t i = 0; i < lc.node.size(); i++){
+    const int n = node_perm[lc.node[i]-1];
+    if(n >= node_lo && n < node_hi){
+      VecSetValue(F,2*n,lc.fx[i],ADD_VALUES);
+      VecSetValue(F,2*n+1,lc.fy[i],ADD_VALUES);
     }
   }
-  VecRestoreArray(RHS,&_RHS);
+  VecAssemblyBegin(F);
+  VecAssemblyEnd(F);
 
-  // apply fixed (zero displacement bc)
-  for(size_t i = 0; i < mesh->boundary.size(); i++){
-    if(mesh->boundary[i].name == "FIXED"){
+  // fixed nodes: K u = 0 on their identity rows keeps u = 0, with no other
+  // correction of the RHS as the prescribed displacements are zero
+  const vector<PetscScalar> zero(fixed_rows.size(),0.0);
+  VecSetValues(F,fixed_rows.size(),fixed_rows.data(),zero.data(),INSERT_VALUES);
+  VecAssemblyBegin(F);
+  VecAssemblyEnd(F);
+}
 
-      int fixed_node[mesh->boundary[i].nodes.size()];
-      for(size_t bc = 0; bc < mesh->boundary[i].nodes.size(); bc++){
-        fixed_node[bc] = mesh->boundary[i].nodes[bc];
-      }
-      // find row number in global stiffness matrix to apply bc
-      int rows[2*mesh->boundary[i].nodes.size()];
-      for(size_t bc = 0; bc < mesh->boundary[i].nodes.size(); bc++){
-        rows[bc*2] = (fixed_node[bc]-1)*2; // u displacement
-        rows[bc*2+1] = rows[bc*2] + 1;     // v displacement
-        //cout << fixed_node[i] << "\t" << rows[i*2] << "\t" << rows[i*2+1] << endl;
-      }
-      // make all entries zero and put 1 on diagonal
-      MatZeroRows(KMat,2*mesh->boundary[i].nodes.size(),rows,1.0,NULL,NULL);
 
+/* x,y of the nodes whose unknowns the solved system holds (owned nodes, free
+ * ones only under BC_ELIMINATE), interlaced with block size 2 */
+void PreProcessor :: Create_Coordinates(Vec* coords) const {
+
+  vector<int> nodes;
+  for(int n = node_lo; n < node_hi; n++){
+    if(!(KFree && fixed_node[n-node_lo])){
+      nodes.push_back(n);
     }
   }
+  VecCreate(PETSC_COMM_WORLD,coords);
+  VecSetSizes(*coords,2*nodes.size(),PETSC_DECIDE);
+  VecSetBlockSize(*coords,2);
+  VecSetFromOptions(*coords);
+
+  PetscScalar* _c;
+  VecGetArray(*coords,&_c);
+  for(size_t i = 0; i < nodes.size(); i++){
+    _c[2*i] = mesh->x[node_iperm[nodes[i]]];
+    _c[2*i+1] = mesh->y[node_iperm[nodes[i]]];
+  }
+  VecRestoreArray(*coords,&_c);
+}
+
+
+void PreProcessor :: Apply_BC(){
+  Profile_Stage stage("Boundary conditions");
+
+  if(RHS == NULL){
+    VecCreate(PETSC_COMM_WORLD,&RHS);
+    VecSetSizes(RHS,2*(node_hi-node_lo),GDof);
+    VecSetBlockSize(RHS,2);
+    VecSetFromOptions(RHS);
+  }
+
+  // point load bc: v load on the first node of POINT_LOAD
+  Load_Case point("POINT_LOAD");
+  for(size_t s = 0; s < mesh->Selections(); s++){
+    if(mesh->selection[s] == "POINT_LOAD"){
+      point.Add_Force(mesh->Selection(s)[0],0.0,Point_Load);
+    }
+  }
+  Build_Load_Vector(point,RHS);
+
+  Constrain_Stiffness_Matrix();
 
 //  WriteMat(KMat,"KMat");
 //  WriteVec(RHS,"RHS");
@@ -195,10 +1416,107 @@ void PreProcessor :: Apply_BC(){
 }
 
 
+/* zero displacement at the FIXED nodes: rows zeroed (BC_ZERO_ROWS) or reduced
+ * system extracted (BC_ELIMINATE); nothing left to do for BC_SYMMETRIC */
+void PreProcessor :: Constrain_Stiffness_Matrix(){
+
+  // apply fixed (zero displacement bc), every process zeroes its own rows:
+  // make all entries zero and put 1 on diagonal
+  if(!Symmetric_System()){
+    MatZeroRows(KMat,fixed_rows.size(),fixed_rows.data(),1.0,NULL,NULL);
+  }
+
+  // reduced system of the owned free DOFs; the full matrix is released and
+  // preallocated again if the stiffness is reassembled
+  if(CMode == BC_ELIMINATE){
+    vector<PetscInt> free_node;
+    for(int n = node_lo; n < node_hi; n++){
+      if(!fixed_node[n-node_lo]){
+        free_node.push_back(n);
+      }
+    }
+    ISDestroy(&Free_DOF);
+    MatDestroy(&KFree);
+    // whole nodes, so the block formats keep their 2x2 blocks
+    ISCreateBlock(PETSC_COMM_WORLD,2,free_node.size(),free_node.data(),PETSC_COPY_VALUES,&Free_DOF);
+    MatCreateSubMatrix(KMat,Free_DOF,Free_DOF,MAT_INITIAL_MATRIX,&KFree);
+    MatDestroy(&KMat);
+
+    MatInfo info;
+    PetscInt nfree;
+    MatGetSize(KFree,&nfree,NULL);
+    MatGetInfo(KFree,MAT_GLOBAL_SUM,&info);
+    PetscPrintf(PETSC_COMM_WORLD,"Reduced stiffness matrix: %d free DOFs, %g nonzeros, %g bytes\n",
+                nfree,info.nz_used,info.memory);
+  }
+}
+
+
 void PreProcessor :: set_pointload(double pl){
   Point_Load = pl;
 }
 
 
+void PreProcessor :: Add_Load_Case(Load_Case const& lc){
+  load_case.push_back(lc);
+}
+
+
+/*
+ * Load case file, one force per line: case name, node id, fx, fy. Lines of
+ * one name form one case, in order of first appearance; # starts a comment.
+ */
+void PreProcessor :: Read_Load_Cases(string const& filename){
+
+  ifstream lfile(filename);
+  assert(lfile.is_open());
+
+  string line;
+  while(getline(lfile,line)){
+    line = line.substr(0,line.find('#'));
+    istringstream record(line);
+    string name;
+    int id;
+    double fx, fy;
+    if(!(record >> name)){
+      continue;
+    }
+    if(!(record >> id >> fx >> fy)){
+      cerr << "ERROR in load case file " << filename << ": " << line << endl;
+      continue;
+    }
+    assert(id >= 1 && id <= int(mesh->Nodes()));
+
+    size_t c = 0;
+    while(c < load_case.size() && load_case[c].name != name){
+      c++;
+    }
+    if(c == load_case.size()){
+      load_case.push_back(Load_Case(name));
+    }
+    load_case[c].Add_Force(id,fx,fy);
+  }
+  PetscPrintf(PETSC_COMM_WORLD,"Load cases read from %s: %d\n",filename.c_str(),int(load_case.size()));
+}
+
+
+size_t PreProcessor :: Num_Elements() const {
+  return mesh->Elements();
+}
+
+size_t PreProcessor :: Num_DOF() const {
+  return GDof;
+}
+
+
+size_t PreProcessor :: Num_Load_Cases() const {
+  return load_case.size();
+}
+
+Load_Case const& PreProcessor :: Get_Load_Case(size_t c) const {
+  return load_case[c];
+}
+
+
 
 #endif // PREPROCESSOR_HPP
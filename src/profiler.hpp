@@ -0,0 +1,297 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cassert>
+#include "petscksp.h"
+
+using namespace std;
+
+
+/*
+ * Allocation counters, fed by the replacements of the global operator new
+ * below when built with -DPROFILE_ALLOCATIONS (the program is one
+ * translation unit, so they are defined here). Only C++ allocations are
+ * counted; PETSc objects show up in the RSS. Without the flag the counts
+ * are not kept and the report leaves them out.
+ */
+struct Allocation_Count{
+  static atomic<size_t>& Calls(){ static atomic<size_t> n(0); return n; }
+  static atomic<size_t>& Bytes(){ static atomic<size_t> n(0); return n; }
+#ifdef PROFILE_ALLOCATIONS
+  static bool Enabled(){ return true; }
+#else
+  static bool Enabled(){ return false; }
+#endif
+
+  /* counted malloc / posix_memalign, NULL on failure */
+  static void* Allocate(size_t size, size_t align = 0){
+    Calls().fetch_add(1,memory_order_relaxed);
+    Bytes().fetch_add(size,memory_order_relaxed);
+    if(align <= alignof(max_align_t)){
+      return malloc(size ? size : 1);
+    }
+    void* p = NULL;
+    return posix_memalign(&p,align,size ? size : 1) == 0 ? p : NULL;
+  }
+
+  /* kept out of line: a free() inlined into the callers of delete reads to
+   * the compiler as a mismatched deallocation */
+  __attribute__((noinline)) static void Release(void* p){
+    free(p);
+  }
+};
+
+#ifdef PROFILE_ALLOCATIONS
+/* the complete set, so that every form of new is matched by its delete */
+void* operator new(size_t size){
+  if(void* p = Allocation_Count::Allocate(size)){
+    return p;
+  }
+  throw bad_alloc();
+}
+void* operator new[](size_t size){
+  if(void* p = Allocation_Count::Allocate(size)){
+    return p;
+  }
+  throw bad_alloc();
+}
+void* operator new(size_t size, align_val_t a){
+  if(void* p = Allocation_Count::Allocate(size,size_t(a))){
+    return p;
+  }
+  throw bad_alloc();
+}
+void* operator new[](size_t size, align_val_t a){
+  if(void* p = Allocation_Count::Allocate(size,size_t(a))){
+    return p;
+  }
+  throw bad_alloc();
+}
+void* operator new(size_t size, const nothrow_t&) noexcept { return Allocation_Count::Allocate(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return Allocation_Count::Allocate(size); }
+void* operator new(size_t size, align_val_t a, const nothrow_t&) noexcept { return Allocation_Count::Allocate(size,size_t(a)); }
+void* operator new[](size_t size, align_val_t a, const nothrow_t&) noexcept { return Allocation_Count::Allocate(size,size_t(a)); }
+
+void operator delete(void* p) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p) noexcept { Allocation_Count::Release(p); }
+void operator delete(void* p, size_t) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p, size_t) noexcept { Allocation_Count::Release(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { Allocation_Count::Release(p); }
+void operator delete(void* p, align_val_t) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p, align_val_t) noexcept { Allocation_Count::Release(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { Allocation_Count::Release(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { Allocation_Count::Release(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { Allocation_Count::Release(p); }
+#endif
+
+
+/*
+ * CLASS PROFILER -> named stages of the pipeline, each a PETSc log stage
+ * (so -log_view breaks down by the same stages). For every stage: calls,
+ * wall time, counted flops of the element kernels, C++ allocations and
+ * bytes (with PROFILE_ALLOCATIONS), and the growth of the peak resident set. Stages may nest, the
+ * numbers of a stage include those of its inner stages.
+ */
+class Profiler{
+private:
+  typedef struct {
+    string name, parent;
+    PetscLogStage stage;
+    int calls;
+    double time, flops;
+    size_t allocs, alloc_bytes;
+    long peak_rss_delta;            // bytes
+    long rss;                       // resident set at the end of the last call, bytes
+  } Stage_Record;
+
+  typedef struct {
+    int id;
+    double time, flops;
+    size_t allocs, alloc_bytes;
+    long peak_rss;
+  } Open_Stage;
+
+  vector<Stage_Record> stages;
+  vector<Open_Stage> open;
+  double flops;                     // counted so far
+  double start;
+
+  Profiler() : flops(0.0) { PetscTime(&start); }
+
+public:
+  static Profiler& Instance(){
+    static Profiler p;
+    return p;
+  }
+
+  /* peak resident set of the process so far, bytes */
+  static long Peak_RSS(){
+    struct rusage r;
+    getrusage(RUSAGE_SELF,&r);
+    return r.ru_maxrss*1024L;
+  }
+
+  /* current resident set, bytes */
+  static long Current_RSS(){
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm","r");
+    if(f != NULL){
+      if(fscanf(f,"%ld %ld",&pages,&resident) != 2){
+        resident = 0;
+      }
+      fclose(f);
+    }
+    return resident*sysconf(_SC_PAGESIZE);
+  }
+
+  /* flops of the kernels, outside threaded regions */
+  void Add_Flops(double n){
+    flops += n;
+    PetscLogFlops(n);
+  }
+
+  void Begin(const char*);
+  void End();
+  void Print() const;
+  void Write_JSON(string const&) const;
+};
+
+
+/* the stage of the enclosing scope */
+class Profile_Stage{
+public:
+  Profile_Stage(const char* name){ Profiler::Instance().Begin(name); }
+  ~Profile_Stage(){ Profiler::Instance().End(); }
+};
+
+
+/******************* Functions **************************/
+
+void Profiler :: Begin(const char* name){
+
+  size_t id = 0;
+  while(id < stages.size() && stages[id].name != name){
+    id++;
+  }
+  if(id == stages.size()){
+    Stage_Record s;
+    s.name = name;
+    s.parent = open.empty() ? "" : stages[open.back().id].name;
+    PetscLogStageRegister(name,&s.stage);
+    s.calls = 0;
+    s.time = s.flops = 0.0;
+    s.allocs = s.alloc_bytes = 0;
+    s.peak_rss_delta = s.rss = 0;
+    stages.push_back(s);
+  }
+  PetscLogStagePush(stages[id].stage);
+
+  Open_Stage o;
+  o.id = id;
+  PetscTime(&o.time);
+  o.flops = flops;
+  o.allocs = Allocation_Count::Calls().load();
+  o.alloc_bytes = Allocation_Count::Bytes().load();
+  o.peak_rss = Peak_RSS();
+  open.push_back(o);
+}
+
+
+void Profiler :: End(){
+
+  assert(!open.empty());
+  const Open_Stage& o = open.back();
+  Stage_Record& s = stages[o.id];
+  double t;
+  PetscTime(&t);
+  s.calls++;
+  s.time += t - o.time;
+  s.flops += flops - o.flops;
+  s.allocs += Allocation_Count::Calls().load() - o.allocs;
+  s.alloc_bytes += Allocation_Count::Bytes().load() - o.alloc_bytes;
+  s.peak_rss_delta += Peak_RSS() - o.peak_rss;
+  s.rss = Current_RSS();
+  open.pop_back();
+  PetscLogStagePop();
+}
+
+
+/* times are the maxima over the processes, counts and bytes their sums */
+void Profiler :: Print() const {
+
+  PetscPrintf(PETSC_COMM_WORLD,"\nProfile:\n%-22s %6s %12s %12s %10s %12s %12s\n",
+              "stage","calls","time(s)","Gflop/s","allocs","alloc(B)","peak RSS +(B)");
+  for(size_t i = 0; i < stages.size(); i++){
+    const Stage_Record& s = stages[i];
+    double v[2] = {s.time,(double)s.peak_rss_delta}, w[3] = {s.flops,(double)s.allocs,(double)s.alloc_bytes};
+    MPI_Allreduce(MPI_IN_PLACE,v,2,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE,w,3,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD);
+    char allocs[16] = "-", bytes[16] = "-";
+    if(Allocation_Count::Enabled()){
+      snprintf(allocs,sizeof(allocs),"%.0f",w[1]);
+      snprintf(bytes,sizeof(bytes),"%.0f",w[2]);
+    }
+    PetscPrintf(PETSC_COMM_WORLD,"%-22s %6d %12.4e %12.4e %10s %12s %12.0f\n",
+                (s.parent.empty() ? s.name : "  " + s.name).c_str(),s.calls,v[0],
+                v[0] > 0 ? 1e-9*w[0]/v[0] : 0.0,allocs,bytes,v[1]);
+  }
+}
+
+
+/*
+ * JSON report of all stages, reduced as in Print, written by the first
+ * process. Every process must have gone through the same stages.
+ */
+void Profiler :: Write_JSON(string const& filename) const {
+
+  PetscMPIInt rank, size;
+  MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+  MPI_Comm_size(PETSC_COMM_WORLD,&size);
+  double now;
+  PetscTime(&now);
+  double total[2] = {now-start,(double)Peak_RSS()};
+  MPI_Allreduce(MPI_IN_PLACE,total,2,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD);
+
+  ofstream out;
+  if(rank == 0){
+    out.open(filename);
+    assert(out.is_open());
+    out.precision(8);
+    out << "{\n  \"ranks\": " << size << ",\n  \"wall_time\": " << total[0]
+        << ",\n  \"peak_rss\": " << (long)total[1] << ",\n  \"stages\": [";
+  }
+  for(size_t i = 0; i < stages.size(); i++){
+    const Stage_Record& s = stages[i];
+    double v[3] = {s.time,(double)s.peak_rss_delta,(double)s.rss}, w[3] = {s.flops,(double)s.allocs,(double)s.alloc_bytes};
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : v,v,3,MPI_DOUBLE,MPI_MAX,0,PETSC_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : w,w,3,MPI_DOUBLE,MPI_SUM,0,PETSC_COMM_WORLD);
+    if(rank == 0){
+      out << (i ? "," : "") << "\n    {\"name\": \"" << s.name << "\", \"parent\": \"" << s.parent
+          << "\", \"calls\": " << s.calls << ", \"time\": " << v[0] << ", \"flops\": " << w[0];
+      if(Allocation_Count::Enabled()){
+        out << ", \"allocations\": " << (size_t)w[1] << ", \"allocated_bytes\": " << (size_t)w[2];
+      }
+      out << ", \"peak_rss_delta\": " << (long)v[1] << ", \"rss\": " << (long)v[2] << "}";
+    }
+  }
+  if(rank == 0){
+    out << "\n  ]\n}\n";
+    out.close();
+  }
+  PetscPrintf(PETSC_COMM_WORLD,"Profile written to %s\n",filename.c_str());
+}
+
+
+#endif // PROFILER_HPP
@@ -4,28 +4,115 @@
 #include <iostream>
 #include <cmath>
 #include <iomanip>
+#include <cstring>
+#include <cassert>
+
+// lapack routine : solves AX = B
+extern "C" {
+void dgesv_(int *n, int *nrhs,  double *a,  int  *lda,
+            int *ipivot, double *b, int *ldb, int *info);
+}
 
 using namespace std;
 
-typedef enum {Q2D_2point, Q2D_3point} Quadrature_Rule;
+/* Gauss rules for Quad4: 2x2 (full), 3x3, and 1 point (reduced, with
+ * hourglass stabilization) */
+typedef enum {Q2D_2point, Q2D_3point, Q2D_1point} Quadrature_Rule;
+static const char* const quadrature_rule_names[] = {"full","gauss3","reduced","Quadrature_Rule","Q2D_",NULL};
+
+
+/*
+ * Shape functions of the quadratic quadrilaterals on [-1,1]^2 and their xi
+ * and eta derivatives at one point, the node count a compile time constant.
+ * Nodes: the 4 corners counterclockwise from (-1,-1), the midsides of the
+ * edges 1-2, 2-3, 3-4, 4-1, then the centre (Quad9 only).
+ */
+template<int NN> struct Quad_Shape;
+
+static const double quad_xi_node[9]  = {-1.0,  1.0, 1.0, -1.0,  0.0, 1.0, 0.0, -1.0, 0.0};
+static const double quad_eta_node[9] = {-1.0, -1.0, 1.0,  1.0, -1.0, 0.0, 1.0,  0.0, 0.0};
+
+// serendipity: no centre node, complete quadratic plus xi^2 eta and xi eta^2
+template<> struct Quad_Shape<8>{
+  static void Eval(double xi, double eta, double* N, double* dN_dxi, double* dN_deta){
+    for(int a = 0; a < 4; a++){
+      const double xa = quad_xi_node[a], ea = quad_eta_node[a];
+      N[a]       = 0.25*(1.0+xi*xa)*(1.0+eta*ea)*(xi*xa+eta*ea-1.0);
+      dN_dxi[a]  = 0.25*xa*(1.0+eta*ea)*(2.0*xi*xa+eta*ea);
+      dN_deta[a] = 0.25*ea*(1.0+xi*xa)*(xi*xa+2.0*eta*ea);
+    }
+    for(int a = 4; a < 8; a++){
+      const double xa = quad_xi_node[a], ea = quad_eta_node[a];
+      if(xa == 0.0){
+        N[a]       = 0.5*(1.0-xi*xi)*(1.0+eta*ea);
+        dN_dxi[a]  = -xi*(1.0+eta*ea);
+        dN_deta[a] = 0.5*ea*(1.0-xi*xi);
+      }else{
+        N[a]       = 0.5*(1.0+xi*xa)*(1.0-eta*eta);
+        dN_dxi[a]  = 0.5*xa*(1.0-eta*eta);
+        dN_deta[a] = -eta*(1.0+xi*xa);
+      }
+    }
+  }
+};
+
+// Lagrange: products of the 1D quadratics through -1, 0, 1
+template<> struct Quad_Shape<9>{
+  static void Line(double s, double node, double& l, double& dl){
+    if(node < 0.0){
+      l = 0.5*s*(s-1.0);  dl = s-0.5;
+    }else if(node > 0.0){
+      l = 0.5*s*(s+1.0);  dl = s+0.5;
+    }else{
+      l = 1.0-s*s;        dl = -2.0*s;
+    }
+  }
+  static void Eval(double xi, double eta, double* N, double* dN_dxi, double* dN_deta){
+    for(int a = 0; a < 9; a++){
+      double lx, dlx, le, dle;
+      Line(xi,quad_xi_node[a],lx,dlx);
+      Line(eta,quad_eta_node[a],le,dle);
+      N[a]       = lx*le;
+      dN_dxi[a]  = dlx*le;
+      dN_deta[a] = lx*dle;
+    }
+  }
+};
+
 
 class Quadrature{
 
 protected:
   int Quadrature_points;            // number of quadrature points
+  int Element_nodes;                // nodes of the reference element
   double *QW, *QXi, *QEta;          // quadrature weights and points
   double **mapping, *mapping_data;  // mapping matrix to compute mapping coeff for each element
+  double **mapping_inv, *mapping_inv_data;  // inverse of mapping: coeff = mapping_inv * nodal coordinates
+  double **N, *N_data;              // shape functions at quadrature points [node][qpoint]
+  double **dN_dxi, *dN_dxi_data;    // shape function derivatives wrt xi at quadrature points
+  double **dN_deta, *dN_deta_data;  // shape function derivatives wrt eta at quadrature points
+
+  void Allocate_Points(int);
+  virtual void Setup_Reference_Element();
+  template<int NN> void Setup_Shape_Tables();
+  static double** Allocate_Table(double*&, int, int);
 
 public:
+  Quadrature();
   virtual ~Quadrature();
 
   virtual void Setup_Quadrature() = 0;
   virtual void Print_Quadrature_Info() = 0;
   int Qpoints() const {return Quadrature_points;}
+  int Nodes() const {return Element_nodes;}
   double* QWeights() const {return QW;}
   double* QXipoints() const {return QXi;}
   double* QEtapoints() const {return QEta;}
   double** QMapping() const {return mapping;}
+  double** QMapping_inv() const {return mapping_inv;}
+  double** QShape() const {return N;}
+  double** QdN_dxi() const {return dN_dxi;}
+  double** QdN_deta() const {return dN_deta;}
 
 };
 
@@ -45,29 +132,189 @@ public:
 };
 
 
+/* reduced integration: the centre of the element, weight 4. The constant
+ * strain part is exact, the hourglass modes it misses are stabilized by the
+ * kernels (see Quad4_Hourglass_Batch) */
+class Quadrature_1PQuad4 : public Quadrature{
+public:
+  virtual void Setup_Quadrature();
+  virtual void Print_Quadrature_Info();
+};
+
+
+/* the 3x3 rule with the tables of the quadratic elements, it integrates
+ * their stiffness exactly on parallelograms (Quad9) or nearly so (Quad8) */
+class Quadrature_3PQuad8 : public Quadrature_3PQuad4{
+protected:
+  virtual void Setup_Reference_Element(){ Setup_Shape_Tables<8>(); }
+public:
+  virtual void Print_Quadrature_Info(){
+    cout << "Element = Quad8 (serendipity)" << endl;
+    Quadrature_3PQuad4::Print_Quadrature_Info();
+  }
+};
+
+
+/* constant strain triangle: one point at the centroid of the reference
+ * triangle (0,0), (1,0), (0,1), weight 1/2. The triangle kernels work in
+ * closed form; the point is where their strains and stresses are reported */
+class Quadrature_1PTri3 : public Quadrature{
+protected:
+  virtual void Setup_Reference_Element();
+public:
+  virtual void Setup_Quadrature();
+  virtual void Print_Quadrature_Info();
+};
+
+
+class Quadrature_3PQuad9 : public Quadrature_3PQuad4{
+protected:
+  virtual void Setup_Reference_Element(){ Setup_Shape_Tables<9>(); }
+public:
+  virtual void Print_Quadrature_Info(){
+    cout << "Element = Quad9 (Lagrange)" << endl;
+    Quadrature_3PQuad4::Print_Quadrature_Info();
+  }
+};
+
+
 
 // functions
 
 
+Quadrature :: Quadrature(){
+  Quadrature_points = 0;
+  Element_nodes = 4;
+  QW = NULL;
+  QXi = NULL;
+  QEta = NULL;
+  mapping = NULL;
+  mapping_data = NULL;
+  mapping_inv = NULL;
+  mapping_inv_data = NULL;
+  N = NULL;
+  N_data = NULL;
+  dN_dxi = NULL;
+  dN_dxi_data = NULL;
+  dN_deta = NULL;
+  dN_deta_data = NULL;
+}
+
+
 Quadrature :: ~Quadrature(){
   delete [] QW;
   delete [] QXi;
   delete [] QEta;
   delete [] mapping_data;
   delete [] mapping;
+  delete [] mapping_inv_data;
+  delete [] mapping_inv;
+  delete [] N_data;
+  delete [] N;
+  delete [] dN_dxi_data;
+  delete [] dN_dxi;
+  delete [] dN_deta_data;
+  delete [] dN_deta;
 }
 
 
-void Quadrature_2PQuad4 :: Setup_Quadrature(){
-  Quadrature_points = 4;
-  QW = new double [4];
-  QXi = new double [4];
-  QEta = new double [4];
-  mapping_data = new double [16];
-  mapping = new double* [4];
+double** Quadrature :: Allocate_Table(double*& data, int rows, int cols){
+  data = new double [rows*cols];
+  double **table = new double* [rows];
+  for(int i = 0; i < rows; i++){
+    table[i] = &data[i*cols];
+  }
+  return table;
+}
+
+
+void Quadrature :: Allocate_Points(int n){
+  Quadrature_points = n;
+  QW = new double [n];
+  QXi = new double [n];
+  QEta = new double [n];
+}
+
+
+/*
+ * Reference element tables shared by all Quad4 elements: shape functions and
+ * their xi/eta derivatives at the quadrature points, and the inverse of the
+ * bilinear mapping x = a0 + a1*xi + a2*eta + a3*xi*eta at the four corners.
+ */
+void Quadrature :: Setup_Reference_Element(){
+
+  const int n = Quadrature_points;
+  const double xi_node[4]  = {-1.0,  1.0, 1.0, -1.0};
+  const double eta_node[4] = {-1.0, -1.0, 1.0,  1.0};
+
+  N = Allocate_Table(N_data,4,n);
+  dN_dxi = Allocate_Table(dN_dxi_data,4,n);
+  dN_deta = Allocate_Table(dN_deta_data,4,n);
+
+  for(int i = 0; i < n; i++){
+    for(int a = 0; a < 4; a++){
+      N[a][i]       = 0.25*(1.0+xi_node[a]*QXi[i])*(1.0+eta_node[a]*QEta[i]);
+      dN_dxi[a][i]  = 0.25*xi_node[a]*(1+eta_node[a]*QEta[i]);
+      dN_deta[a][i] = 0.25*eta_node[a]*(1+xi_node[a]*QXi[i]);
+    }
+  }
+
+  // transposed form because of lapack solver
+  mapping = Allocate_Table(mapping_data,4,4);
+  for(int a = 0; a < 4; a++){
+    mapping[0][a] = 1.0;
+    mapping[1][a] = xi_node[a];
+    mapping[2][a] = eta_node[a];
+    mapping[3][a] = xi_node[a]*eta_node[a];
+  }
+
+  /* invert once with lapack: solve mapping * X = I */
+  int nm = 4, nrhs = 4, lda = 4, ldb = 4, info, ipiv[4];
+  double mat[16], inv[16];
+  memcpy(&mat[0],&mapping[0][0],16*sizeof(double));
+  for(int i = 0; i < 16; i++){
+    inv[i] = (i % 5 == 0) ? 1.0 : 0.0;
+  }
+  dgesv_(&nm, &nrhs, &mat[0], &lda, ipiv, &inv[0], &ldb, &info);
+  assert(info == 0);
+
+  // inv is column major, store row major so that coeff[i] = sum_j mapping_inv[i][j]*x[j]
+  mapping_inv = Allocate_Table(mapping_inv_data,4,4);
   for(int i = 0; i < 4; i++){
-    mapping[i] = &mapping_data[i*4];
+    for(int j = 0; j < 4; j++){
+      mapping_inv[i][j] = inv[j*4+i];
+    }
   }
+}
+
+
+/*
+ * Shape function tables of the NN node element at the quadrature points. The
+ * quadratic elements are isoparametric, there is no mapping matrix.
+ */
+template<int NN>
+void Quadrature :: Setup_Shape_Tables(){
+
+  const int n = Quadrature_points;
+  Element_nodes = NN;
+  N = Allocate_Table(N_data,NN,n);
+  dN_dxi = Allocate_Table(dN_dxi_data,NN,n);
+  dN_deta = Allocate_Table(dN_deta_data,NN,n);
+
+  for(int i = 0; i < n; i++){
+    double Ni[NN], dxi[NN], deta[NN];
+    Quad_Shape<NN>::Eval(QXi[i],QEta[i],Ni,dxi,deta);
+    for(int a = 0; a < NN; a++){
+      N[a][i] = Ni[a];
+      dN_dxi[a][i] = dxi[a];
+      dN_deta[a][i] = deta[a];
+    }
+  }
+}
+
+
+void Quadrature_2PQuad4 :: Setup_Quadrature(){
+  Allocate_Points(4);
 
   QW[0] = 1.0;
   QW[1] = 1.0;
@@ -84,23 +331,7 @@ void Quadrature_2PQuad4 :: Setup_Quadrature(){
   QEta[2] =  1.0/sqrt(3);
   QEta[3] =  1.0/sqrt(3);
 
-  // transposed form because of lapack solver
-  mapping[0][0] =  1.0;
-  mapping[1][0] = -1.0;
-  mapping[2][0] = -1.0;
-  mapping[3][0] =  1.0;
-  mapping[0][1] =  1.0;
-  mapping[1][1] =  1.0;
-  mapping[2][1] = -1.0;
-  mapping[3][1] = -1.0;
-  mapping[0][2] =  1.0;
-  mapping[1][2] =  1.0;
-  mapping[2][2] =  1.0;
-  mapping[3][2] =  1.0;
-  mapping[0][3] =  1.0;
-  mapping[1][3] = -1.0;
-  mapping[2][3] =  1.0;
-  mapping[3][3] = -1.0;
+  Setup_Reference_Element();
 }
 
 void Quadrature_2PQuad4 :: Print_Quadrature_Info(){
@@ -124,10 +355,7 @@ void Quadrature_2PQuad4 :: Print_Quadrature_Info(){
 
 
 void Quadrature_3PQuad4 :: Setup_Quadrature(){
-  Quadrature_points = 9;
-  QW = new double [9];
-  QXi = new double [9];
-  QEta = new double [9];
+  Allocate_Points(9);
 
   QW[0] = (5.0/9.0)*(5.0/9.0);
   QW[1] = (8.0/9.0)*(5.0/9.0);
@@ -139,25 +367,28 @@ void Quadrature_3PQuad4 :: Setup_Quadrature(){
   QW[7] = (8.0/9.0)*(5.0/9.0);
   QW[8] = (5.0/9.0)*(5.0/9.0);
 
+  // tensor product of the 3 point rule, xi runs fastest
   QXi[0] = -sqrt(3.0/5.0);
   QXi[1] =  0.0;
   QXi[2] =  sqrt(3.0/5.0);
   QXi[3] = -sqrt(3.0/5.0);
   QXi[4] =  0.0;
-  QXi[5] = -sqrt(3.0/5.0);
-  QXi[6] =  sqrt(3.0/5.0);
+  QXi[5] =  sqrt(3.0/5.0);
+  QXi[6] = -sqrt(3.0/5.0);
   QXi[7] =  0.0;
-  QXi[8] = -sqrt(3.0/5.0);
+  QXi[8] =  sqrt(3.0/5.0);
 
   QEta[0] = -sqrt(3.0/5.0);
-  QEta[1] =  0.0;
-  QEta[2] =  sqrt(3.0/5.0);
-  QEta[3] = -sqrt(3.0/5.0);
+  QEta[1] = -sqrt(3.0/5.0);
+  QEta[2] = -sqrt(3.0/5.0);
+  QEta[3] =  0.0;
   QEta[4] =  0.0;
-  QEta[5] = -sqrt(3.0/5.0);
+  QEta[5] =  0.0;
   QEta[6] =  sqrt(3.0/5.0);
-  QEta[7] =  0.0;
-  QEta[8] = -sqrt(3.0/5.0);
+  QEta[7] =  sqrt(3.0/5.0);
+  QEta[8] =  sqrt(3.0/5.0);
+
+  Setup_Reference_Element();
 }
 
 void Quadrature_3PQuad4 :: Print_Quadrature_Info(){
@@ -180,4 +411,60 @@ void Quadrature_3PQuad4 :: Print_Quadrature_Info(){
 
 
 
+
+void Quadrature_1PQuad4 :: Setup_Quadrature(){
+  Allocate_Points(1);
+  QW[0] = 4.0;
+  QXi[0] = 0.0;
+  QEta[0] = 0.0;
+  Setup_Reference_Element();
+}
+
+void Quadrature_1PQuad4 :: Print_Quadrature_Info(){
+  cout << "Quadrature = 2D Gaussian Quadrature : 1 Point (reduced, hourglass stabilized)" << endl;
+  cout << "Quadrature points : " << Qpoints() << endl;
+  cout << "Weights:" << endl;
+  cout << setw(10) << QW[0] << endl;
+  cout << "Xi:" << endl;
+  cout << setw(10) << QXi[0] << endl;
+  cout << "Eta:" << endl;
+  cout << setw(10) << QEta[0] << endl;
+  cout << endl;
+}
+
+
+
+void Quadrature_1PTri3 :: Setup_Quadrature(){
+  Allocate_Points(1);
+  QW[0] = 0.5;
+  QXi[0] = 1.0/3.0;
+  QEta[0] = 1.0/3.0;
+  Setup_Reference_Element();
+}
+
+/* linear shape functions 1-xi-eta, xi, eta */
+void Quadrature_1PTri3 :: Setup_Reference_Element(){
+  Element_nodes = 3;
+  N = Allocate_Table(N_data,3,1);
+  dN_dxi = Allocate_Table(dN_dxi_data,3,1);
+  dN_deta = Allocate_Table(dN_deta_data,3,1);
+  N[0][0] = 1.0-QXi[0]-QEta[0];  dN_dxi[0][0] = -1.0;  dN_deta[0][0] = -1.0;
+  N[1][0] = QXi[0];              dN_dxi[1][0] =  1.0;  dN_deta[1][0] =  0.0;
+  N[2][0] = QEta[0];             dN_dxi[2][0] =  0.0;  dN_deta[2][0] =  1.0;
+}
+
+void Quadrature_1PTri3 :: Print_Quadrature_Info(){
+  cout << "Element = Tri3 (constant strain), closed form" << endl;
+  cout << "Quadrature points : " << Qpoints() << endl;
+  cout << "Weights:" << endl;
+  cout << setw(10) << QW[0] << endl;
+  cout << "Xi:" << endl;
+  cout << setw(10) << QXi[0] << endl;
+  cout << "Eta:" << endl;
+  cout << setw(10) << QEta[0] << endl;
+  cout << endl;
+}
+
+
+
 #endif // QUADRATURE_HPP
@@ -6,54 +6,392 @@
 
 using namespace std;
 
-class FEA_Solver{
+/* solver configuration: PETSc defaults (CG/ICC for symmetric systems), or
+ * smoothed aggregation multigrid with the rigid body modes of plane elasticity */
+typedef enum {SOLVER_DEFAULT, SOLVER_ELASTICITY} Solver_Preset;
+static const char* const solver_preset_names[] = {"default","elasticity","Solver_Preset","SOLVER_",NULL};
 
+class FEA_Solver{
+  friend class PostProcessor;
 private:
   const PreProcessor* prep;
   Vec Solution;
   KSP ksp;
+  double tolerance;
+  double setup_time;              // seconds spent in the last Setup
+  Solver_Preset preset;
+  Output_Format out_format;       // files written by write_sol_disp
+
+  /* copy the local part of x (full or free DOF layout of K) into Solution */
+  void Set_Solution(const PetscScalar* x){
+    Vec u = Solution;
+    if(prep->KFree){
+      VecSet(Solution,0.0);
+      VecGetSubVector(Solution,prep->Free_DOF,&u);
+    }
+    PetscInt n;
+    PetscScalar* _u;
+    VecGetLocalSize(u,&n);
+    VecGetArray(u,&_u);
+    memcpy(_u,x,n*sizeof(PetscScalar));
+    VecRestoreArray(u,&_u);
+    if(prep->KFree){
+      VecRestoreSubVector(Solution,prep->Free_DOF,&u);
+    }
+  }
+
 public:
   FEA_Solver(const PreProcessor* pre)
-    : prep(pre)
+    : prep(pre), ksp(NULL), tolerance(1e-12), setup_time(0.0), preset(SOLVER_DEFAULT), out_format(OUT_TEXT)
   {
     VecDuplicate(prep->RHS,&Solution);
   }
 
-  void solve_disp(double tol = 1e-12){
+  /*
+   * Operator and preconditioner (or factorization) set up once, reused by
+   * every solve until Setup is called again, e.g. after reassembly.
+   */
+  double Setup(double tol = 1e-12){
+    Profile_Stage stage("Solver setup");
 
-    int itn;
+    double t0, t1;
+    PetscTime(&t0);
+    Mat K = prep->KFree ? prep->KFree : prep->KMat;
+    KSPDestroy(&ksp);
     KSPCreate(PETSC_COMM_WORLD,&ksp);
-    KSPSetOperators(ksp,prep->KMat,prep->KMat);
+    KSPSetOperators(ksp,K,K);
     KSPSetTolerances(ksp,tol,PETSC_DEFAULT,PETSC_DEFAULT,PETSC_DEFAULT);
+    if(prep->Matrix_Free()){
+      // only the diagonal of the operator is available without assembly
+      if(preset == SOLVER_ELASTICITY){
+        PetscPrintf(PETSC_COMM_WORLD,"Warning: the elasticity preset needs an assembled matrix, using Jacobi\n");
+      }
+      PC pc;
+      KSPGetPC(ksp,&pc);
+      KSPSetType(ksp,KSPCG);
+      PCSetType(pc,PCJACOBI);
+    }else if(preset == SOLVER_ELASTICITY){
+      Set_Elasticity_Preconditioner(K);
+    }else if(prep->Symmetric_System()){
+      // symmetric constraints: conjugate gradients, incomplete Cholesky on one process
+      PetscMPIInt size;
+      MPI_Comm_size(PETSC_COMM_WORLD,&size);
+      KSPSetType(ksp,KSPCG);
+      if(size == 1){
+        PC pc;
+        KSPGetPC(ksp,&pc);
+        PCSetType(pc,PCICC);
+      }
+    }
     KSPSetFromOptions(ksp);
     KSPSetUp(ksp);
-    KSPSolve(ksp,prep->RHS,Solution);
+    tolerance = tol;
+    PetscTime(&t1);
+    setup_time = t1-t0;
+    return setup_time;
+  }
+
+  void Set_preset(Solver_Preset const& p){
+    preset = p;
+    KSPDestroy(&ksp);
+  }
+
+  /*
+   * Elasticity preset: the three rigid body modes (x and y translation,
+   * in-plane rotation) from the nodal coordinates become the near nullspace
+   * of K (2x2 node blocks), which smoothed aggregation GAMG uses to build its
+   * coarse spaces. CG needs the symmetric constraint modes, GMRES is used
+   * otherwise.
+   */
+  void Set_Elasticity_Preconditioner(Mat K){
+
+    PetscInt bs;
+    MatGetBlockSize(K,&bs);
+    if(bs != 2){
+      PetscPrintf(PETSC_COMM_WORLD,"Warning: stiffness block size %d, rigid body modes need 2\n",int(bs));
+    }
+    Vec coords;
+    MatNullSpace rigid;
+    prep->Create_Coordinates(&coords);
+    MatNullSpaceCreateRigidBody(coords,&rigid);
+    MatSetNearNullSpace(K,rigid);
+    MatNullSpaceDestroy(&rigid);
+    VecDestroy(&coords);
+
+    if(prep->Symmetric_System()){
+      KSPSetType(ksp,KSPCG);
+    }else{
+      PetscPrintf(PETSC_COMM_WORLD,"Warning: nonsymmetric constraints (-constraints zero_rows), using GMRES\n");
+      KSPSetType(ksp,KSPGMRES);
+    }
+    PC pc;
+    KSPGetPC(ksp,&pc);
+    PCSetType(pc,PCGAMG);
+    PCGAMGSetType(pc,PCGAMGAGG);
+    PCGAMGSetNSmooths(pc,1);
+  }
+
+  /*
+   * The solved matrix has new values (same nonzero pattern): the KSP is kept,
+   * its preconditioner is set up again by the next solve, reusing the
+   * symbolic phase. A new matrix object gets a new KSP.
+   */
+  void Update_Operator(){
+    Mat K = prep->KFree ? prep->KFree : prep->KMat;
+    Mat A = NULL;
+    if(ksp){
+      KSPGetOperators(ksp,&A,NULL);
+    }
+    if(A != K){
+      KSPDestroy(&ksp);
+      return;
+    }
+    KSPSetOperators(ksp,K,K);
+  }
+
+  void Scale_Solution(double s){
+    VecScale(Solution,s);
+  }
+
+  double Max_Displacement() const {
+    double umax;
+    VecNorm(Solution,NORM_INFINITY,&umax);
+    return umax;
+  }
+
+  /* F.u of the last solution for the point load, twice its strain energy */
+  double Compliance() const {
+    double c;
+    VecDot(prep->RHS,Solution,&c);
+    return c;
+  }
+
+  int Iterations() const {
+    PetscInt itn = 0;
+    if(ksp){
+      KSPGetIterationNumber(ksp,&itn);
+    }
+    return itn;
+  }
+
+  double Setup_Time() const {
+    return setup_time;
+  }
+
+  void solve_disp(double tol = 1e-12){
+    Profile_Stage stage("Solve");
+
+    int itn;
+    if(ksp == NULL || tol != tolerance){
+      Setup(tol);
+    }
+    if(prep->KFree){
+      // solve for the free DOFs, the fixed ones stay zero
+      Vec b, x;
+      VecSet(Solution,0.0);
+      VecGetSubVector(prep->RHS,prep->Free_DOF,&b);
+      VecGetSubVector(Solution,prep->Free_DOF,&x);
+      KSPSolve(ksp,b,x);
+      VecRestoreSubVector(Solution,prep->Free_DOF,&x);
+      VecRestoreSubVector(prep->RHS,prep->Free_DOF,&b);
+    }else{
+      KSPSolve(ksp,prep->RHS,Solution);
+    }
     KSPGetIterationNumber(ksp,&itn);
     PetscPrintf(PETSC_COMM_WORLD,"Iterations taken by KSP: %d\n",itn);
 
   }
 
-  void write_sol_disp(){
+  /*
+   * All load cases of the preprocessor as one block of right-hand sides
+   * (KSPMatSolve: a factorization solves them together, Krylov methods
+   * column by column). Each case is written to disp_*_<case>.dat.
+   */
+  void solve_load_cases(double tol = 1e-12){
+    Profile_Stage stage("Load cases");
+
+    const PetscInt ncase = prep->Num_Load_Cases();
+    if(ncase == 0){
+      return;
+    }
+    if(ksp == NULL || tol != tolerance){
+      Setup(tol);
+    }
+
+    double t0, t1, t2;
+    PetscTime(&t0);
+    Mat K;
+    PetscInt m, M;
+    KSPGetOperators(ksp,&K,NULL);
+    MatGetLocalSize(K,&m,NULL);
+    MatGetSize(K,&M,NULL);
+
+    Mat B, X;
+    PetscScalar *_B;
+    PetscInt lda;
+    MatCreateDense(PETSC_COMM_WORLD,m,PETSC_DECIDE,M,ncase,NULL,&B);
+    MatCreateDense(PETSC_COMM_WORLD,m,PETSC_DECIDE,M,ncase,NULL,&X);
+    MatDenseGetArray(B,&_B);
+    MatDenseGetLDA(B,&lda);
+    Vec F;
+    VecDuplicate(prep->RHS,&F);
+    for(PetscInt c = 0; c < ncase; c++){
+      prep->Build_Load_Vector(prep->Get_Load_Case(c),F);
+      Vec f = F;
+      if(prep->KFree){
+        VecGetSubVector(F,prep->Free_DOF,&f);
+      }
+      const PetscScalar* _f;
+      VecGetArrayRead(f,&_f);
+      memcpy(_B + c*lda,_f,m*sizeof(PetscScalar));
+      VecRestoreArrayRead(f,&_f);
+      if(prep->KFree){
+        VecRestoreSubVector(F,prep->Free_DOF,&f);
+      }
+    }
+    VecDestroy(&F);
+    MatDenseRestoreArray(B,&_B);
+
+    PetscTime(&t1);
+    KSPMatSolve(ksp,B,X);
+    PetscTime(&t2);
+
+    int itn;
+    KSPGetIterationNumber(ksp,&itn);
+    PetscPrintf(PETSC_COMM_WORLD,"Load cases: %d, setup %.4e s, right-hand sides %.4e s, solve %.4e s (%.4e s per case), %d iterations\n",
+                int(ncase),setup_time,t1-t0,t2-t1,(t2-t1)/ncase,itn);
+
+    const PetscScalar* _X;
+    MatDenseGetArrayRead(X,&_X);
+    MatDenseGetLDA(X,&lda);
+    for(PetscInt c = 0; c < ncase; c++){
+      Set_Solution(_X + c*lda);
+      write_sol_disp("_" + prep->Get_Load_Case(c).Name());
+    }
+    MatDenseRestoreArrayRead(X,&_X);
+    MatDestroy(&B);
+    MatDestroy(&X);
+  }
+
+  /*
+   * Gather the solution on the first process and write it in file node order:
+   * text      disp_total<suffix>.dat, disp_u<suffix>.dat, disp_v<suffix>.dat
+   * binary    disp<suffix>.bin, u v of every node as little endian doubles
+   * vtk       solution<suffix>.vtu, mesh and displacement
+   * The parallel format is written by all processes, see Write_Parallel.
+   */
+  void write_sol_disp(string const& suffix = ""){
+    Profile_Stage stage("Output");
 
-    ofstream disp_total("disp_total.dat");
-    ofstream disp_u("disp_u.dat");
-    ofstream disp_v("disp_v.dat");
-    PetscReal *_sol;
-    VecGetArray(Solution,&_sol);
-    for(size_t i = 0; i < prep->GDof; i+=2){
-      disp_total << sqrt(pow(_sol[i],2)+pow(_sol[i+1],2)) << endl;
-      disp_u << _sol[i] << endl;
-      disp_v << _sol[i+1] << endl;
+    if(out_format == OUT_PARALLEL){
+      Write_Parallel("solution" + suffix + ".pbin");
+      return;
     }
-    disp_total.close();
-    disp_u.close();
-    disp_v.close();
-    VecRestoreArray(Solution,&_sol);
+    double t0, t1;
+    PetscTime(&t0);
+    Vec Seq_Solution;
+    VecScatter gather;
+    PetscMPIInt rank;
+    MPI_Comm_rank(PETSC_COMM_WORLD,&rank);
+    VecScatterCreateToZero(Solution,&gather,&Seq_Solution);
+    VecScatterBegin(gather,Solution,Seq_Solution,INSERT_VALUES,SCATTER_FORWARD);
+    VecScatterEnd(gather,Solution,Seq_Solution,INSERT_VALUES,SCATTER_FORWARD);
+
+    if(rank == 0){
+      const PetscScalar *_sol;
+      VecGetArrayRead(Seq_Solution,&_sol);
+      size_t bytes = 0;
+      string files;
+      if(out_format == OUT_TEXT){
+        Buffered_Writer disp_total("disp_total" + suffix + ".dat");
+        Buffered_Writer disp_u("disp_u" + suffix + ".dat");
+        Buffered_Writer disp_v("disp_v" + suffix + ".dat");
+        for(size_t i = 0; i < prep->GDof/2; i++){
+          const int n = prep->node_perm[i];
+          disp_total.Write_Line(sqrt(pow(_sol[2*n],2)+pow(_sol[2*n+1],2)));
+          disp_u.Write_Line(_sol[2*n]);
+          disp_v.Write_Line(_sol[2*n+1]);
+        }
+        disp_total.Close();
+        disp_u.Close();
+        disp_v.Close();
+        bytes = disp_total.Bytes() + disp_u.Bytes() + disp_v.Bytes();
+        files = "disp_{total,u,v}" + suffix + ".dat";
+      }else{
+        vector<double> uv(prep->GDof);
+        for(size_t i = 0; i < prep->GDof/2; i++){
+          const int n = prep->node_perm[i];
+          uv[2*i]   = _sol[2*n];
+          uv[2*i+1] = _sol[2*n+1];
+        }
+        if(out_format == OUT_BINARY){
+          files = "disp" + suffix + ".bin";
+          Buffered_Writer out(files);
+          out.Write_LE(uv.data(),uv.size());
+          out.Close();
+          bytes = out.Bytes();
+        }else{
+          files = "solution" + suffix + ".vtu";
+          VTK_Writer vtk;
+          prep->VTK_Mesh(vtk);
+          vtk.Add_Point_Data("displacement",3,Pad_Vector(uv));
+          bytes = vtk.Write(files);
+        }
+      }
+      VecRestoreArrayRead(Seq_Solution,&_sol);
+      PetscTime(&t1);
+      PetscPrintf(PETSC_COMM_SELF,"Output: %s, %zu bytes in %.4e s\n",files.c_str(),bytes,t1-t0);
+    }
+    VecScatterDestroy(&gather);
+    VecDestroy(&Seq_Solution);
 
     //WriteVec(Solution,"solution");
 
   }
 
+  /* x y u v of every node into one shared file, each process writing its
+   * own nodes, without gathering the solution (Write_Node_Records) */
+  void Write_Parallel(string const& filename) const {
+
+    double t0, t1;
+    PetscTime(&t0);
+    vector<int> index;
+    vector<double> xy;
+    prep->Owned_Nodes(index,xy);
+
+    vector<double> rec(4*index.size());
+    const PetscScalar* _sol;
+    VecGetArrayRead(Solution,&_sol);
+    for(size_t k = 0; k < index.size(); k++){
+      const int n = prep->node_perm[index[k]] - prep->node_lo;
+      rec[4*k]   = xy[2*k];
+      rec[4*k+1] = xy[2*k+1];
+      rec[4*k+2] = _sol[2*n];
+      rec[4*k+3] = _sol[2*n+1];
+    }
+    VecRestoreArrayRead(Solution,&_sol);
+    const size_t bytes = Write_Node_Records(filename,prep->GDof/2,4,index,rec,PETSC_COMM_WORLD);
+    PetscTime(&t1);
+    PetscPrintf(PETSC_COMM_WORLD,"Output: %s, %zu bytes in %.4e s\n",filename.c_str(),bytes,t1-t0);
+  }
+
+  /* u v per node -> u v 0, the 3 component vectors of VTK */
+  static vector<double> Pad_Vector(vector<double> const& uv){
+    vector<double> v(3*(uv.size()/2),0.0);
+    for(size_t i = 0; i < uv.size()/2; i++){
+      v[3*i]   = uv[2*i];
+      v[3*i+1] = uv[2*i+1];
+    }
+    return v;
+  }
+
+  void Set_output_format(Output_Format f){
+    out_format = f;
+  }
+
+  Output_Format Get_output_format() const {
+    return out_format;
+  }
 
 
   ~FEA_Solver(){
@@ -2,7 +2,9 @@
 #define STIFFELEMENT_HPP
 
 #include <iostream>
+#include <vector>
 #include "element.hpp"
+#include "geometry.hpp"
 #include "mesh.hpp"
 #include "material.hpp"
 #include "cblas.h"
@@ -10,139 +12,148 @@
 using namespace std;
 
 
-class EStiffness{
+/*
+ * CLASS ELEMENT_MATRICES -> the element stiffness matrices of the local
+ * elements, quadrilaterals first then triangles, as packed upper triangles
+ * (row by row) in one array, with the equation numbers of their DOFs in a
+ * second one. Element e of a kind starts at e*ncoef, resp. e*ndof, in the
+ * part of that kind. Allocated once, no per element objects.
+ */
+class Element_Matrices{
 private:
-  const Element* element;
-  const Material* material;
-  const size_t K_size;            // stiffness matrix dimension
-  double **K, *K_data;            // element stiffness matrix
-  int *P;                  // global equation number
+  size_t nquad, ntri;
+  int quad_dof, quad_coef;        // per quadrilateral: DOFs, packed coefficients
+  vector<double> K;               // packed upper triangles
+  vector<int> P;                  // global equation numbers
+
+  size_t K_offset(size_t e) const {
+    return e < nquad ? e*quad_coef : nquad*quad_coef + (e-nquad)*TRI3_UPPER;
+  }
+  size_t P_offset(size_t e) const {
+    return e < nquad ? e*quad_dof : nquad*quad_dof + (e-nquad)*TRI3_DOF;
+  }
+
 public:
-  EStiffness(const Material*,const Element*);
-  ~EStiffness();
-  void Compute_Element_Stiffness(double const&);
-  void Compute_Equation_Number(const vector<int>&);
-  int Get_K_size() const {return K_size;}
-  int* Get_P() const {return P;}
-  double** Get_K() const {return K;}
+  Element_Matrices() : nquad(0), ntri(0), quad_dof(0), quad_coef(0) {}
+  void Allocate(size_t, int, size_t);
 
+  size_t size() const {return nquad + ntri;}
+  bool empty() const {return size() == 0;}
+  size_t Bytes() const {return K.size()*sizeof(double) + P.size()*sizeof(int);}
+
+  int DOF(size_t e) const {return e < nquad ? quad_dof : TRI3_DOF;}
+  const int* Equations(size_t e) const {return &P[P_offset(e)];}
+  const double* Packed(size_t e) const {return &K[K_offset(e)];}
+
+  void Set_Equations(size_t, const Node_List&, const vector<int>&);
+  void Set(size_t, const double*, int);
+  void Unpack(size_t, double*) const;
 };
 
 
+/* cblas reference path of the quadrilateral stiffness, full matrix row by row */
+void Reference_Quad_Stiffness(const Element_Geometry&, size_t, const double*, double const* const*, double, double*);
+
+
 
 // Functions
 
 
-EStiffness :: EStiffness(const Material* m,const Element* e)
-  : element(e),material(m), K_size(2*e->Quad->Qpoints())
-{
-  assert(K_size != 0);
-  P = new int [K_size];
-  K = new double* [K_size];
-  K_data = new double [K_size*K_size];
-  for(size_t i = 0; i < K_size; i++){
-    K[i] = &K_data[i*K_size];
+/* nq quadrilaterals of nen nodes and nt triangles */
+void Element_Matrices :: Allocate(size_t nq, int nen, size_t nt){
+  nquad = nq;
+  ntri = nt;
+  quad_dof = QUAD_DOF(nen);
+  quad_coef = QUAD_UPPER(nen);
+  K.assign(nquad*quad_coef + ntri*TRI3_UPPER,0.0);
+  P.assign(nquad*quad_dof + ntri*TRI3_DOF,0);
+}
+
+
+/* equation numbers from the face nodes and the node numbering of the partition */
+void Element_Matrices :: Set_Equations(size_t e, const Node_List& node, const vector<int>& perm){
+  assert(int(2*node.size()) == DOF(e));
+  int* p = &P[P_offset(e)];
+  for(size_t i = 0; i < node.size(); i++){
+    p[i*2] = perm[node[i]-1]*2;
+    p[i*2+1] = p[i*2] + 1;
   }
 }
 
 
-EStiffness :: ~EStiffness(){
-  delete [] K_data;
-  delete [] K;
-  delete [] P;
+/* packed upper triangle of element e from the kernel output, entry k at Kup[k*stride] */
+void Element_Matrices :: Set(size_t e, const double* Kup, int stride){
+  double* k = &K[K_offset(e)];
+  const int ncoef = e < nquad ? quad_coef : TRI3_UPPER;
+  for(int i = 0; i < ncoef; i++){
+    k[i] = Kup[i*stride];
+  }
 }
 
 
+/* full symmetric matrix of element e, row by row */
+void Element_Matrices :: Unpack(size_t e, double* Kfull) const {
+  const double* k = Packed(e);
+  const int ndof = DOF(e);
+  for(int i = 0; i < ndof; i++){
+    for(int j = i; j < ndof; j++){
+      Kfull[i*ndof + j] = Kfull[j*ndof + i] = *k++;
+    }
+  }
+}
 
-void EStiffness :: Compute_Element_Stiffness(double const& thickness){
+
+/* quadrature path of quadrilateral e, K = sum B^T C B J t w with two dgemm per point */
+void Reference_Quad_Stiffness(const Element_Geometry& G, size_t e, const double* QW,
+                              double const* const* C, double thickness, double* K){
+  const int K_size = QUAD_DOF(G.Nodes_per_element());
   double B[3][K_size];
-  double** C = material->Get_Element_Stiffness();
-  double* QW = element->Quad->QWeights();
-  double result[8][3];
+  double Cm[3][3];
+  double result[K_size][3];
   double beta;
 
-  assert(K_size == 8);
-  for(size_t z = 0; z < K_size/2; z++){
-    // compute B
-    B[0][0] = element->dN1_dxi[z]*element->dxi_dx[z] + element->dN1_deta[z]*element->deta_dx[z];
-    B[0][1] = 0.0;
-    B[1][0] = 0.0;
-    B[1][1] = element->dN1_dxi[z]*element->dxi_dy[z] + element->dN1_deta[z]*element->deta_dy[z];
-    B[2][0] = B[1][1];
-    B[2][1] = B[0][0];
-
-    B[0][2] = element->dN2_dxi[z]*element->dxi_dx[z] + element->dN2_deta[z]*element->deta_dx[z];
-    B[0][3] = 0.0;
-    B[1][2] = 0.0;
-    B[1][3] = element->dN2_dxi[z]*element->dxi_dy[z] + element->dN2_deta[z]*element->deta_dy[z];
-    B[2][2] = B[1][3];
-    B[2][3] = B[0][2];
-
-    B[0][4] = element->dN3_dxi[z]*element->dxi_dx[z] + element->dN3_deta[z]*element->deta_dx[z];
-    B[0][5] = 0.0;
-    B[1][4] = 0.0;
-    B[1][5] = element->dN3_dxi[z]*element->dxi_dy[z] + element->dN3_deta[z]*element->deta_dy[z];
-    B[2][4] = B[1][5];
-    B[2][5] = B[0][4];
-
-    B[0][6] = element->dN4_dxi[z]*element->dxi_dx[z] + element->dN4_deta[z]*element->deta_dx[z];
-    B[0][7] = 0.0;
-    B[1][6] = 0.0;
-    B[1][7] = element->dN4_dxi[z]*element->dxi_dy[z] + element->dN4_deta[z]*element->deta_dy[z];
-    B[2][6] = B[1][7];
-    B[2][7] = B[0][6];
-
-//    for(int i = 0; i < 3; i++){
-//      for(int j = 0; j < 8; j++){
-//        cout << setw(12) << B[i][j];
-//      }
-//      cout << endl;
-//    }
-//    cout << endl;
-
-    double alpha = element->J[z]*thickness*QW[z];
-    // matrix multiplication --> result = B(transpose)*C*alpha
-    cblas_dgemm(CblasRowMajor,CblasTrans,CblasNoTrans,K_size,3,3,alpha,&B[0][0],K_size,&C[0][0],3,0.0,&result[0][0],3);
-
-//      for(int i = 0; i < 8; i++){
-//        for(int j = 0; j < 3; j++){
-//          cout << setw(15) << result[i][j];
-//        }
-//        cout << endl;
-//      }
-
-    if(z == 0){
-      beta = 0.0;
-    }else if(z > 0){
-      beta = 1.0;
+  for(int i = 0; i < 3; i++){
+    for(int j = 0; j < 3; j++){
+      Cm[i][j] = C[i][j];
     }
-    // matrix multiplication --> K = beta*K + result*B
-    cblas_dgemm(CblasRowMajor,CblasNoTrans,CblasNoTrans,K_size,K_size,3,1.0,&result[0][0],3,&B[0][0],K_size,beta,&K[0][0],K_size);
   }
 
-//  for(int i = 0; i < 8; i++){
-//    for(int j = 0; j < 8; j++){
-//      cout << setw(15) << K[i][j];
-//    }
-//    cout << endl;
-//  }
-//  cout << endl;
-
-}
+  for(int z = 0; z < G.Qpoints(); z++){
+    // compute B
+    for(int a = 0; a < K_size/2; a++){
+      B[0][2*a]   = G.dN_dx(e,a,z);
+      B[0][2*a+1] = 0.0;
+      B[1][2*a]   = 0.0;
+      B[1][2*a+1] = G.dN_dy(e,a,z);
+      B[2][2*a]   = B[1][2*a+1];
+      B[2][2*a+1] = B[0][2*a];
+    }
 
+    double alpha = G.J(e,z)*thickness*QW[z];
+    // matrix multiplication --> result = B(transpose)*C*alpha
+    cblas_dgemm(CblasRowMajor,CblasTrans,CblasNoTrans,K_size,3,3,alpha,&B[0][0],K_size,&Cm[0][0],3,0.0,&result[0][0],3);
 
-void EStiffness :: Compute_Equation_Number(const vector<int>& node){
-  for(size_t i = 0; i < node.size(); i++){
-    P[i*2] = (node[i]-1)*2;
-    P[i*2+1] = P[i*2] + 1;
+    beta = (z == 0) ? 0.0 : 1.0;
+    // matrix multiplication --> K = beta*K + result*B
+    cblas_dgemm(CblasRowMajor,CblasNoTrans,CblasNoTrans,K_size,K_size,3,1.0,&result[0][0],3,&B[0][0],K_size,beta,K,K_size);
   }
 
-//  cout << "Equation Number: " << endl;
-//  for(size_t i = 0; i < K_size; i++){
-//    cout << setw(12) << P[i];
-//  }
-//  cout << endl << endl;
-
+  /* one point rule: hourglass stabilization, as in Quad4_Hourglass_Batch */
+  if(G.Hourglass()){
+    double sx = 0.0, sy = 0.0;
+    for(int a = 0; a < 4; a++){
+      sx += G.dN_dx(e,a,0)*G.dN_dx(e,a,0);
+      sy += G.dN_dy(e,a,0)*G.dN_dy(e,a,0);
+    }
+    const double w = G.J(e,0)*thickness*QW[0]*4.0/3.0;
+    const double ku = C[0][0]*w*sx, kv = C[1][1]*w*sy;
+    for(int a = 0; a < 4; a++){
+      for(int b = 0; b < 4; b++){
+        K[(2*a)*K_size + 2*b]     += ku*G.gamma(e,a)*G.gamma(e,b);
+        K[(2*a+1)*K_size + 2*b+1] += kv*G.gamma(e,a)*G.gamma(e,b);
+      }
+    }
+  }
 }
 
 
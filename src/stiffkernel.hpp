@@ -0,0 +1,251 @@
+#ifndef STIFFKERNEL_HPP
+#define STIFFKERNEL_HPP
+
+#include <cstring>
+#include "geometry.hpp"
+
+/*
+ * Batched quadrilateral stiffness kernel: one element per SIMD lane, node
+ * count and quadrature size compile time constants (Quad4, Quad8, Quad9).
+ *
+ * For node a the strain-displacement columns are [bx 0 by] (u) and [0 by bx] (v),
+ * with bx = dNa/dx, by = dNa/dy. Because the plane stress matrix has
+ * C02 = C12 = 0, C times these columns is [C00 bx, C10 bx, C22 by] and
+ * [C01 by, C11 by, C22 bx], so every entry of Ke costs two multiply-adds per
+ * quadrature point. Only the upper triangle is computed, packed row by row.
+ */
+
+// lanes per batch: AVX-512 = 8 doubles, AVX = 4, otherwise plain scalar code
+#if defined(__AVX512F__)
+#define STIFF_BATCH 8
+#elif defined(__AVX__)
+#define STIFF_BATCH 4
+#else
+#define STIFF_BATCH 1
+#endif
+
+#define QUAD4_DOF 8
+#define QUAD4_UPPER 36  // entries in the upper triangle of the 8x8 element matrix
+
+// element DOFs and upper triangle entries of an nn node element
+#define QUAD_DOF(nn) (2*(nn))
+#define QUAD_UPPER(nn) (QUAD_DOF(nn)*(QUAD_DOF(nn)+1)/2)
+#define QUAD_MAX_NODES 9
+#define QUAD_MAX_UPPER QUAD_UPPER(QUAD_MAX_NODES)
+
+// flops per element: at every quadrature point the weight, w C B (8 per node)
+// and 4 per upper triangle entry; plus the stabilization of the one point rule
+#define QUAD4_HOURGLASS_FLOPS (16 + 6 + 3*20)
+#define QUAD_STIFFNESS_FLOPS(nn,nq) ((1.0 + 8*(nn) + 4*QUAD_UPPER(nn))*(nq) + ((nq) == 1 ? QUAD4_HOURGLASS_FLOPS : 0))
+#define QUAD4_STIFFNESS_FLOPS(nq) QUAD_STIFFNESS_FLOPS(4,nq)
+
+
+template<int W> struct Lanes{
+  typedef double type __attribute__((vector_size(W*sizeof(double))));
+
+  static inline type Load(const double* p){
+    type v;
+    memcpy(&v,p,sizeof(type));
+    return v;
+  }
+};
+
+
+/*
+ * Ke (upper triangle) of elements e0 .. e0+W-1, NN nodes, NQ quadrature
+ * points. Kup is lane-fastest: Kup[k*W + l] is entry k of element e0+l.
+ */
+template<int NN, int NQ, int W>
+void Quad_Stiffness_Batch(const Element_Geometry& G, size_t e0, const double* QW,
+                          double const* const* C, double thickness, double* Kup){
+
+  typedef typename Lanes<W>::type V;
+  const int NDOF = QUAD_DOF(NN), NUP = QUAD_UPPER(NN);
+  const double C00 = C[0][0], C01 = C[0][1], C10 = C[1][0], C11 = C[1][1], C22 = C[2][2];
+  V K[NUP];
+
+  for(int k = 0; k < NUP; k++){
+    K[k] = V();
+  }
+
+  for(int q = 0; q < NQ; q++){
+    const V w = Lanes<W>::Load(&G.J(e0,q))*(thickness*QW[q]);
+    V bx[NN], by[NN], r[NDOF][3];
+
+    for(int a = 0; a < NN; a++){
+      bx[a] = Lanes<W>::Load(&G.dN_dx(e0,a,q));
+      by[a] = Lanes<W>::Load(&G.dN_dy(e0,a,q));
+      const V wx = w*bx[a], wy = w*by[a];
+      // w*C*B column of the u and v dof of node a
+      r[2*a][0]   = wx*C00;  r[2*a][1]   = wx*C10;  r[2*a][2]   = wy*C22;
+      r[2*a+1][0] = wy*C01;  r[2*a+1][1] = wy*C11;  r[2*a+1][2] = wx*C22;
+    }
+
+    int k = 0;
+    for(int i = 0; i < NDOF; i++){
+      for(int j = i; j < NDOF; j++){
+        const int b = j/2;
+        if(j % 2 == 0){
+          K[k] += r[i][0]*bx[b] + r[i][2]*by[b];
+        }else{
+          K[k] += r[i][1]*by[b] + r[i][2]*bx[b];
+        }
+        k++;
+      }
+    }
+  }
+
+  for(int k = 0; k < NUP; k++){
+    memcpy(&Kup[k*W],&K[k],W*sizeof(double));
+  }
+}
+
+
+/*
+ * Hourglass stiffnesses of one point Quad4 elements e0 .. e0+W-1, from the
+ * centre gradients and weight w = 4 J t:
+ *   k_u = 4/3 C00 w sum_a (dNa/dx)^2,  k_v = 4/3 C11 w sum_a (dNa/dy)^2.
+ * On rectangles k_u gamma gamma^T is the energy of the pure bending mode
+ * without the parasitic shear of full integration, so the element neither
+ * locks in bending nor has zero energy modes. Linear in C (parameter sweep).
+ */
+template<int W>
+inline void Quad4_Hourglass_Stiffness(const Element_Geometry& G, size_t e0, double const* const* C,
+                                      double thickness, double QW0, typename Lanes<W>::type& ku,
+                                      typename Lanes<W>::type& kv){
+  typedef typename Lanes<W>::type V;
+  V sx = V(), sy = V();
+  for(int a = 0; a < 4; a++){
+    const V bx = Lanes<W>::Load(&G.dN_dx(e0,a,0)), by = Lanes<W>::Load(&G.dN_dy(e0,a,0));
+    sx += bx*bx;
+    sy += by*by;
+  }
+  const V w = Lanes<W>::Load(&G.J(e0,0))*(thickness*QW0*4.0/3.0);
+  ku = (C[0][0]*w)*sx;
+  kv = (C[1][1]*w)*sy;
+}
+
+
+/* add k_u gamma gamma^T to the u-u and k_v gamma gamma^T to the v-v entries
+ * of the packed upper triangles of a one point Quad4 batch */
+template<int W>
+void Quad4_Hourglass_Batch(const Element_Geometry& G, size_t e0, double const* const* C,
+                           double thickness, double QW0, double* Kup){
+
+  typedef typename Lanes<W>::type V;
+  V ku, kv, g[4];
+  Quad4_Hourglass_Stiffness<W>(G,e0,C,thickness,QW0,ku,kv);
+  for(int a = 0; a < 4; a++){
+    g[a] = Lanes<W>::Load(&G.gamma(e0,a));
+  }
+
+  int k = 0;
+  for(int i = 0; i < QUAD4_DOF; i++){
+    for(int j = i; j < QUAD4_DOF; j++){
+      if(i % 2 == j % 2){
+        V K = Lanes<W>::Load(&Kup[k*W]);
+        K += ((i % 2 == 0) ? ku : kv)*g[i/2]*g[j/2];
+        memcpy(&Kup[k*W],&K,W*sizeof(double));
+      }
+      k++;
+    }
+  }
+}
+
+
+/* runtime quadrature size -> compile time specialization (Quad4 only) */
+template<int W>
+void Quad4_Stiffness_Kernel(const Element_Geometry& G, size_t e0, const double* QW,
+                            double const* const* C, double thickness, double* Kup){
+  if(G.Qpoints() == 1){
+    Quad_Stiffness_Batch<4,1,W>(G,e0,QW,C,thickness,Kup);
+    Quad4_Hourglass_Batch<W>(G,e0,C,thickness,QW[0],Kup);
+  }else if(G.Qpoints() == 4){
+    Quad_Stiffness_Batch<4,4,W>(G,e0,QW,C,thickness,Kup);
+  }else if(G.Qpoints() == 9){
+    Quad_Stiffness_Batch<4,9,W>(G,e0,QW,C,thickness,Kup);
+  }else{
+    assert(false);
+  }
+}
+
+
+/* runtime element type -> compile time specialization, any quadrilateral */
+template<int W>
+void Quad_Stiffness_Kernel(const Element_Geometry& G, size_t e0, const double* QW,
+                           double const* const* C, double thickness, double* Kup){
+  if(G.Nodes_per_element() == 4){
+    Quad4_Stiffness_Kernel<W>(G,e0,QW,C,thickness,Kup);
+  }else if(G.Nodes_per_element() == 8 && G.Qpoints() == 9){
+    Quad_Stiffness_Batch<8,9,W>(G,e0,QW,C,thickness,Kup);
+  }else if(G.Nodes_per_element() == 9 && G.Qpoints() == 9){
+    Quad_Stiffness_Batch<9,9,W>(G,e0,QW,C,thickness,Kup);
+  }else{
+    assert(false);
+  }
+}
+
+
+/*
+ * Constant strain triangle (Tri3), closed form. With twoA = 2 x area,
+ *   dN/dx = (y1-y2, y2-y0, y0-y1)/twoA,  dN/dy = (x2-x1, x0-x2, x1-x0)/twoA,
+ * constant over the element, so Ke = A t B^T C B with no quadrature loop.
+ */
+#define TRI3_DOF QUAD_DOF(3)
+#define TRI3_UPPER QUAD_UPPER(3)
+
+// flops per element: gradients and weight, w C B (8 per node), 3 per upper
+// triangle entry
+#define TRI3_GRADIENT_FLOPS 21
+#define TRI3_STIFFNESS_FLOPS (TRI3_GRADIENT_FLOPS + 2 + 8*3 + 3*TRI3_UPPER)
+
+
+/* gradients of triangles e0 .. e0+W-1 and twice their areas */
+template<int W>
+inline void Tri3_Gradients(const Tri_Coordinates& T, size_t e0, typename Lanes<W>::type* bx,
+                           typename Lanes<W>::type* by, typename Lanes<W>::type& twoA){
+  typedef typename Lanes<W>::type V;
+  V x[3], y[3];
+  for(int a = 0; a < 3; a++){
+    x[a] = Lanes<W>::Load(&T.x(e0,a));
+    y[a] = Lanes<W>::Load(&T.y(e0,a));
+  }
+  twoA = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+  const V inv = 1.0/twoA;
+  bx[0] = (y[1]-y[2])*inv;  by[0] = (x[2]-x[1])*inv;
+  bx[1] = (y[2]-y[0])*inv;  by[1] = (x[0]-x[2])*inv;
+  bx[2] = (y[0]-y[1])*inv;  by[2] = (x[1]-x[0])*inv;
+}
+
+
+/* Ke (upper triangle) of triangles e0 .. e0+W-1, Kup lane-fastest as above */
+template<int W>
+void Tri3_Stiffness_Batch(const Tri_Coordinates& T, size_t e0, double const* const* C,
+                          double thickness, double* Kup){
+
+  typedef typename Lanes<W>::type V;
+  const double C00 = C[0][0], C01 = C[0][1], C10 = C[1][0], C11 = C[1][1], C22 = C[2][2];
+  V bx[3], by[3], twoA, r[TRI3_DOF][3];
+
+  Tri3_Gradients<W>(T,e0,bx,by,twoA);
+  const V w = twoA*(0.5*thickness);
+  for(int a = 0; a < 3; a++){
+    const V wx = w*bx[a], wy = w*by[a];
+    r[2*a][0]   = wx*C00;  r[2*a][1]   = wx*C10;  r[2*a][2]   = wy*C22;
+    r[2*a+1][0] = wy*C01;  r[2*a+1][1] = wy*C11;  r[2*a+1][2] = wx*C22;
+  }
+
+  int k = 0;
+  for(int i = 0; i < TRI3_DOF; i++){
+    for(int j = i; j < TRI3_DOF; j++){
+      const int b = j/2;
+      const V K = (j % 2 == 0) ? r[i][0]*bx[b] + r[i][2]*by[b]
+                               : r[i][1]*by[b] + r[i][2]*bx[b];
+      memcpy(&Kup[k*W],&K,W*sizeof(double));
+      k++;
+    }
+  }
+}
+
+
+#endif // STIFFKERNEL_HPP
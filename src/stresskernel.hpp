@@ -0,0 +1,198 @@
+#ifndef STRESSKERNEL_HPP
+#define STRESSKERNEL_HPP
+
+#include <cmath>
+#include "stiffkernel.hpp"
+
+/*
+ * Batched quadrilateral stress recovery kernel, one element per SIMD lane
+ * (batches of STIFF_BATCH as for the stiffness), NN nodes and NQ quadrature
+ * points known at compile time.
+ *
+ * At every quadrature point: strains from the shape function gradients,
+ * plane stress from C and the von Mises stress; the values are extrapolated
+ * to the element nodes with the NN x NQ matrix X (least squares fit of the
+ * element's own shape functions through the quadrature points) and the internal forces
+ * sum_q w J t B^T sigma = Ke ue are accumulated on the way.
+ */
+
+#define STRESS_FIELDS 7   // strain xx, yy, xy (engineering), stress xx, yy, xy, von Mises
+
+// flops per element: at every quadrature point strains (8 per node), stresses,
+// von Mises, extrapolation to the nodes and internal forces (10 per node);
+// plus the hourglass forces of the one point rule
+#define QUAD_STRESS_FLOPS(nn,nq) ((8*(nn) + 7 + 9 + 2*(nn)*STRESS_FIELDS + 1 + 10.0*(nn))*(nq) \
+                                  + ((nq) == 1 ? 16 + 6 + 34 : 0))
+
+
+/*
+ * ue[k*W + l] is DOF k of element e0+l. Outputs are lane-fastest as well:
+ * gauss[(q*STRESS_FIELDS + f)*W + l], nodal[(a*STRESS_FIELDS + f)*W + l] and
+ * force[k*W + l].
+ */
+template<int NN, int NQ, int W>
+void Quad_Stress_Batch(const Element_Geometry& G, size_t e0, const double* ue, const double* QW,
+                        double const* const* C, double thickness, const double* X,
+                        double* gauss, double* nodal, double* force){
+
+  typedef typename Lanes<W>::type V;
+  const double C00 = C[0][0], C01 = C[0][1], C10 = C[1][0], C11 = C[1][1], C22 = C[2][2];
+  const int NDOF = QUAD_DOF(NN);
+  V u[NDOF], f[NDOF], nod[NN][STRESS_FIELDS];
+
+  for(int k = 0; k < NDOF; k++){
+    u[k] = Lanes<W>::Load(&ue[k*W]);
+    f[k] = V();
+  }
+  for(int a = 0; a < NN; a++){
+    for(int i = 0; i < STRESS_FIELDS; i++){
+      nod[a][i] = V();
+    }
+  }
+
+  for(int q = 0; q < NQ; q++){
+    V bx[NN], by[NN];
+    V exx = V(), eyy = V(), gxy = V();
+    for(int a = 0; a < NN; a++){
+      bx[a] = Lanes<W>::Load(&G.dN_dx(e0,a,q));
+      by[a] = Lanes<W>::Load(&G.dN_dy(e0,a,q));
+      exx += bx[a]*u[2*a];
+      eyy += by[a]*u[2*a+1];
+      gxy += by[a]*u[2*a] + bx[a]*u[2*a+1];
+    }
+    const V sxx = C00*exx + C01*eyy;
+    const V syy = C10*exx + C11*eyy;
+    const V sxy = C22*gxy;
+
+    V vm = sxx*sxx - sxx*syy + syy*syy + 3.0*sxy*sxy;
+    for(int l = 0; l < W; l++){
+      vm[l] = sqrt(vm[l]);
+    }
+
+    const V val[STRESS_FIELDS] = {exx, eyy, gxy, sxx, syy, sxy, vm};
+    for(int i = 0; i < STRESS_FIELDS; i++){
+      memcpy(&gauss[(q*STRESS_FIELDS + i)*W],&val[i],W*sizeof(double));
+      for(int a = 0; a < NN; a++){
+        nod[a][i] += X[a*NQ + q]*val[i];
+      }
+    }
+
+    const V w = Lanes<W>::Load(&G.J(e0,q))*(thickness*QW[q]);
+    for(int a = 0; a < NN; a++){
+      f[2*a]   += w*(bx[a]*sxx + by[a]*sxy);
+      f[2*a+1] += w*(by[a]*syy + bx[a]*sxy);
+    }
+  }
+
+  for(int a = 0; a < NN; a++){
+    for(int i = 0; i < STRESS_FIELDS; i++){
+      memcpy(&nodal[(a*STRESS_FIELDS + i)*W],&nod[a][i],W*sizeof(double));
+    }
+  }
+  for(int k = 0; k < NDOF; k++){
+    memcpy(&force[k*W],&f[k],W*sizeof(double));
+  }
+}
+
+
+/* one point Quad4: the hourglass part of the internal forces,
+ * k_u gamma (gamma.u) and k_v gamma (gamma.v); the stresses are the centre
+ * values, the stabilization carries no stress */
+template<int W>
+void Quad4_Hourglass_Forces(const Element_Geometry& G, size_t e0, const double* ue,
+                            double const* const* C, double thickness, double QW0, double* force){
+
+  typedef typename Lanes<W>::type V;
+  V ku, kv, g[4], qu = V(), qv = V();
+  Quad4_Hourglass_Stiffness<W>(G,e0,C,thickness,QW0,ku,kv);
+  for(int a = 0; a < 4; a++){
+    g[a] = Lanes<W>::Load(&G.gamma(e0,a));
+    qu += g[a]*Lanes<W>::Load(&ue[(2*a)*W]);
+    qv += g[a]*Lanes<W>::Load(&ue[(2*a+1)*W]);
+  }
+  qu *= ku;
+  qv *= kv;
+  for(int a = 0; a < 4; a++){
+    V fu = Lanes<W>::Load(&force[(2*a)*W]) + g[a]*qu;
+    V fv = Lanes<W>::Load(&force[(2*a+1)*W]) + g[a]*qv;
+    memcpy(&force[(2*a)*W],&fu,W*sizeof(double));
+    memcpy(&force[(2*a+1)*W],&fv,W*sizeof(double));
+  }
+}
+
+
+/* runtime element type and quadrature size -> compile time specialization */
+template<int W>
+void Quad_Stress_Kernel(const Element_Geometry& G, size_t e0, const double* ue, const double* QW,
+                        double const* const* C, double thickness, const double* X,
+                        double* gauss, double* nodal, double* force){
+  const int nen = G.Nodes_per_element(), nq = G.Qpoints();
+  if(nen == 4 && nq == 1){
+    Quad_Stress_Batch<4,1,W>(G,e0,ue,QW,C,thickness,X,gauss,nodal,force);
+    Quad4_Hourglass_Forces<W>(G,e0,ue,C,thickness,QW[0],force);
+  }else if(nen == 4 && nq == 4){
+    Quad_Stress_Batch<4,4,W>(G,e0,ue,QW,C,thickness,X,gauss,nodal,force);
+  }else if(nen == 4 && nq == 9){
+    Quad_Stress_Batch<4,9,W>(G,e0,ue,QW,C,thickness,X,gauss,nodal,force);
+  }else if(nen == 8 && nq == 9){
+    Quad_Stress_Batch<8,9,W>(G,e0,ue,QW,C,thickness,X,gauss,nodal,force);
+  }else if(nen == 9 && nq == 9){
+    Quad_Stress_Batch<9,9,W>(G,e0,ue,QW,C,thickness,X,gauss,nodal,force);
+  }else{
+    assert(false);
+  }
+}
+
+
+/*
+ * Constant strain triangles e0 .. e0+W-1: one set of values per element,
+ * reported at its quadrature point (the centroid) and at its three nodes;
+ * internal forces A t B^T sigma. Layouts as in Quad_Stress_Batch with one
+ * quadrature point and three nodes.
+ */
+#define TRI3_STRESS_FLOPS (TRI3_GRADIENT_FLOPS + 2 + 8*3 + 7 + 9 + 10.0*3)
+
+template<int W>
+void Tri3_Stress_Batch(const Tri_Coordinates& T, size_t e0, const double* ue,
+                       double const* const* C, double thickness,
+                       double* gauss, double* nodal, double* force){
+
+  typedef typename Lanes<W>::type V;
+  const double C00 = C[0][0], C01 = C[0][1], C10 = C[1][0], C11 = C[1][1], C22 = C[2][2];
+  V bx[3], by[3], twoA;
+
+  Tri3_Gradients<W>(T,e0,bx,by,twoA);
+  V exx = V(), eyy = V(), gxy = V();
+  for(int a = 0; a < 3; a++){
+    const V u = Lanes<W>::Load(&ue[(2*a)*W]), v = Lanes<W>::Load(&ue[(2*a+1)*W]);
+    exx += bx[a]*u;
+    eyy += by[a]*v;
+    gxy += by[a]*u + bx[a]*v;
+  }
+  const V sxx = C00*exx + C01*eyy;
+  const V syy = C10*exx + C11*eyy;
+  const V sxy = C22*gxy;
+
+  V vm = sxx*sxx - sxx*syy + syy*syy + 3.0*sxy*sxy;
+  for(int l = 0; l < W; l++){
+    vm[l] = sqrt(vm[l]);
+  }
+
+  const V val[STRESS_FIELDS] = {exx, eyy, gxy, sxx, syy, sxy, vm};
+  for(int i = 0; i < STRESS_FIELDS; i++){
+    memcpy(&gauss[i*W],&val[i],W*sizeof(double));
+    for(int a = 0; a < 3; a++){
+      memcpy(&nodal[(a*STRESS_FIELDS + i)*W],&val[i],W*sizeof(double));
+    }
+  }
+
+  const V w = twoA*(0.5*thickness);
+  for(int a = 0; a < 3; a++){
+    const V fx = w*(bx[a]*sxx + by[a]*sxy), fy = w*(by[a]*syy + bx[a]*sxy);
+    memcpy(&force[(2*a)*W],&fx,W*sizeof(double));
+    memcpy(&force[(2*a+1)*W],&fy,W*sizeof(double));
+  }
+}
+
+
+#endif // STRESSKERNEL_HPP
@@ -0,0 +1,10 @@
+#!/bin/sh
+# Phase benchmark over process counts: every launch appends its runs (sizes x
+# thread counts) to the same JSON lines file.
+#
+# usage: bench_phases.sh <2dFEA executable> "<process counts>" [options]
+#   e.g. bench_phases.sh ./2dFEA "1 2 4" -generate plate_hole -bench_sizes 100,200,400 -bench_threads_list 1,2,4
+exe=$1; ranks=$2; shift 2
+for n in $ranks; do
+  mpiexec -n $n $exe -bench_phases "$@" || exit 1
+done
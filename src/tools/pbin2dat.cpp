@@ -0,0 +1,80 @@
+/*
+ * pbin2dat -> converts the shared files of the parallel output format back
+ * to the text files of the solver, to check them against a text run:
+ *   solution<suffix>.pbin (x y u v)  -> disp_total, disp_u, disp_v<suffix>.dat
+ *   stress.pbin (x y + 7 fields)     -> strain_*.dat, stress_*.dat
+ *
+ * usage: pbin2dat <file.pbin> [suffix]
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include "../writer.hpp"
+
+using namespace std;
+
+
+int main(int argc, char* argv[]){
+
+  if(argc < 2){
+    cerr << "usage: " << argv[0] << " <file.pbin> [suffix]" << endl;
+    return 1;
+  }
+  const string suffix = (argc > 2) ? argv[2] : "";
+
+  FILE* in = fopen(argv[1],"rb");
+  if(in == NULL){
+    cerr << "cannot open " << argv[1] << endl;
+    return 1;
+  }
+  char magic[8];
+  uint64_t n[2];
+  if(fread(magic,1,8,in) != 8 || fread(n,sizeof(uint64_t),2,in) != 2 || string(magic,8) != "2DFEAPAR"){
+    cerr << argv[1] << " is not a parallel output file" << endl;
+    return 1;
+  }
+  if(!Host_Little_Endian()){
+    Swap_Bytes(n[0]);
+    Swap_Bytes(n[1]);
+  }
+  const uint64_t nodes = n[0], values = n[1];
+  vector<double> rec(nodes*values);
+  if(fread(rec.data(),sizeof(double),rec.size(),in) != rec.size()){
+    cerr << argv[1] << " is truncated" << endl;
+    return 1;
+  }
+  fclose(in);
+  if(!Host_Little_Endian()){
+    for(size_t i = 0; i < rec.size(); i++){
+      Swap_Bytes(rec[i]);
+    }
+  }
+
+  vector<string> name;
+  if(values == 4){
+    name = {"disp_u" + suffix + ".dat", "disp_v" + suffix + ".dat"};
+    Buffered_Writer disp_total("disp_total" + suffix + ".dat");
+    for(uint64_t i = 0; i < nodes; i++){
+      disp_total.Write_Line(sqrt(pow(rec[4*i+2],2)+pow(rec[4*i+3],2)));
+    }
+  }else if(values == 9){
+    name = {"strain_xx.dat","strain_yy.dat","strain_xy.dat",
+            "stress_xx.dat","stress_yy.dat","stress_xy.dat","stress_vm.dat"};
+  }else{
+    cerr << "unknown record of " << values << " values" << endl;
+    return 1;
+  }
+
+  // values 0 and 1 of every record are the node coordinates
+  for(size_t f = 0; f < name.size(); f++){
+    Buffered_Writer out(name[f]);
+    for(uint64_t i = 0; i < nodes; i++){
+      out.Write_Line(rec[values*i + 2 + f]);
+    }
+  }
+  cout << argv[1] << ": " << nodes << " nodes, " << values << " values per node" << endl;
+
+  return 0;
+}
@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += pbin2dat.cpp
+
+INCLUDEPATH += -I /usr/local/openmpi/include
+
+QMAKE_CXXFLAGS += -std=c++17 -O3
@@ -0,0 +1,274 @@
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <mpi.h>
+
+using namespace std;
+
+/* result files: one value per line (text), raw little endian doubles
+ * (binary), VTK XML unstructured grid with appended raw data (vtk), or node
+ * records written by all processes into one shared file (parallel) */
+typedef enum {OUT_TEXT, OUT_BINARY, OUT_VTK, OUT_PARALLEL} Output_Format;
+static const char* const output_format_names[] = {"text","binary","vtk","parallel","Output_Format","OUT_",NULL};
+
+
+inline bool Host_Little_Endian(){
+  const uint16_t one = 1;
+  return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+template<class T> inline void Swap_Bytes(T& v){
+  unsigned char b[sizeof(T)];
+  memcpy(b,&v,sizeof(T));
+  for(size_t k = 0; k < sizeof(T)/2; k++){
+    swap(b[k],b[sizeof(T)-1-k]);
+  }
+  memcpy(&v,b,sizeof(T));
+}
+
+
+/*
+ * CLASS BUFFERED_WRITER -> file written in large blocks through one buffer,
+ * counts the bytes written. Numbers are stored little endian whatever the
+ * host byte order.
+ */
+class Buffered_Writer{
+private:
+  FILE* file;
+  vector<char> buffer;
+  size_t used;
+  size_t bytes;
+
+  void Flush(){
+    if(used > 0){
+      size_t n = fwrite(&buffer[0],1,used,file);
+      assert(n == used);
+      used = 0;
+    }
+  }
+
+public:
+  Buffered_Writer(string const& filename, size_t block = 1 << 22)
+    : buffer(block), used(0), bytes(0)
+  {
+    file = fopen(filename.c_str(),"wb");
+    assert(file != NULL);
+  }
+
+  ~Buffered_Writer(){
+    Close();
+  }
+
+  void Write(const void* p, size_t n){
+    const char* c = static_cast<const char*>(p);
+    bytes += n;
+    if(used + n > buffer.size()){
+      Flush();
+      if(n >= buffer.size()){
+        size_t m = fwrite(c,1,n,file);
+        assert(m == n);
+        return;
+      }
+    }
+    memcpy(&buffer[used],c,n);
+    used += n;
+  }
+
+  template<class T> void Write_LE(const T* v, size_t n){
+    if(Host_Little_Endian()){
+      Write(v,n*sizeof(T));
+      return;
+    }
+    for(size_t i = 0; i < n; i++){
+      T b = v[i];
+      Swap_Bytes(b);
+      Write(&b,sizeof(T));
+    }
+  }
+
+  void Write(string const& s){
+    Write(s.data(),s.size());
+  }
+
+  /* one value per line, formatted like an ostream with default settings */
+  void Write_Line(double v){
+    char s[32];
+    int n = snprintf(s,sizeof(s),"%g\n",v);
+    Write(s,n);
+  }
+
+  size_t Bytes() const {return bytes;}
+
+  void Close(){
+    if(file != NULL){
+      Flush();
+      fclose(file);
+      file = NULL;
+    }
+  }
+};
+
+
+/*
+ * CLASS VTK_WRITER -> VTK XML unstructured grid (.vtu), all arrays in one
+ * appended raw block (UInt64 size headers, little endian), written through a
+ * Buffered_Writer. Point data are in mesh node order.
+ */
+class VTK_Writer{
+private:
+  typedef struct {
+    string name;
+    int ncomp;
+    vector<double> value;
+  } Point_Field;
+
+  vector<double> points;              // x, y, z per node
+  vector<int32_t> connectivity, offsets;
+  vector<uint8_t> types;
+  vector<Point_Field> fields;
+
+  template<class T> static uint64_t Block_Bytes(const vector<T>& v){
+    return sizeof(uint64_t) + v.size()*sizeof(T);
+  }
+
+  template<class T> static void Write_Block(Buffered_Writer& out, const vector<T>& v){
+    const uint64_t n = v.size()*sizeof(T);
+    out.Write_LE(&n,1);
+    out.Write_LE(v.data(),v.size());
+  }
+
+public:
+  static const uint8_t VTK_TRIANGLE = 5;
+  static const uint8_t VTK_QUAD = 9;
+  static const uint8_t VTK_QUADRATIC_QUAD = 23;
+  static const uint8_t VTK_BIQUADRATIC_QUAD = 28;
+
+  void Set_Points(vector<double> const& xyz){
+    points = xyz;
+  }
+
+  /* cell c has the nodes conn[offs[c]-n .. offs[c]-1], offsets as in VTK */
+  void Set_Cells(vector<int32_t> const& conn, vector<int32_t> const& offs, vector<uint8_t> const& type){
+    connectivity = conn;
+    offsets = offs;
+    types = type;
+  }
+
+  void Add_Point_Data(string const& name, int ncomp, vector<double> const& value){
+    assert(value.size() == size_t(ncomp)*(points.size()/3));
+    Point_Field f;
+    f.name = name;
+    f.ncomp = ncomp;
+    f.value = value;
+    fields.push_back(f);
+  }
+
+  /* returns the bytes written */
+  size_t Write(string const& filename) const {
+
+    ostringstream xml;
+    uint64_t off = 0;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+        << "  <UnstructuredGrid>\n"
+        << "    <Piece NumberOfPoints=\"" << points.size()/3 << "\" NumberOfCells=\"" << types.size() << "\">\n"
+        << "      <PointData>\n";
+    for(size_t i = 0; i < fields.size(); i++){
+      xml << "        <DataArray type=\"Float64\" Name=\"" << fields[i].name << "\" NumberOfComponents=\""
+          << fields[i].ncomp << "\" format=\"appended\" offset=\"" << off << "\"/>\n";
+      off += Block_Bytes(fields[i].value);
+    }
+    xml << "      </PointData>\n"
+        << "      <Points>\n"
+        << "        <DataArray type=\"Float64\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << off << "\"/>\n"
+        << "      </Points>\n";
+    off += Block_Bytes(points);
+    xml << "      <Cells>\n"
+        << "        <DataArray type=\"Int32\" Name=\"connectivity\" format=\"appended\" offset=\"" << off << "\"/>\n";
+    off += Block_Bytes(connectivity);
+    xml << "        <DataArray type=\"Int32\" Name=\"offsets\" format=\"appended\" offset=\"" << off << "\"/>\n";
+    off += Block_Bytes(offsets);
+    xml << "        <DataArray type=\"UInt8\" Name=\"types\" format=\"appended\" offset=\"" << off << "\"/>\n"
+        << "      </Cells>\n"
+        << "    </Piece>\n"
+        << "  </UnstructuredGrid>\n"
+        << "  <AppendedData encoding=\"raw\">\n_";
+
+    Buffered_Writer out(filename);
+    out.Write(xml.str());
+    for(size_t i = 0; i < fields.size(); i++){
+      Write_Block(out,fields[i].value);
+    }
+    Write_Block(out,points);
+    Write_Block(out,connectivity);
+    Write_Block(out,offsets);
+    Write_Block(out,types);
+    out.Write(string("\n  </AppendedData>\n</VTKFile>\n"));
+    out.Close();
+    return out.Bytes();
+  }
+};
+
+
+/*
+ * Node records in one shared file, every process writing its own nodes with
+ * one collective MPI-IO call. Layout (little endian):
+ *   char[8] "2DFEAPAR", uint64 nodes, uint64 values per node,
+ *   nodes x values doubles in file node order.
+ * index holds the file node index of every local record, ascending; rec the
+ * records, values doubles each (byte swapped in place on big endian hosts).
+ * Returns the size of the file.
+ */
+inline size_t Write_Node_Records(string const& filename, uint64_t nodes, uint64_t values,
+                                 vector<int> const& index, vector<double>& rec, MPI_Comm comm){
+
+  assert(rec.size() == index.size()*values);
+  if(!Host_Little_Endian()){
+    for(size_t i = 0; i < rec.size(); i++){
+      Swap_Bytes(rec[i]);
+    }
+  }
+
+  MPI_File fh;
+  int rank;
+  MPI_Comm_rank(comm,&rank);
+  MPI_File_open(comm,filename.c_str(),MPI_MODE_CREATE | MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
+  MPI_File_set_size(fh,0);
+
+  const MPI_Offset header = 8 + 2*sizeof(uint64_t);
+  if(rank == 0){
+    char h[header];
+    uint64_t n[2] = {nodes,values};
+    if(!Host_Little_Endian()){
+      Swap_Bytes(n[0]);
+      Swap_Bytes(n[1]);
+    }
+    memcpy(h,"2DFEAPAR",8);
+    memcpy(h+8,n,sizeof(n));
+    MPI_File_write_at(fh,0,h,header,MPI_BYTE,MPI_STATUS_IGNORE);
+  }
+
+  // one record per node; the file view of a process selects its own records
+  MPI_Datatype record, view;
+  MPI_Type_contiguous(values,MPI_DOUBLE,&record);
+  MPI_Type_commit(&record);
+  MPI_Type_create_indexed_block(index.size(),1,index.data(),record,&view);
+  MPI_Type_commit(&view);
+  MPI_File_set_view(fh,header,record,view,"native",MPI_INFO_NULL);
+  MPI_File_write_all(fh,rec.data(),index.size(),record,MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  MPI_Type_free(&view);
+  MPI_Type_free(&record);
+
+  return header + nodes*values*sizeof(double);
+}
+
+
+#endif // WRITER_HPP
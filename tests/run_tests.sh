@@ -0,0 +1,237 @@
+#!/bin/sh
+#
+# Regression checks of 2dFEA on the meshes of input_files. Every check runs
+# the program in a scratch directory and inspects the files it writes.
+#
+# usage: tests/run_tests.sh <2dFEA executable>
+#
+
+exe=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+root=$(cd "$(dirname "$0")/.." && pwd)
+scratch=$(mktemp -d)
+failed=0
+meshes="1Quad 4x4Quad L-plate plate_hole"
+
+# run <name> <mesh> [options]: the mesh, of input_files or else of tests,
+# is read as 4x4Quad.dat
+run(){
+  name=$1; mesh=$2; shift 2
+  dir=$scratch/$name
+  mkdir -p $dir
+  src=$root/input_files/$mesh.dat
+  [ -f $src ] || src=$root/tests/$mesh.dat
+  cp $src $dir/4x4Quad.dat
+  (cd $dir && $exe "$@" > log.txt 2>&1)
+  status=$?
+  if [ $status -ne 0 ]; then
+    fail "$name: exit status $status, see $dir/log.txt"
+    return 1
+  fi
+  if ! grep -q "Program Finished!" $dir/log.txt; then
+    fail "$name: run did not finish, see $dir/log.txt"
+    return 1
+  fi
+}
+
+fail(){
+  echo "FAIL $1"
+  failed=1
+}
+
+# zero <file> <lines>: the values on the given lines are zero
+zero(){
+  awk -v lines="$2" 'BEGIN{n = split(lines,l," "); for(i = 1; i <= n; i++) want[l[i]] = 1}
+                     (NR in want) && ($1 > 1e-12 || $1 < -1e-12){bad = 1}
+                     END{exit bad}' $1
+}
+
+# same <file> <file> [tol]: equal values up to a relative tol (default 1e-9)
+# of the largest
+same(){
+  paste $1 $2 | awk -v tol=${3:-1e-9} '{d = $1 - $2; if(d < 0) d = -d; if(d > dmax) dmax = d;
+                                       a = $1 < 0 ? -$1 : $1; if(a > amax) amax = a}
+                                      END{exit !(NR > 0 && dmax <= tol*amax)}'
+}
+
+# agree <name> <mesh> [tol]: the displacements of run <name> are those of
+# the default run on <mesh>, up to the solver tolerance (default 1e-6)
+agree(){
+  for f in disp_u disp_v; do
+    if ! same $scratch/$1/$f.dat $scratch/default_$2/$f.dat ${3:-1e-6}; then
+      fail "$1: $f.dat differs from the default run"
+      return 1
+    fi
+  done
+}
+
+# patch <name>: the load case "patch" of run <name> gives the uniaxial strain
+# u = 1e-4 x, v = 0 at every node, up to a relative 1e-5 (6 digit output)
+patch(){
+  d=$scratch/$1
+  paste $d/disp_u_patch.dat $d/disp_v_patch.dat | awk -v a=1e-4 '
+    FNR == 1 {file++}
+    file == 1 {if($1 == "#Nodes") nodes = 1; else if($1 == "-1") nodes = 0;
+               else if(nodes){x[$1] = $2; n++; if($2 > xmax) xmax = $2}
+               next}
+    {du = $1 - a*x[FNR]; if(du < 0) du = -du; dv = $2 < 0 ? -$2 : $2;
+     if(du > dmax) dmax = du; if(dv > dmax) dmax = dv}
+    END{exit !(FNR == n && n > 0 && dmax <= 1e-5*a*xmax)}' $d/4x4Quad.dat - \
+    || fail "$1: the patch test is not passed"
+}
+
+
+# default runs, the reference of the variants below
+for mesh in $meshes; do
+  run default_$mesh $mesh
+done
+
+
+# a load case with forces on a FIXED node: they are dropped in every
+# constraint mode, the displacements are those of the free load alone
+fixed="1 16 15 14 10"
+for mode in zero_rows symmetric eliminate; do
+  if run load_fixed_$mode 4x4Quad -load_cases $root/tests/load_fixed.txt -constraints $mode; then
+    d=$scratch/load_fixed_$mode
+    zero $d/disp_u_fixed.dat "$fixed" && zero $d/disp_v_fixed.dat "$fixed" \
+      || fail "load_fixed_$mode: nonzero displacement of a FIXED node"
+    same $d/disp_v_fixed.dat $d/disp_v_tip.dat \
+      || fail "load_fixed_$mode: the force on the FIXED node changed the solution"
+  fi
+done
+
+
+# parameter sweep in every constraint mode: the matrix is assembled again
+# after the constraints, and the variant of the program's own material
+# (E = 3e7) reproduces the direct solve
+for mode in zero_rows symmetric eliminate; do
+  if run sweep_$mode 4x4Quad -sweep_E 1e7,3e7 -sweep_write -constraints $mode; then
+    d=$scratch/sweep_$mode
+    grep -q "^Sweep: 2 variants" $d/log.txt || fail "sweep_$mode: no sweep summary"
+    same $d/disp_v_sweep1.dat $d/disp_v.dat \
+      || fail "sweep_$mode: the sweep differs from the direct solve"
+  fi
+done
+
+
+# block formats: BAIJ, and SBAIJ with symmetric constraints, give the
+# displacements of AIJ
+for mesh in $meshes; do
+  for fmt in baij sbaij; do
+    if run ${fmt}_$mesh $mesh -mat_type $fmt; then
+      grep -Eq "^Stiffness matrix \((seq|mpi)?$fmt\)" $scratch/${fmt}_$mesh/log.txt \
+        || fail "${fmt}_$mesh: the matrix is not $fmt"
+      agree ${fmt}_$mesh $mesh
+    fi
+  done
+done
+
+
+# matrix-free operator, element matrices stored or recomputed, serial and
+# applied by element colors: the displacements of the assembled matrix
+for mesh in $meshes; do
+  for mf in stored recompute; do
+    for nt in 0 2; do
+      name=mf_${mf}_${nt}_$mesh
+      if run $name $mesh -matrix_free $mf -num_threads $nt; then
+        grep -q "^Stiffness operator (matrix-free, element matrices $mf" $scratch/$name/log.txt \
+          || fail "$name: not solved with the matrix-free operator"
+        agree $name $mesh
+      fi
+    done
+  done
+done
+
+
+# constraint modes: symmetric elimination during assembly and the reduced
+# system of the free DOFs give the displacements of zeroed rows
+for mesh in $meshes; do
+  for mode in symmetric eliminate; do
+    run ${mode}_$mesh $mesh -constraints $mode && agree ${mode}_$mesh $mesh
+  done
+  if [ -f $scratch/eliminate_$mesh/log.txt ]; then
+    grep -q "^Reduced stiffness matrix" $scratch/eliminate_$mesh/log.txt \
+      || fail "eliminate_$mesh: no reduced system"
+  fi
+done
+
+
+# RCM node ordering: the same displacements, written in file node order
+for mesh in $meshes; do
+  if run rcm_$mesh $mesh -rcm; then
+    grep -q "^Node ordering (RCM)" $scratch/rcm_$mesh/log.txt || fail "rcm_$mesh: nodes not reordered"
+    agree rcm_$mesh $mesh
+  fi
+done
+
+
+# patch test of the quadratic elements, 2x2 elements around an off-grid
+# node read with 8 and 9 node connectivity: the consistent edge loads of a
+# uniaxial strain reproduce it exactly
+for mesh in patch_quad8 patch_quad9; do
+  run $mesh $mesh -load_cases $root/tests/patch_quadratic.txt && patch $mesh
+done
+
+
+# patch test of the triangles, alone and mixed with quadrilaterals (two of
+# the four quadrilaterals split), the latter also threaded
+for mesh in patch_tri3 patch_mixed; do
+  run $mesh $mesh -load_cases $root/tests/patch_linear.txt && patch $mesh
+done
+run patch_mixed_threads patch_mixed -load_cases $root/tests/patch_linear.txt -num_threads 2 \
+  && patch patch_mixed_threads
+
+
+# one point Quad4 with hourglass stabilization: the stabilization leaves
+# linear fields alone (patch test), and on L-plate the element is softer than
+# the fully integrated one by less than 5% in the largest displacement
+if run patch_reduced patch_quad4 -load_cases $root/tests/patch_linear.txt -quadrature reduced; then
+  grep -q "^Quadrature = .*1 Point (reduced, hourglass stabilized)" $scratch/patch_reduced/log.txt \
+    || fail "patch_reduced: not the reduced rule"
+  patch patch_reduced
+fi
+if run reduced_L-plate L-plate -quadrature reduced; then
+  paste $scratch/default_L-plate/disp_total.dat $scratch/reduced_L-plate/disp_total.dat \
+    | awk '{if($1 > full) full = $1; if($2 > reduced) reduced = $2}
+           END{exit !(full > 0 && reduced >= full && reduced <= 1.05*full)}' \
+    || fail "reduced_L-plate: largest displacement not within 5% above full integration"
+fi
+
+
+# mesh cache: a second run maps the cache written by the first one and gives
+# the same displacements. Moving a node without changing the file size, with
+# the same mtime seconds, makes the cache stale: it is parsed again.
+if run cache L-plate; then
+  d=$scratch/cache
+  cp $d/disp_v.dat $d/disp_v_parsed.dat
+  if [ ! -f $d/4x4Quad.dat.bin ]; then
+    fail "cache: no mesh cache written"
+  elif (cd $d && $exe > log_mapped.txt 2>&1); then
+    grep -q " [1-9][0-9]* bytes mapped from the mesh cache" $d/log_mapped.txt \
+      || fail "cache: the second run did not map the mesh cache"
+    same $d/disp_v.dat $d/disp_v_parsed.dat \
+      || fail "cache: the cached mesh changed the solution"
+
+    mtime=$(stat -c %Y $d/4x4Quad.dat)
+    size=$(stat -c %s $d/4x4Quad.dat)
+    sed -i '/^ *26 /s/1.000000000E+001/1.050000000E+001/' $d/4x4Quad.dat
+    touch -d "@$mtime.5" $d/4x4Quad.dat
+    [ $(stat -c %s $d/4x4Quad.dat) -eq $size ] || fail "cache: the edit changed the mesh size"
+    if (cd $d && $exe > log_stale.txt 2>&1); then
+      grep -q " 0 bytes mapped from the mesh cache" $d/log_stale.txt \
+        || fail "cache: a stale mesh cache was mapped"
+      same $d/disp_v.dat $d/disp_v_parsed.dat \
+        && fail "cache: the moved node did not change the solution"
+    else
+      fail "cache: run on the edited mesh failed, see $d/log_stale.txt"
+    fi
+  else
+    fail "cache: second run failed, see $d/log_mapped.txt"
+  fi
+fi
+
+
+if [ $failed -eq 0 ]; then
+  echo "All tests passed"
+  rm -rf $scratch
+fi
+exit $failed